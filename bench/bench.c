@@ -0,0 +1,281 @@
+// Microbenchmarks for the parser and builtin lookup, and end-to-end
+// command throughput through the executor. Built and run by `make bench`;
+// results are printed as CSV (default) or JSON for comparing runs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "shell.h"
+#include "execute.h"
+#include "builtin.h"
+#include "parse.h"
+#include "input.h"
+
+#define BENCH_DEFAULT_SECONDS 0.5
+#define BENCH_LONG_LINE_ARGS 500
+
+typedef struct {
+    const char* name;
+    const char* group;
+    long iterations;
+    double seconds;
+} BenchResult;
+
+static BenchResult results[32];
+static int result_count = 0;
+static double min_seconds = BENCH_DEFAULT_SECONDS;
+
+// ==================== CORPORA ====================
+static const char* parse_corpus[] = {
+    "ls -la /tmp",
+    "echo \"Hello World\"",
+    "grep -n 'pattern with spaces' src/main.c src/parse.c",
+    "cat < input.txt | sort | uniq -c | sort -rn | head -20 > out.txt",
+    "make -j8 CFLAGS=\"-O2 -g\" all >> build.log",
+    "printf '%s\\n' a\\ b \"c d\" 'e f' &",
+    "find . -name '*.c' | xargs wc -l | tail -1",
+    "sleep 1 &",
+    NULL
+};
+
+static const char* builtin_corpus[] = {
+    "cd", "echo", "ls", "cat", "grep", "pwd", "test", "sort", "[", "exit",
+    "printf", "make", "parallel", "kill", "awk", "true", NULL
+};
+
+// One long generated line (xargs-style), rebuilt identically every run
+static char* long_line = NULL;
+
+static void build_corpora(void) {
+    size_t cap = BENCH_LONG_LINE_ARGS * 32 + 64;
+    long_line = malloc(cap);
+    if (!long_line) {
+        perror("malloc");
+        exit(1);
+    }
+
+    size_t len = snprintf(long_line, cap, "rm -f");
+    for (int i = 0; i < BENCH_LONG_LINE_ARGS; i++) {
+        len += snprintf(long_line + len, cap - len,
+                        i % 4 == 0 ? " 'build/obj %d.o'" : " build/obj_%d.o", i);
+    }
+}
+
+// ==================== TIMING ====================
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run fn in doubling batches until min_seconds have passed
+static void run_bench(const char* group, const char* name, long (*fn)(void* arg, long n), void* arg) {
+    long batch = 1;
+    long total = 0;
+    double elapsed = 0;
+
+    fn(arg, 1);   // warm-up: caches, arena chunks, path cache
+    while (elapsed < min_seconds) {
+        double start = now_seconds();
+        total += fn(arg, batch);
+        elapsed += now_seconds() - start;
+        if (batch < (1L << 20)) batch *= 2;
+    }
+
+    if (result_count < (int)(sizeof(results) / sizeof(results[0]))) {
+        results[result_count++] = (BenchResult){name, group, total, elapsed};
+    }
+    fprintf(stderr, "  %-24s %10.0f ops/s\n", name, total / elapsed);
+}
+
+// ==================== PARSER BENCHMARKS ====================
+static long bench_lex(void* arg, long n) {
+    const char** lines = arg;
+    static char buf[64 * 1024];
+    long ops = 0;
+
+    for (long i = 0; i < n; i++) {
+        for (int j = 0; lines[j]; j++, ops++) {
+            // lex_line() cuts the line in place, so lex a fresh copy
+            strcpy(buf, lines[j]);
+            Token* tokens;
+            int count;
+            lex_line(buf, &tokens, &count);
+        }
+        parse_reset();
+    }
+    return ops;
+}
+
+static long bench_parse(void* arg, long n) {
+    const char** lines = arg;
+    long ops = 0;
+
+    for (long i = 0; i < n; i++) {
+        for (int j = 0; lines[j]; j++, ops++) {
+            Command* cmd = NULL;
+            if (parse_input(lines[j], &cmd) && cmd) {
+                command_destroy(cmd);
+            }
+        }
+        parse_reset();
+    }
+    return ops;
+}
+
+static long bench_get_builtin(void* arg, long n) {
+    const char** names = arg;
+    long ops = 0;
+    volatile int found = 0;
+
+    for (long i = 0; i < n; i++) {
+        for (int j = 0; names[j]; j++, ops++) {
+            found += get_builtin(names[j]) != NULL;
+        }
+    }
+    return ops;
+}
+
+// ==================== END-TO-END BENCHMARKS ====================
+typedef struct {
+    Shell* shell;
+    const char* line;
+    int builtin;      // run through execute_builtin() (redirection setup)
+} ExecBench;
+
+static long bench_execute(void* arg, long n) {
+    ExecBench* eb = arg;
+
+    for (long i = 0; i < n; i++) {
+        Command* cmd = NULL;
+        if (!parse_input(eb->line, &cmd) || !cmd) {
+            fprintf(stderr, "bench: cannot parse '%s'\n", eb->line);
+            exit(1);
+        }
+
+        if (eb->builtin) {
+            execute_builtin(eb->shell, cmd);
+        } else if (cmd->pipe_next) {
+            execute_pipeline(eb->shell, cmd);
+        } else {
+            execute_external(eb->shell, cmd);
+        }
+        command_destroy(cmd);
+        parse_reset();
+    }
+    return n;
+}
+
+// A shell reading an empty script, logging into a scratch directory
+static Shell* bench_shell(char* dir) {
+    if (!mkdtemp(dir) || chdir(dir) < 0) {
+        perror("bench: scratch directory");
+        exit(1);
+    }
+
+    Shell* shell = create_shell();
+    if (!shell) exit(1);
+    shell->input = input_open_string("");
+    shell_init(shell);
+    return shell;
+}
+
+// ==================== REPORTING ====================
+static void print_csv(void) {
+    printf("group,name,iterations,seconds,ops_per_sec,ns_per_op\n");
+    for (int i = 0; i < result_count; i++) {
+        BenchResult* r = &results[i];
+        printf("%s,%s,%ld,%.6f,%.1f,%.1f\n", r->group, r->name, r->iterations,
+               r->seconds, r->iterations / r->seconds, r->seconds * 1e9 / r->iterations);
+    }
+}
+
+static void print_json(void) {
+    printf("{\n  \"results\": [\n");
+    for (int i = 0; i < result_count; i++) {
+        BenchResult* r = &results[i];
+        printf("    {\"group\": \"%s\", \"name\": \"%s\", \"iterations\": %ld, "
+               "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"ns_per_op\": %.1f}%s\n",
+               r->group, r->name, r->iterations, r->seconds,
+               r->iterations / r->seconds, r->seconds * 1e9 / r->iterations,
+               i + 1 < result_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: myshell-bench [--format csv|json] [--time seconds]\n");
+}
+
+int main(int argc, char** argv) {
+    int json = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            json = strcmp(argv[++i], "json") == 0;
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            min_seconds = atof(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (min_seconds <= 0) min_seconds = BENCH_DEFAULT_SECONDS;
+
+    build_corpora();
+    const char* long_corpus[] = {long_line, NULL};
+
+    fprintf(stderr, "parse:\n");
+    run_bench("parse", "lex_line", bench_lex, parse_corpus);
+    run_bench("parse", "lex_line_long", bench_lex, long_corpus);
+    run_bench("parse", "parse_input", bench_parse, parse_corpus);
+    run_bench("parse", "parse_input_long", bench_parse, long_corpus);
+    run_bench("parse", "get_builtin", bench_get_builtin, builtin_corpus);
+
+    // Children write into the scratch directory; keep the report clean
+    char dir[] = "/tmp/myshell-bench.XXXXXX";
+    Shell* shell = bench_shell(dir);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || devnull < 0 || dup2(devnull, STDOUT_FILENO) < 0) {
+        perror("bench: /dev/null");
+        return 1;
+    }
+    close(devnull);
+
+    fprintf(stderr, "execute:\n");
+    ExecBench external = {shell, "true", 0};
+    // true and cat are builtins too: name the binaries to measure spawned
+    // stages. true | true runs both stages in the shell; cat reads its
+    // stdin, so the cat pipeline measures forked builtin stages
+    ExecBench pipe2_stage = {shell, "/bin/true | /bin/true", 0};
+    ExecBench pipe5_stage = {shell, "/bin/cat /dev/null | /bin/cat | /bin/cat | /bin/cat | /bin/cat", 0};
+    ExecBench pipe2_builtin = {shell, "true | true", 0};
+    ExecBench pipe5_builtin = {shell, "cat /dev/null | cat | cat | cat | cat", 0};
+    ExecBench redir_external = {shell, "true < /dev/null > out.txt", 0};
+    ExecBench redir_builtin = {shell, "true < /dev/null > out.txt", 1};
+    run_bench("execute", "external", bench_execute, &external);
+    run_bench("execute", "pipeline_2", bench_execute, &pipe2_stage);
+    run_bench("execute", "pipeline_5", bench_execute, &pipe5_stage);
+    run_bench("execute", "pipeline_builtin_2", bench_execute, &pipe2_builtin);
+    run_bench("execute", "pipeline_builtin_5", bench_execute, &pipe5_builtin);
+    run_bench("execute", "redirect_external", bench_execute, &redir_external);
+    run_bench("execute", "redirect_builtin", bench_execute, &redir_builtin);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    destroy_shell(shell);
+    unlink("out.txt");
+    unlink("myshell.log");
+    rmdir(dir);
+    free(long_line);
+
+    if (json) {
+        print_json();
+    } else {
+        print_csv();
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Thin client for myshell --server: sends a command line (or a script)
+// with this process's stdin, stdout and stderr to a pre-started shell and
+// exits with the commands' status. Built by `make` as bin/myshell-client.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+// Status when the server could not be reached or went away
+#define CLIENT_FAILURE 255
+
+static void usage(void) {
+    fprintf(stderr, "usage: myshell-client [-s socket] -c command\n");
+    fprintf(stderr, "       myshell-client [-s socket] script\n");
+    fprintf(stderr, "The socket defaults to $MYSHELL_SERVER.\n");
+}
+
+static char* read_script(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    char* text = malloc(st.st_size + 1);
+    size_t got = 0;
+    while (text && got < (size_t)st.st_size) {
+        ssize_t n = read(fd, text + got, st.st_size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+    if (!text) perror("malloc");
+    *len = got;
+    return text;
+}
+
+static int send_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Header, cwd and the start of the text in one message carrying our stdio
+static int send_request(int sock, const char* cwd, const char* text, size_t text_len) {
+    ServerRequest req = {SERVER_MAGIC, strlen(cwd), text_len};
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov[3] = {
+        {&req, sizeof(req)},
+        {(void*)cwd, req.cwd_len},
+        {(void*)text, text_len},
+    };
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+
+    // A large script may not fit in one message
+    size_t sent = n;
+    size_t total = sizeof(req) + req.cwd_len + text_len;
+    if (sent < sizeof(req) + req.cwd_len) {
+        return -1;   // the header and cwd are far below any socket buffer
+    }
+    size_t text_sent = sent - sizeof(req) - req.cwd_len;
+    return sent < total ? send_all(sock, text + text_sent, text_len - text_sent) : 0;
+}
+
+int main(int argc, char** argv) {
+    const char* path = getenv("MYSHELL_SERVER");
+    char* text = NULL;
+    size_t text_len = 0;
+
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+        path = argv[i + 1];
+        i += 2;
+    }
+    if (i + 1 < argc && strcmp(argv[i], "-c") == 0 && i + 2 == argc) {
+        text = strdup(argv[i + 1]);
+        text_len = strlen(argv[i + 1]);
+    } else if (i + 1 == argc && argv[i][0] != '-') {
+        text = read_script(argv[i], &text_len);
+        if (!text) return CLIENT_FAILURE;
+    } else {
+        usage();
+        return 2;
+    }
+    if (!path || !text) {
+        if (!path) usage();
+        free(text);
+        return 2;
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        free(text);
+        return CLIENT_FAILURE;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        free(text);
+        return CLIENT_FAILURE;
+    }
+
+    if (send_request(sock, cwd, text, text_len) < 0) {
+        perror("myshell-client: send");
+        free(text);
+        return CLIENT_FAILURE;
+    }
+    free(text);
+
+    // The commands write to our descriptors directly; wait for the status
+    int32_t status;
+    size_t got = 0;
+    while (got < sizeof(status)) {
+        ssize_t n = recv(sock, (char*)&status + got, sizeof(status) - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "myshell-client: server closed the connection\n");
+            return CLIENT_FAILURE;
+        }
+        got += n;
+    }
+    close(sock);
+    return status & 0xff;
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+// Bump allocator: allocations are only released all at once by
+// arena_reset(), which keeps the chunks for reuse
+typedef struct {
+    ArenaChunk* first;
+    ArenaChunk* current;
+    size_t chunk_size;
+    unsigned long chunk_allocs;   // malloc() calls made for chunks
+} Arena;
+
+// Position to roll back to with arena_rewind()
+typedef struct {
+    ArenaChunk* chunk;
+    size_t used;
+} ArenaMark;
+
+void arena_init(Arena* arena, size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* str, size_t len);
+char* arena_strdup(Arena* arena, const char* str);
+void arena_reset(Arena* arena);
+ArenaMark arena_mark(Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+void arena_destroy(Arena* arena);
+
+#endif
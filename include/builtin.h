@@ -4,23 +4,50 @@
 #include "shell.h"
 
 // Builtin command function pointer type
-typedef int (*BuiltinFunc)(Command* cmd);
+typedef int (*BuiltinFunc)(Shell* self, Command* cmd);
 
 // Builtin command structure
-typedef struct {
+struct BuiltinCommand {
     char* name;
     BuiltinFunc func;
-} BuiltinCommand;
+    int stage;      // runs as a pipeline stage in the shell: reads no
+                    // stdin, writes a bounded output, keeps shell state
+};
 
 // Builtin functions
-int builtin_cd(Command* cmd);
-int builtin_exit(Command* cmd);
-int builtin_pwd(Command* cmd);
-int builtin_help(Command* cmd);
+int builtin_cd(Shell* self, Command* cmd);
+int builtin_exit(Shell* self, Command* cmd);
+int builtin_pwd(Shell* self, Command* cmd);
+int builtin_help(Shell* self, Command* cmd);
+int builtin_hash(Shell* self, Command* cmd);
+int builtin_stats(Shell* self, Command* cmd);
+int builtin_set(Shell* self, Command* cmd);
+int builtin_export(Shell* self, Command* cmd);
+int builtin_unset(Shell* self, Command* cmd);
+int builtin_run(Shell* self, Command* cmd);
+int builtin_jobs(Shell* self, Command* cmd);
+int builtin_fg(Shell* self, Command* cmd);
+int builtin_bg(Shell* self, Command* cmd);
+int builtin_wait(Shell* self, Command* cmd);
+int builtin_kill(Shell* self, Command* cmd);
+int builtin_true(Shell* self, Command* cmd);
+int builtin_false(Shell* self, Command* cmd);
+int builtin_echo(Shell* self, Command* cmd);
+int builtin_printf(Shell* self, Command* cmd);
+int builtin_test(Shell* self, Command* cmd);
+int builtin_cat(Shell* self, Command* cmd);
+int builtin_parallel(Shell* self, Command* cmd);
+int builtin_history(Shell* self, Command* cmd);
+int builtin_cache(Shell* self, Command* cmd);
+int builtin_logq(Shell* self, Command* cmd);
+int builtin_break(Shell* self, Command* cmd);
+int builtin_continue(Shell* self, Command* cmd);
+int builtin_return(Shell* self, Command* cmd);
 
 // Builtin registry
 BuiltinCommand* get_builtin(const char* name);
 int is_builtin_command(Command* cmd);
-int execute_builtin(Command* cmd);
+int is_shell_stage(Command* cmd);
+int execute_builtin(Shell* self, Command* cmd);
 
 #endif
\ No newline at end of file
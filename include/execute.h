@@ -2,9 +2,7 @@
 #define EXECUTE_H
 
 #include "shell.h"
-
-// Command lifecycle
-void command_destroy(Command* cmd);
+#include "jobs.h"
 
 // Shell lifecycle
 Shell* create_shell();
@@ -16,8 +14,16 @@ void shell_run(Shell* self);
 // Execution functions
 void execute_command(Shell* self, Command* cmd);
 int execute_external(Shell* self, Command* cmd);
-int execute_pipeline(Shell* self, Command* cmd1, Command* cmd2);
+int execute_pipeline(Shell* self, Command* cmd);
+Job* execute_start(Shell* self, Command* cmd, int count, int in_fd, int out_fd, pid_t pgid);
+
+// Redirections: targets are opened in the shell, then applied in the
+// child or, for builtins, to the shell's own descriptors
+int open_redirections(Command* cmd);
+void close_redirections(Command* cmd);
+int redirection_source(const Redirection* r);
+int apply_redirections(Command* cmd, Shell* self);
 int setup_redirections(Shell* self, Command* cmd);
-void restore_std_fds(Shell* self);
+void restore_redirections(Shell* self);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+// Pipes the shell makes for a job; MYSHELL_PIPE_SIZE (bytes, K or M)
+// sets their capacity with F_SETPIPE_SZ, otherwise the kernel's default
+int pipe_open_sized(int fds[2]);
+
+// producer |> (consumer) (consumer) ...: every consumer reads a copy of
+// the producer's output. The bytes never pass through user space: a
+// relay thread tee(2)s the producer's pipe buffers into an empty staging
+// pipe per consumer and splice(2)s them on as each consumer makes room.
+// The slowest consumer paces the producer; one that exits is dropped.
+typedef struct Fanout Fanout;
+
+Fanout* fanout_open(int consumers);
+
+// The producer writes fanout_input(), consumer n reads fanout_output().
+// Once the stages are started the caller closes these as it would any
+// pipe end, and fanout_start() hands the rest to the relay.
+int fanout_input(Fanout* fanout);
+int fanout_output(Fanout* fanout, int n);
+void fanout_start(Fanout* fanout);
+
+// Close everything, for a job that could not be started
+void fanout_abort(Fanout* fanout);
+
+#endif
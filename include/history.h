@@ -0,0 +1,23 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include "shell.h"
+
+// History lifecycle: the file is shared by every shell and only appended to
+void history_init(Shell* self);
+void history_cleanup(Shell* self);
+
+// Record a line as executed
+void history_add(History* hist, const char* line);
+
+// Expand a leading !!, !n, !-n, !prefix or !?text; 0 if the line has no
+// event, 1 with *out set (valid until the next call), -1 if not found
+int history_expand(History* hist, const char* line, const char** out);
+
+// Listing and search for the history builtin
+size_t history_count(History* hist);
+void history_print(History* hist, size_t last);
+int history_search(History* hist, const char* text);
+
+#endif
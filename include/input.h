@@ -0,0 +1,21 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+typedef struct InputReader InputReader;
+
+// Input sources
+InputReader* input_open_fd(int fd);
+InputReader* input_open_file(const char* path);
+InputReader* input_open_string(const char* str);
+void input_close(InputReader* in);
+
+// Next line without its '\n', NUL-terminated and writable; valid until
+// the next call. NULL at end of input.
+char* input_next_line(InputReader* in, size_t* len);
+
+// 1 if in reads fd, and fd is still open on the file it was then
+int input_reads(const InputReader* in, int fd);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <time.h>
+#include "shell.h"
+
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+// One process of a job (a pipeline stage)
+typedef struct {
+    pid_t pid;            // -1 if the stage failed to start, 0 for a builtin
+    int pidfd;            // watched by the reaper, -1 if not
+    int exited;
+    int status;           // decoded exit status
+    ProcUsage usage;
+    char* cmd_line;       // this stage, for the log
+} JobProcess;
+
+typedef struct Job {
+    int id;               // %n, 0 until the job enters the table
+    pid_t pgid;
+    JobState state;
+    int background;       // owned by the reaper thread while set
+    int nprocs;
+    int remaining;        // processes not yet reaped
+    int status;           // pipeline status once done
+    char* cmd_line;       // whole pipeline
+    struct timespec start;
+    JobProcess* procs;
+} Job;
+
+// Job table lifecycle
+void jobs_init(Shell* self);
+void jobs_cleanup(Shell* self);
+
+// Job creation and waiting
+Job* job_create(Shell* self, Command* cmd, int count, const pid_t* pids,
+                pid_t pgid, const struct timespec* start);
+int job_wait_foreground(Shell* self, Job* job);
+void job_give_terminal(Shell* self, Job* job);
+int job_wait(Shell* self, Job* job);
+int jobs_wait_all(Shell* self);
+
+// Jobs outside the table, driven by the caller
+void job_open_pidfds(Job* job);
+int job_reap_nowait(Job* job);
+int job_finish(Shell* self, Job* job);
+
+// Job control
+Job* job_find(Shell* self, const char* spec);
+int job_continue(Shell* self, Job* job, int foreground);
+int job_signal(Shell* self, Job* job, int sig);
+
+// Prompt-time bookkeeping
+void jobs_notify(Shell* self);
+void jobs_print(Shell* self, int long_format);
+
+#endif
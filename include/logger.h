@@ -1,9 +1,59 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdint.h>
+#include <stddef.h>
 #include "shell.h"
 
+// ==================== LOG FORMAT ====================
+// One line per record; cmd is escaped (\\ \" \n \t \xHH) so it never
+// contains a raw quote or newline:
+//   [YYYY-mm-dd HH:MM:SS] pid=N cmd="..." status=N [usage]
+//   [YYYY-mm-dd HH:MM:SS] pgid=N cmd="..." status=N pipestatus=a,b [usage]
+//
+// Every record also gets a fixed-size entry in <log>.idx, appended right
+// after the record reaches the log. Entries are in write order, so
+// time_ms + delay_ms grows along the file (give or take
+// LOG_INDEX_SLACK_MS between concurrent shells) and can be binary searched.
+// When the log passes MYSHELL_LOG_MAX bytes both files move to <log>.1,
+// <log>.1.idx and so on, keeping MYSHELL_LOG_KEEP generations.
+#define LOG_INDEX_SUFFIX   ".idx"
+#define LOG_INDEX_MAGIC    0x514c        // "LQ"
+#define LOG_INDEX_SLACK_MS 2000
+
+typedef enum {
+    LOG_KIND_COMMAND,     // a job of one process
+    LOG_KIND_STAGE,       // one process of a pipeline
+    LOG_KIND_PIPELINE     // a whole pipeline
+} LogKind;
+
+typedef struct {
+    int64_t time_ms;      // when the record was made, ms since the epoch
+    uint64_t offset;      // of the record in the log
+    uint64_t cmd_hash;    // FNV-1a of the command line
+    int32_t status;
+    uint32_t delay_ms;    // from time_ms until the record was written
+    uint16_t kind;
+    uint16_t magic;
+    uint32_t length;      // of the record, newline included
+} LogIndexEntry;
+
+// Log or index file of a generation (0 is the current one)
+void log_file_name(char* buf, size_t size, const char* log_path, int generation, int index);
+
+// Logger lifecycle
+void logger_init(Shell* self);
+void logger_flush(Shell* self);
+void logger_shutdown(Shell* self);
+
+// Absolute path of the log, NULL when there is none
+const char* logger_path(Shell* self);
+
 // Logging functions
-void log_command(Shell* self, pid_t pid, const char* cmd_line, int status);
+void log_command(Shell* self, pid_t pid, const char* cmd_line, int status,
+                 const ProcUsage* usage, int stage);
+void log_pipeline(Shell* self, pid_t pgid, const char* cmd_line,
+                  const int* statuses, int count, int status,
+                  const ProcUsage* usage);
 
-#endif
\ No newline at end of file
+#endif
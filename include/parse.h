@@ -2,17 +2,82 @@
 #define PARSE_H
 
 #include "shell.h"
+#include "arena.h"
+#include "input.h"
 
 // Utility functions
 char* trim_whitespace(char* str);
 int is_empty_string(const char* str);
-char** tokenize(const char* input, int* token_count);
-void free_tokens(char** tokens);
+
+// Lexer: tokens are spans into line, which is unquoted and cut in place.
+// The returned array is reused by the next call.
+typedef enum {
+    TOK_WORD,
+    TOK_IO_NUMBER, // the n of n>, n<, ... (text holds the digits)
+    TOK_PIPE,      // |
+    TOK_AMP,       // &
+    TOK_LESS,      // <
+    TOK_GREAT,     // > and >|
+    TOK_DGREAT,    // >>
+    TOK_LESSGREAT, // <>
+    TOK_LESSAND,   // <&
+    TOK_GREATAND,  // >&
+    TOK_DLESS,     // <<
+    TOK_DLESSDASH, // <<-
+    TOK_TLESS,     // <<<
+    TOK_ANDGREAT,  // &>
+    TOK_ANDDGREAT, // &>>
+    TOK_FANOUT,    // |>
+    TOK_LPAREN,    // (
+    TOK_RPAREN,    // )
+    TOK_SEMI,      // ;, && and || only separate the commands of a list,
+    TOK_AND_IF,    // which the script reader splits before any pipeline
+    TOK_OR_IF      // gets here
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char* text;       // NUL-terminated word text, NULL for operators
+    size_t len;
+    int quoted;       // word had quotes or escapes somewhere
+    char* pattern;    // glob pattern if the word has an unquoted * ? or [,
+                      // with quoted metacharacters escaped; else NULL
+    int assignment;   // word starts with an unquoted NAME=
+} Token;
+
+int lex_line(char* line, Token** tokens, int* token_count);
+
+// The same rules for readers that only need the structure, with nothing
+// expanded or copied: the length of the operator at p (0 if there is
+// none), and the end of the word at p, or NULL if it leaves a quote open
+// or ends in a backslash
+int lex_operator(const char* p, TokenType* type);
+const char* lex_word_end(const char* p);
+
+// Line memory: parsed commands are valid until parse_reset(), or until
+// parse_rewind() to a mark taken before them
+typedef struct {
+    ArenaMark arena;
+    size_t heredoc_len;
+} ParseMark;
+
+void parse_reset(void);
+ParseMark parse_mark(void);
+void parse_rewind(ParseMark mark);
+void parse_cleanup(void);
+unsigned long parse_heap_allocs(void);
 
 // Parsing functions
 Command* create_command();
-RedirectionType get_redir_type(const char* token);
-void parse_redirections(Command* cmd, char*** tokens_ptr, int* count_ptr);
+void command_destroy(Command* cmd);
 int parse_input(const char* input, Command** cmd);
 
+// The last parse_input() read no variables, files or here-documents, so
+// the same text always parses the same way
+int parse_line_cacheable(void);
+
+// Read the bodies of cmd's <<WORD here-documents from the lines that
+// follow in input, prompting with prompt if it is not NULL
+int parse_heredocs(Command* cmd, InputReader* input, const char* prompt);
+
 #endif
\ No newline at end of file
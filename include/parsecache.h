@@ -0,0 +1,19 @@
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include <stdio.h>
+#include "shell.h"
+
+// Parsed commands of recently run lines (MYSHELL_PARSE_CACHE entries,
+// default 256, 0 turns it off), keyed by the line with its unquoted
+// blanks collapsed. Only lines whose parse is reproducible are kept.
+// A cached tree is shared: run it, never change or destroy it.
+Command* parse_cache_lookup(const char* line);
+void parse_cache_store(const char* line, const Command* cmd, int cacheable);
+
+void parse_cache_print(FILE* out);
+void parse_cache_print_json(FILE* out);
+void parse_cache_reset_stats(void);
+void parse_cache_cleanup(void);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+// Command location cache (name -> absolute path)
+const char* path_lookup(const char* name);
+// Uncached search of another PATH value; the result is malloc'd
+char* path_search(const char* name, const char* path_var);
+void path_cache_forget(const char* name);
+int path_cache_add(const char* name);
+void path_cache_clear(void);
+void path_cache_print(void);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdio.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "shell.h"
+
+// Scheduling and resource limits applied in a child before exec: per
+// command with run OPTIONS cmd, for every command with run --default.
+#define POLICY_CPUS     0x01
+#define POLICY_NICE     0x02
+#define POLICY_IO       0x04
+#define POLICY_MEM      0x08
+#define POLICY_CPU_TIME 0x10
+#define POLICY_NOFILE   0x20
+#define POLICY_CGROUP   0x40
+
+struct JobPolicy {
+    unsigned set;           // POLICY_* bits of the fields given
+    cpu_set_t cpus;
+    int nice;
+    int io_class;           // IOPRIO_CLASS_* value
+    int io_level;
+    rlim_t mem;             // RLIMIT_AS, bytes
+    rlim_t cpu_time;        // RLIMIT_CPU, seconds
+    rlim_t nofile;          // RLIMIT_NOFILE
+    char cgroup[256];       // cgroup v2 directory
+    char cgroup_procs[272]; // its cgroup.procs, built when parsed
+};
+
+// Parse the options at argv[0..argc). Returns how many words they took
+// (stopping at the first non-option or after "--"), or -1 after
+// printing what was wrong.
+int policy_parse(JobPolicy* policy, int argc, char** argv);
+
+// In the child: apply everything set, -1 (with a message) if any of it
+// failed. NULL applies nothing. Only async-signal-safe calls are made,
+// as the shell forking the child may have other threads.
+int policy_apply(const JobPolicy* policy);
+
+// Options that give the same policy back
+void policy_print(FILE* out, const JobPolicy* policy);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "shell.h"
+
+// Process creation backends
+void spawn_init(Shell* self);
+pid_t spawn_command(Shell* self, Command* cmd, int in_fd, int out_fd, pid_t pgid);
+
+// Same for a builtin, function or compound stage, run in a forked child
+pid_t spawn_subshell(Shell* self, Command* cmd, int in_fd, int out_fd, pid_t pgid);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "shell.h"
+#include "jobs.h"
+
+// Command lists (; & && || and newlines), ! pipelines, if, for, while,
+// until, { } groups and functions. The grammar only looks at structure,
+// through the lexer's quoting rules: its leaves are pipelines kept as
+// text, which run through the parse cache and execute_command() like a
+// line of their own, so the commands of a loop body are parsed once
+// (unless they expand something) and builtins in it never fork. A
+// compound command or function in a pipeline or in the background runs
+// in a forked subshell.
+
+// Read the command that starts with line, taking more lines from
+// self->input while a list or compound command is left open, along with
+// the here-document bodies that follow each line. 0 with *tree set (NULL
+// if there is nothing to run) or -1 after a syntax error.
+int script_read(Shell* self, const char* line, ScriptNode** tree);
+void script_execute(Shell* self, ScriptNode* tree);
+
+// Drop the last command's tree; functions stay defined until cleanup
+void script_reset(void);
+void script_cleanup(void);
+
+int script_unset_function(const char* name);
+int script_is_function(const char* name);
+
+// Run a stage in a forked subshell: cmd's compound body, the function it
+// calls or its builtin. Returns the exit status.
+int script_run_stage(Shell* self, Command* cmd);
+
+// Start text, which must be complete by itself, as one job the way
+// execute_start() does: a lone pipeline directly, any other list in a
+// forked subshell. NULL after an error, already reported.
+Job* script_start(Shell* self, const char* text, int in_fd, int out_fd, pid_t pgid);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+// Wire protocol between myshell --server and myshell-client. A request
+// is the header, the client's cwd and the command text; the client's
+// stdin, stdout and stderr travel with the header as SCM_RIGHTS, so
+// output goes straight to the client's descriptors. The reply is the
+// exit status as an int32_t once the commands have finished.
+#define SERVER_MAGIC 0x4853594d          // "MYSH"
+#define SERVER_MAX_TEXT (64 * 1024 * 1024)
+#define SERVER_DEFAULT_WORKERS 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cwd_len;
+    uint32_t text_len;
+} ServerRequest;
+
+// Serve requests on a Unix socket at path until SIGINT or SIGTERM
+int server_run(const char* path, int workers);
+
+#endif
@@ -7,26 +7,72 @@
 // ==================== ENUMS ====================
 typedef enum {
     REDIR_NONE,
-    REDIR_IN,      // <
-    REDIR_OUT,     // >
-    REDIR_APPEND   // >>
+    REDIR_IN,      // n<  file
+    REDIR_OUT,     // n>  file
+    REDIR_APPEND,  // n>> file
+    REDIR_RDWR,    // n<> file
+    REDIR_DUP,     // n>&m, n<&m, n>&- (close)
+    REDIR_HEREDOC  // n<<WORD, n<<-WORD, n<<<word
 } RedirectionType;
 
+// Highest descriptor a redirection may name; files opened for
+// redirections are kept above it
+#define REDIR_MAX_FD 9
+
 typedef enum {
     CMD_EXTERNAL,
-    CMD_BUILTIN
+    CMD_BUILTIN,
+    CMD_UNRESOLVED    // not looked up yet
 } CommandType;
 
+typedef enum {
+    SPAWN_POSIX,   // posix_spawn (vfork-style, no page table copy)
+    SPAWN_FORK     // fork() + execvp() fallback
+} SpawnBackend;
+
+typedef enum {
+    LOG_SYNC_COMMAND,  // write each record before the next prompt
+    LOG_SYNC_BATCH,    // background flush by size or interval (default)
+    LOG_SYNC_EXIT      // flush only when the ring fills or at exit
+} LogSyncMode;
+
 // ==================== FORWARD DECLARATIONS ====================
 typedef struct Shell Shell;
 typedef struct Command Command;
 typedef struct Redirection Redirection;
+typedef struct Logger Logger;
+typedef struct JobTable JobTable;
+typedef struct InputReader InputReader;
+typedef struct History History;
+typedef struct JobPolicy JobPolicy;
+typedef struct BuiltinCommand BuiltinCommand;
+typedef struct ScriptNode ScriptNode;
 
 // ==================== STRUCT DEFINITIONS ====================
-// Redirection structure
+// Resource usage of one reaped child (from wait4)
+typedef struct {
+    long wall_us;         // spawn to reap, monotonic clock
+    long user_us;
+    long sys_us;
+    long maxrss_kb;
+    long nvcsw;           // voluntary context switches
+    long nivcsw;          // involuntary context switches
+    long inblock;         // block input operations
+    long oublock;         // block output operations
+} ProcUsage;
+
+// Redirection structure, one node per operator in source order
 struct Redirection {
     RedirectionType type;
-    char* filename;
+    int fd;                    // descriptor being redirected
+    int dup_fd;                // REDIR_DUP source, -1 to close fd
+    char* filename;            // file, or here-document delimiter
+    char* text;                // here-document body, NULL until read
+    size_t text_len;
+    int strip_tabs;            // <<- drops leading tabs from the body
+    int expand;                // unquoted delimiter: $ in the body expands
+    int open_fd;               // target while being applied, -1 otherwise
+    struct Redirection* next;
 };
 
 // Command structure
@@ -34,19 +80,38 @@ struct Command {
     char** argv;           // Array de argumentos
     int argc;             // Número de argumentos
     CommandType cmd_type;  // Tipo de comando
+    BuiltinCommand* builtin;  // when cmd_type is CMD_BUILTIN
     int background;       // 1 si es trabajo en segundo plano
     
-    struct Redirection input_redir;
-    struct Redirection output_redir;
+    char** assigns;        // NAME=value words before the command name
+    int assign_count;
+    JobPolicy* policy;     // run options, NULL for none
+    int fanout;            // first stage of a |> consumer: reads its own
+                           // copy of the producer's output
+    ScriptNode* body;      // compound command run as this stage, or NULL
+    struct Redirection* redirs;  // applied in order after the pipe ends
     struct Command* pipe_next;  // Siguiente comando en pipe
 };
 
 // Shell state structure
 struct Shell {
     int running;
+    int exit_status;      // status passed to exit
     int log_fd;
-    int saved_stdin;
-    int saved_stdout;
+    Logger* logger;       // buffered writer for log_fd
+    int saved_fds[REDIR_MAX_FD + 1];  // under a builtin's redirections, -1 if untouched
+    int saved_cloexec;    // bit n: saved_fds[n] was close-on-exec
+    SpawnBackend spawn_backend;
+    int interactive;      // stdin is a terminal: hand it to foreground jobs
+    pid_t shell_pgid;
+    int last_status;      // status of the last command ($?)
+    int pipefail;         // set -o pipefail
+    int* pipe_status;     // per-stage statuses of the last foreground pipeline
+    int pipe_status_count;
+    JobTable* jobs;       // background and stopped jobs
+    InputReader* input;   // script, -c string or stdin
+    History* history;     // NULL when history is off
+    JobPolicy* policy;    // run --default, NULL when unset
 };
 
 // ==================== FUNCTION DECLARATIONS ====================
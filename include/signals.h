@@ -4,7 +4,6 @@
 #include "shell.h"
 
 // Signal handling
-void setup_signal_handlers();
-void sigchld_handler(int sig);
+void setup_signal_handlers(int interactive);
 
 #endif
\ No newline at end of file
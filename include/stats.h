@@ -0,0 +1,42 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Shell phases timed on the hot path
+typedef enum {
+    STAT_READ,       // input_next_line()
+    STAT_PARSE,      // parse_input()
+    STAT_LOOKUP,     // PATH resolution for a spawn
+    STAT_SPAWN,      // posix_spawn() or fork(), redirections included
+    STAT_RUN,        // spawn to exit of each child
+    STAT_WAIT,       // blocked in wait4() for a foreground job
+    STAT_BUILTIN,    // builtin run in the shell, redirections included
+    STAT_LOG,        // formatting and queueing a log record
+    STAT_LINE,       // one input line from parse to done
+    STAT_COUNT
+} StatPhase;
+
+// Monotonic clock in nanoseconds
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Recording is lock-free and may happen on any thread
+void stats_record(StatPhase phase, uint64_t ns);
+
+static inline void stats_since(StatPhase phase, uint64_t start) {
+    stats_record(phase, stats_now() - start);
+}
+
+// Reporting for the stats builtin and the exit dump
+void stats_reset(void);
+void stats_print(FILE* out);
+void stats_print_json(FILE* out);
+void stats_dump_at_exit(void);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Shell variables, imported from the environment at startup. Exported
+// variables make up environ: the array is patched in place when one of
+// them is set, exported or unset, so spawning never rebuilds it.
+void vars_init(void);
+void vars_cleanup(void);
+
+// Value of a variable, NULL if unset. var_lookup() takes a name that is
+// not NUL-terminated and also knows the specials ? $ # @ * and digits.
+const char* var_get(const char* name);
+const char* var_lookup(const char* name, size_t len);
+
+// Set name to value, keeping its export flag unless export is 1
+int var_set(const char* name, const char* value, int export);
+int var_unexport(const char* name);
+int var_unset(const char* name);
+
+// Length of the variable name at the start of s (0 if there is none)
+size_t var_name_length(const char* s);
+
+// "NAME=value" words: set them all, or build a private environment for
+// one command (free it with free(); the strings are not copied)
+int var_assign(char** assigns, int count);
+char** var_environ_with(char** assigns, int count);
+
+// Show such an environment in environ while a builtin runs, then go back
+// to the shell's own
+char** var_environ_push(char** assigns, int count);
+void var_environ_pop(char** pushed);
+
+// Last command status for $?
+void vars_set_status(int status);
+
+// $1 ... $N, $# and $@ (or $*, the same here): arguments of the running
+// function or script. The strings are not copied.
+void var_set_positional(char** args, int count);
+void var_get_positional(char*** args, int* count);
+
+// $0: the script, the name given after -c string, or "myshell". The
+// string is not copied.
+void var_set_name(const char* name);
+
+// set lists all variables, export all exported ones, as shell input
+void var_print(FILE* out, int exported_only);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "arena.h"
+
+// Filename generation for * ? [...] and ** (any number of directories).
+// A backslash in the pattern makes the next character literal.
+
+// Pattern has an unescaped *, ? or complete [...]
+int wildcard_has_magic(const char* pattern);
+
+// Store the sorted paths matching pattern in *matches, strings and array
+// allocated from arena. Returns the number of matches (0 when nothing
+// matched) or -1 on allocation failure.
+int wildcard_expand(const char* pattern, Arena* arena, char*** matches);
+
+// Directory listings are reused within a line. With the session cache on
+// (set -o globcache) they are also kept across lines and rescanned only
+// when the directory's mtime changes.
+void wildcard_next_line(void);
+void wildcard_set_session_cache(int enable);
+int wildcard_session_cache(void);
+void wildcard_cleanup(void);
+
+#endif
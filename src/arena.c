@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+// ==================== ARENA LIFECYCLE ====================
+void arena_init(Arena* arena, size_t chunk_size) {
+    if (!arena) return;
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunk_size = chunk_size;
+    arena->chunk_allocs = 0;
+}
+
+void arena_reset(Arena* arena) {
+    if (!arena) return;
+
+    for (ArenaChunk* c = arena->first; c; c = c->next) {
+        c->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+    ArenaMark mark = {NULL, 0};
+    if (arena && arena->current) {
+        mark.chunk = arena->current;
+        mark.used = arena->current->used;
+    }
+    return mark;
+}
+
+// Release everything allocated since mark was taken
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    if (!arena) return;
+    if (!mark.chunk) {
+        arena_reset(arena);
+        return;
+    }
+
+    for (ArenaChunk* c = mark.chunk->next; c; c = c->next) {
+        c->used = 0;
+    }
+    mark.chunk->used = mark.used;
+    arena->current = mark.chunk;
+}
+
+void arena_destroy(Arena* arena) {
+    if (!arena) return;
+
+    ArenaChunk* c = arena->first;
+    while (c) {
+        ArenaChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+// ==================== ALLOCATION ====================
+static ArenaChunk* new_chunk(Arena* arena, size_t min_size) {
+    size_t size = arena->chunk_size > min_size ? arena->chunk_size : min_size;
+
+    ArenaChunk* c = malloc(sizeof(ArenaChunk) + size);
+    if (!c) return NULL;
+
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    arena->chunk_allocs++;
+    return c;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    if (!arena) return NULL;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // Move on through chunks kept from earlier lines before allocating;
+    // chunks after current are always empty
+    ArenaChunk* c = arena->current;
+    while (c && c->size - c->used < size && c->next) {
+        c = c->next;
+    }
+
+    if (!c || c->size - c->used < size) {
+        ArenaChunk* fresh = new_chunk(arena, size);
+        if (!fresh) return NULL;
+
+        if (c) {
+            c->next = fresh;
+        } else {
+            arena->first = fresh;
+        }
+        c = fresh;
+    }
+
+    arena->current = c;
+    void* ptr = c->data + c->used;
+    c->used += size;
+    return ptr;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t len) {
+    char* copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    return arena_strndup(arena, str, strlen(str));
+}
@@ -3,16 +3,30 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include "shell.h"
 #include "builtin.h"
+#include "execute.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "history.h"
+#include "stats.h"
+#include "wildcard.h"
+#include "vars.h"
+#include "policy.h"
+#include "script.h"
 
 // ==================== BUILTIN IMPLEMENTATIONS ====================
-int builtin_cd(Command* cmd) {
+int builtin_cd(Shell* self, Command* cmd) {
+    (void)self; // Unused
     const char* path;
     
     if (!cmd || cmd->argc == 1) {
         // No argument, go to HOME
-        path = getenv("HOME");
+        path = var_get("HOME");
         if (!path) {
             fprintf(stderr, "cd: HOME not set\n");
             return 1;
@@ -32,17 +46,23 @@ int builtin_cd(Command* cmd) {
     return 0;
 }
 
-int builtin_exit(Command* cmd) {
+int builtin_exit(Shell* self, Command* cmd) {
     // Exit with status if provided
     int status = 0;
     if (cmd && cmd->argc > 1) {
         status = atoi(cmd->argv[1]);
     }
-    exit(status);
-    return status; // Not reached
+    
+    // Stop the main loop so shell_cleanup() still flushes the log
+    if (self) {
+        self->running = 0;
+        self->exit_status = status;
+    }
+    return status;
 }
 
-int builtin_pwd(Command* cmd) {
+int builtin_pwd(Shell* self, Command* cmd) {
+    (void)self; // Unused
     (void)cmd; // Unused
     
     char cwd[1024];
@@ -55,7 +75,8 @@ int builtin_pwd(Command* cmd) {
     }
 }
 
-int builtin_help(Command* cmd) {
+int builtin_help(Shell* self, Command* cmd) {
+    (void)self; // Unused
     (void)cmd; // Unused
     
     printf("MyShell - A Mini Unix Shell\n");
@@ -65,24 +86,963 @@ int builtin_help(Command* cmd) {
     printf("  quit          - Exit shell\n");
     printf("  pwd           - Print working directory\n");
     printf("  help          - Show this help\n");
+    printf("  hash [-r] [name ...] - List, clear or prefill the command path cache\n");
+    printf("  set [-o|+o pipefail|globcache] - List variables, show or change options\n");
+    printf("  export [-n] [name[=value] ...] - Export variables to commands\n");
+    printf("  unset [-f] name ...  - Remove variables, or functions with -f\n");
+    printf("  run [-c cpus] [-n nice] [-i io] [-m mem] [-t secs] [-f files] [-g cgroup] cmd\n");
+    printf("      - Run cmd with that affinity, priority, limits or cgroup\n");
+    printf("  run --default [options] - Apply them to every command (none: stop)\n");
+    printf("  jobs [-l]     - List background and stopped jobs\n");
+    printf("  fg [%%n]       - Resume a job in the foreground\n");
+    printf("  bg [%%n]       - Resume a stopped job in the background\n");
+    printf("  wait [%%n|pid] - Wait for background jobs\n");
+    printf("  kill [-sig] %%n|pid - Send a signal to a job or process\n");
+    printf("  echo, printf, test/[, cat, true, false - Run without a new process\n");
+    printf("  parallel [-j N] [--line-buffer] cmd {} ::: args - Run jobs N at a time\n");
+    printf("  history [N] | -s text - List history or find the newest match\n");
+    printf("  cache [--stats | --clear | [--] cmd args] - Replay stored output of cmd\n");
+    printf("  stats [-r] [--json] - Show or reset the shell's phase timings\n");
+    printf("  logq [--since T] [--until T] [--failed | --status N] [--grep TEXT] [--stages]\n");
+    printf("       [--last N | --count | --top N] [--file LOG] - Query the command log\n");
+    printf("  break [n], continue [n] - Leave or go on with the n-th enclosing loop\n");
+    printf("  return [status] - Return from a function\n");
     printf("\n");
     printf("Features:\n");
     printf("  - External commands: ls, grep, etc.\n");
-    printf("  - I/O redirection: >, >>, <\n");
-    printf("  - Pipes: cmd1 | cmd2\n");
+    printf("  - I/O redirection: <, >, >>, n<, n>, n>>, n<>, n>&m, n<&m, n>&-, &>, &>>\n");
+    printf("  - Here-documents: <<WORD, <<-WORD (tabs stripped), <<<word\n");
+    printf("  - Pipes: cmd1 | cmd2 | ... | cmdN\n");
+    printf("  - Fan-out: producer |> (consumer1) (consumer2 | ...) ...\n");
+    printf("  - Globs: *, ?, [...], ** (any depth)\n");
+    printf("  - Variables: name=value, $name, ${name}, $?, $$, $1..., $#, $@\n");
+    printf("  - Lists: cmd1; cmd2, cmd1 && cmd2, cmd1 || cmd2, ! cmd\n");
+    printf("  - Control flow: if/elif/else/fi, for/while/until ... do ... done, { ...; }\n");
+    printf("  - Functions: name() { ...; }\n");
     printf("  - Background jobs: cmd &\n");
+    printf("  - History: !!, !n, !-n, !prefix, !?text\n");
+    
+    return 0;
+}
+
+int builtin_hash(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    if (!cmd || cmd->argc == 1) {
+        path_cache_print();
+        return 0;
+    }
+    
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->argv[i], "-r") == 0) {
+            // Forget all remembered locations
+            path_cache_clear();
+        } else if (path_cache_add(cmd->argv[i]) < 0) {
+            fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+            status = 1;
+        }
+    }
+    
+    return status;
+}
+
+int builtin_stats(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    int json = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->argv[i], "-r") == 0) {
+            stats_reset();
+            return 0;
+        } else if (strcmp(cmd->argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            fprintf(stderr, "stats: %s: invalid option\n", cmd->argv[i]);
+            fprintf(stderr, "usage: stats [-r] [--json]\n");
+            return 2;
+        }
+    }
+    
+    if (json) {
+        stats_print_json(stdout);
+    } else {
+        stats_print(stdout);
+    }
+    return 0;
+}
+
+int builtin_set(Shell* self, Command* cmd) {
+    if (!self || !cmd) return 1;
+    
+    // No arguments: list variables; "-o": list options
+    if (cmd->argc == 1) {
+        var_print(stdout, 0);
+        return 0;
+    }
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "-o") == 0) {
+        printf("pipefail\t%s\n", self->pipefail ? "on" : "off");
+        printf("globcache\t%s\n", wildcard_session_cache() ? "on" : "off");
+        return 0;
+    }
+    
+    for (int i = 1; i < cmd->argc; i++) {
+        int enable;
+        if (strcmp(cmd->argv[i], "-o") == 0) {
+            enable = 1;
+        } else if (strcmp(cmd->argv[i], "+o") == 0) {
+            enable = 0;
+        } else {
+            fprintf(stderr, "set: %s: invalid option\n", cmd->argv[i]);
+            return 1;
+        }
+        
+        if (i + 1 >= cmd->argc) {
+            fprintf(stderr, "set: %s: option name required\n", cmd->argv[i]);
+            return 1;
+        }
+        i++;
+        
+        if (strcmp(cmd->argv[i], "pipefail") == 0) {
+            self->pipefail = enable;
+        } else if (strcmp(cmd->argv[i], "globcache") == 0) {
+            // Keep directory listings for glob across lines
+            wildcard_set_session_cache(enable);
+        } else {
+            fprintf(stderr, "set: %s: invalid option name\n", cmd->argv[i]);
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+// ==================== VARIABLE BUILTINS ====================
+int builtin_export(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    int i = 1;
+    int unexport = 0;
+    if (i < cmd->argc && strcmp(cmd->argv[i], "-n") == 0) {
+        unexport = 1;
+        i++;
+    } else if (i < cmd->argc && strcmp(cmd->argv[i], "-p") == 0) {
+        i++;
+    }
+    
+    if (i == cmd->argc) {
+        var_print(stdout, 1);
+        return 0;
+    }
+    
+    int status = 0;
+    for (; i < cmd->argc; i++) {
+        char* arg = cmd->argv[i];
+        char* eq = strchr(arg, '=');
+        size_t len = eq ? (size_t)(eq - arg) : strlen(arg);
+        if (len == 0 || var_name_length(arg) != len) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", arg);
+            status = 1;
+            continue;
+        }
+        
+        if (unexport) {
+            var_unexport(arg);
+        } else if (eq) {
+            *eq = '\0';
+            if (var_set(arg, eq + 1, 1) < 0) status = 1;
+            *eq = '=';
+        } else {
+            // An unset name is left alone
+            const char* value = var_get(arg);
+            if (value && var_set(arg, value, 1) < 0) status = 1;
+        }
+    }
+    return status;
+}
+
+int builtin_unset(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    int status = 0;
+    int functions = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char* name = cmd->argv[i];
+        if (i == 1 && strcmp(name, "-v") == 0) continue;
+        if (i == 1 && strcmp(name, "-f") == 0) {
+            functions = 1;
+            continue;
+        }
+        if (functions) {
+            script_unset_function(name);
+            continue;
+        }
+        
+        if (var_name_length(name) != strlen(name) || name[0] == '\0') {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", name);
+            status = 1;
+            continue;
+        }
+        var_unset(name);
+    }
+    return status;
+}
+
+// ==================== RESOURCE POLICY ====================
+// run OPTIONS cmd is taken apart by the parser; what reaches here is
+// run alone (show the default policy) or run --default [OPTIONS]
+int builtin_run(Shell* self, Command* cmd) {
+    if (!self || !cmd) return 1;
+    
+    if (cmd->argc == 1) {
+        printf("run --default");
+        if (self->policy) policy_print(stdout, self->policy);
+        printf("\n");
+        return 0;
+    }
+    
+    if (strcmp(cmd->argv[1], "--default") != 0) {
+        fprintf(stderr, "run: missing command\n");
+        fprintf(stderr, "usage: run [options] cmd [args ...] | run --default [options]\n");
+        return 2;
+    }
+    
+    JobPolicy policy;
+    int used = policy_parse(&policy, cmd->argc - 2, cmd->argv + 2);
+    if (used < 0) return 2;
+    if (used + 2 < cmd->argc) {
+        fprintf(stderr, "run: %s: --default does not take a command\n", cmd->argv[used + 2]);
+        return 2;
+    }
     
+    // No options clears the default
+    if (policy.set == 0) {
+        free(self->policy);
+        self->policy = NULL;
+        return 0;
+    }
+    if (!self->policy && !(self->policy = malloc(sizeof(JobPolicy)))) {
+        perror("malloc");
+        return 1;
+    }
+    *self->policy = policy;
     return 0;
 }
 
+// ==================== JOB CONTROL BUILTINS ====================
+int builtin_jobs(Shell* self, Command* cmd) {
+    int long_format = cmd && cmd->argc > 1 && strcmp(cmd->argv[1], "-l") == 0;
+    jobs_print(self, long_format);
+    return 0;
+}
+
+// Job from argv[1], or the current job when no argument is given
+static Job* job_argument(Shell* self, Command* cmd, const char* name) {
+    const char* spec = cmd->argc > 1 ? cmd->argv[1] : "%+";
+    Job* job = job_find(self, spec);
+    if (!job) {
+        fprintf(stderr, "%s: %s: no such job\n", name, cmd->argc > 1 ? spec : "current");
+    }
+    return job;
+}
+
+int builtin_fg(Shell* self, Command* cmd) {
+    Job* job = job_argument(self, cmd, "fg");
+    if (!job) return 1;
+    
+    return job_continue(self, job, 1);
+}
+
+int builtin_bg(Shell* self, Command* cmd) {
+    Job* job = job_argument(self, cmd, "bg");
+    if (!job) return 1;
+    
+    return job_continue(self, job, 0);
+}
+
+int builtin_wait(Shell* self, Command* cmd) {
+    if (!cmd || cmd->argc == 1) {
+        return jobs_wait_all(self);
+    }
+    
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        Job* job = job_find(self, cmd->argv[i]);
+        if (!job) {
+            fprintf(stderr, "wait: %s: no such job\n", cmd->argv[i]);
+            status = 127;
+            continue;
+        }
+        status = job_wait(self, job);
+    }
+    
+    return status;
+}
+
+static const struct {
+    const char* name;
+    int number;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+    {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {NULL, 0}
+};
+
+// "TERM", "SIGTERM" or "15"; -1 if unknown
+static int parse_signal(const char* name) {
+    if (*name >= '0' && *name <= '9') {
+        int sig = atoi(name);
+        return sig > 0 && sig < NSIG ? sig : -1;
+    }
+    if (strncmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    for (int i = 0; signal_names[i].name; i++) {
+        if (strcmp(signal_names[i].name, name) == 0) {
+            return signal_names[i].number;
+        }
+    }
+    return -1;
+}
+
+int builtin_kill(Shell* self, Command* cmd) {
+    if (!cmd || cmd->argc < 2) {
+        fprintf(stderr, "kill: usage: kill [-s sig | -sig] %%job|pid ...\n");
+        return 1;
+    }
+    
+    int sig = SIGTERM;
+    int i = 1;
+    
+    if (strcmp(cmd->argv[1], "-l") == 0) {
+        for (int j = 0; signal_names[j].name; j++) {
+            printf("%2d) SIG%s\n", signal_names[j].number, signal_names[j].name);
+        }
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "-s") == 0 && cmd->argc > 2) {
+        sig = parse_signal(cmd->argv[2]);
+        i = 3;
+    } else if (cmd->argv[1][0] == '-') {
+        sig = parse_signal(cmd->argv[1] + 1);
+        i = 2;
+    }
+    if (sig < 0) {
+        fprintf(stderr, "kill: %s: invalid signal specification\n", cmd->argv[i - 1]);
+        return 1;
+    }
+    
+    int status = 0;
+    for (; i < cmd->argc; i++) {
+        const char* target = cmd->argv[i];
+        if (target[0] == '%') {
+            Job* job = job_find(self, target);
+            if (!job) {
+                fprintf(stderr, "kill: %s: no such job\n", target);
+                status = 1;
+            } else if (job_signal(self, job, sig) < 0) {
+                fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+                status = 1;
+            }
+            continue;
+        }
+        char* end;
+        long pid = strtol(target, &end, 10);
+        if (end == target || *end != '\0') {
+            fprintf(stderr, "kill: %s: arguments must be process or job IDs\n", target);
+            status = 1;
+        } else if (kill((pid_t)pid, sig) < 0) {
+            fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+            status = 1;
+        }
+    }
+    
+    return status;
+}
+
+// ==================== HISTORY BUILTIN ====================
+int builtin_history(Shell* self, Command* cmd) {
+    if (!self->history) {
+        fprintf(stderr, "history: history is not enabled\n");
+        return 1;
+    }
+    
+    // history -s text: newest entry containing text
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-s") == 0) {
+        if (cmd->argc != 3) {
+            fprintf(stderr, "history: usage: history -s text\n");
+            return 2;
+        }
+        return history_search(self->history, cmd->argv[2]) == 0 ? 0 : 1;
+    }
+    
+    size_t last = 0;
+    if (cmd->argc > 1) {
+        char* end;
+        long n = strtol(cmd->argv[1], &end, 10);
+        if (*end != '\0' || n < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", cmd->argv[1]);
+            return 2;
+        }
+        last = n;
+    }
+    
+    history_print(self->history, last);
+    return 0;
+}
+
+// ==================== UTILITY BUILTINS ====================
+// Common utilities run in-process to save a fork+exec each. They write
+// through stdio (cat writes fd 1 directly after a flush) and honor the
+// command's redirections, which execute_builtin() sets up.
+int builtin_true(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    (void)cmd; // Unused
+    return 0;
+}
+
+int builtin_false(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    (void)cmd; // Unused
+    return 1;
+}
+
+// Print the backslash escape at s and return its last character. echo
+// and %b spell octal as \0nnn, printf formats as \nnn. *stop is set by \c.
+static const char* print_escape(const char* s, int echo_octal, int* stop) {
+    s++;
+    switch (*s) {
+        case '\0': putchar('\\'); return s - 1;
+        case 'a': putchar('\a'); return s;
+        case 'b': putchar('\b'); return s;
+        case 'c': *stop = 1; return s;
+        case 'e': putchar('\033'); return s;
+        case 'f': putchar('\f'); return s;
+        case 'n': putchar('\n'); return s;
+        case 'r': putchar('\r'); return s;
+        case 't': putchar('\t'); return s;
+        case 'v': putchar('\v'); return s;
+        case '\\': putchar('\\'); return s;
+    }
+    
+    const char* digits = s;
+    if (echo_octal && *s == '0') {
+        digits = s + 1;
+    } else if (echo_octal || *s < '0' || *s > '7') {
+        putchar('\\');
+        putchar(*s);
+        return s;
+    }
+    
+    int value = 0;
+    int n = 0;
+    while (n < 3 && digits[n] >= '0' && digits[n] <= '7') {
+        value = value * 8 + (digits[n] - '0');
+        n++;
+    }
+    putchar(value);
+    return digits + n - 1;
+}
+
+// Print s interpreting escapes; returns 1 when \c asked to stop output
+static int print_escaped(const char* s) {
+    int stop = 0;
+    for (; *s && !stop; s++) {
+        if (*s == '\\') {
+            s = print_escape(s, 1, &stop);
+        } else {
+            putchar(*s);
+        }
+    }
+    return stop;
+}
+
+int builtin_echo(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+    
+    // Leading option words made only of n, e and E
+    for (; i < cmd->argc; i++) {
+        const char* arg = cmd->argv[i];
+        if (arg[0] != '-' || arg[1] == '\0' || strspn(arg + 1, "neE") != strlen(arg + 1)) {
+            break;
+        }
+        for (const char* f = arg + 1; *f; f++) {
+            if (*f == 'n') newline = 0;
+            else if (*f == 'e') escapes = 1;
+            else escapes = 0;
+        }
+    }
+    
+    for (int first = i; i < cmd->argc; i++) {
+        if (i > first) putchar(' ');
+        if (!escapes) {
+            fputs(cmd->argv[i], stdout);
+        } else if (print_escaped(cmd->argv[i])) {
+            return 0;
+        }
+    }
+    if (newline) putchar('\n');
+    
+    return 0;
+}
+
+// printf: numeric arguments are converted the way printf(1) does,
+// including 'c' for a character's code
+static int printf_conversion_error = 0;
+
+static long long printf_integer(const char* arg) {
+    if (!arg) return 0;
+    if (arg[0] == '\'' || arg[0] == '"') return (unsigned char)arg[1];
+    
+    char* end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        printf_conversion_error = 1;
+    }
+    return value;
+}
+
+static double printf_float(const char* arg) {
+    if (!arg) return 0;
+    
+    char* end;
+    double value = strtod(arg, &end);
+    if (*arg == '\0' || *end != '\0') {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        printf_conversion_error = 1;
+    }
+    return value;
+}
+
+int builtin_printf(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    if (cmd->argc < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    
+    const char* format = cmd->argv[1];
+    char** args = cmd->argv + 2;
+    int nargs = cmd->argc - 2;
+    int next = 0;
+    printf_conversion_error = 0;
+    
+    // The format is reused until every argument has been consumed
+    do {
+        int consumed = 0;
+        for (const char* f = format; *f; f++) {
+            if (*f == '\\') {
+                int stop = 0;
+                f = print_escape(f, 0, &stop);
+                if (stop) return printf_conversion_error;
+                continue;
+            }
+            if (*f != '%') {
+                putchar(*f);
+                continue;
+            }
+            if (f[1] == '%') {
+                putchar('%');
+                f++;
+                continue;
+            }
+            
+            // Copy flags, width and precision into a spec for printf(3)
+            char spec[64] = "%";
+            size_t len = 1;
+            const char* p = f + 1;
+            while (*p && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 4) {
+                spec[len++] = *p++;
+            }
+            char conv = *p;
+            if (conv == '\0') {
+                fprintf(stderr, "printf: %s: missing conversion\n", format);
+                return 1;
+            }
+            
+            const char* arg = next < nargs ? args[next++] : NULL;
+            consumed = 1;
+            switch (conv) {
+                case 'd': case 'i':
+                    spec[len++] = 'l'; spec[len++] = 'l'; spec[len++] = conv; spec[len] = '\0';
+                    printf(spec, printf_integer(arg));
+                    break;
+                case 'u': case 'o': case 'x': case 'X':
+                    spec[len++] = 'l'; spec[len++] = 'l'; spec[len++] = conv; spec[len] = '\0';
+                    printf(spec, (unsigned long long)printf_integer(arg));
+                    break;
+                case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                    spec[len++] = conv; spec[len] = '\0';
+                    printf(spec, printf_float(arg));
+                    break;
+                case 'c':
+                    spec[len++] = 'c'; spec[len] = '\0';
+                    printf(spec, arg ? arg[0] : '\0');
+                    break;
+                case 's':
+                    spec[len++] = 's'; spec[len] = '\0';
+                    printf(spec, arg ? arg : "");
+                    break;
+                case 'b':
+                    if (arg && print_escaped(arg)) return printf_conversion_error;
+                    break;
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+                    return 1;
+            }
+            f = p;
+        }
+        // A format without conversions is printed once
+        if (!consumed) break;
+    } while (next < nargs);
+    
+    return printf_conversion_error;
+}
+
+// ---------- test / [ ----------
+// Recursive descent over argv: or := and {-o and}, and := not {-a not},
+// not := ! not | primary. Errors print and set test_error (status 2).
+typedef struct {
+    char** argv;
+    int pos;
+    int end;
+    int error;
+} TestState;
+
+static int test_or(TestState* t);
+
+static int test_unary(const char* op, const char* arg, TestState* t) {
+    struct stat st;
+    
+    if (strcmp(op, "-n") == 0) return arg[0] != '\0';
+    if (strcmp(op, "-z") == 0) return arg[0] == '\0';
+    if (strcmp(op, "-t") == 0) return isatty(atoi(arg));
+    if (strcmp(op, "-r") == 0) return access(arg, R_OK) == 0;
+    if (strcmp(op, "-w") == 0) return access(arg, W_OK) == 0;
+    if (strcmp(op, "-x") == 0) return access(arg, X_OK) == 0;
+    if (strcmp(op, "-h") == 0 || strcmp(op, "-L") == 0) {
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    
+    if (stat(arg, &st) < 0) {
+        if (strchr("efdsbcpSugk", op[1]) && op[2] == '\0') return 0;
+    } else if (op[2] == '\0') {
+        switch (op[1]) {
+            case 'e': return 1;
+            case 'f': return S_ISREG(st.st_mode);
+            case 'd': return S_ISDIR(st.st_mode);
+            case 's': return st.st_size > 0;
+            case 'b': return S_ISBLK(st.st_mode);
+            case 'c': return S_ISCHR(st.st_mode);
+            case 'p': return S_ISFIFO(st.st_mode);
+            case 'S': return S_ISSOCK(st.st_mode);
+            case 'u': return (st.st_mode & S_ISUID) != 0;
+            case 'g': return (st.st_mode & S_ISGID) != 0;
+            case 'k': return (st.st_mode & S_ISVTX) != 0;
+        }
+    }
+    
+    fprintf(stderr, "test: %s: unary operator expected\n", op);
+    t->error = 1;
+    return 0;
+}
+
+static int is_test_unary(const char* op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("nztrwxhLefdsbcpSugk", op[1]) != NULL;
+}
+
+static long long test_integer(const char* arg, TestState* t) {
+    char* end;
+    long long value = strtoll(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0') {
+        fprintf(stderr, "test: %s: integer expression expected\n", arg);
+        t->error = 1;
+    }
+    return value;
+}
+
+// -1 if op is not a binary operator
+static int test_binary(const char* left, const char* op, const char* right, TestState* t) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(left, right) > 0;
+    
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0) {
+        struct stat a, b;
+        int ha = stat(left, &a) == 0;
+        int hb = stat(right, &b) == 0;
+        int newer = ha && (!hb || a.st_mtim.tv_sec > b.st_mtim.tv_sec ||
+                    (a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec > b.st_mtim.tv_nsec));
+        int older = hb && (!ha || b.st_mtim.tv_sec > a.st_mtim.tv_sec ||
+                    (b.st_mtim.tv_sec == a.st_mtim.tv_sec && b.st_mtim.tv_nsec > a.st_mtim.tv_nsec));
+        return op[1] == 'n' ? newer : older;
+    }
+    if (strcmp(op, "-ef") == 0) {
+        struct stat a, b;
+        return stat(left, &a) == 0 && stat(right, &b) == 0 &&
+               a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    }
+    
+    static const char* int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL};
+    for (int i = 0; int_ops[i]; i++) {
+        if (strcmp(op, int_ops[i]) != 0) continue;
+        long long l = test_integer(left, t);
+        long long r = test_integer(right, t);
+        switch (i) {
+            case 0: return l == r;
+            case 1: return l != r;
+            case 2: return l < r;
+            case 3: return l <= r;
+            case 4: return l > r;
+            default: return l >= r;
+        }
+    }
+    return -1;
+}
+
+static int test_primary(TestState* t) {
+    if (t->pos >= t->end) {
+        fprintf(stderr, "test: argument expected\n");
+        t->error = 1;
+        return 0;
+    }
+    
+    char** argv = t->argv;
+    int remaining = t->end - t->pos;
+    
+    // Binary operators take precedence so "test -f = -f" compares strings
+    if (remaining >= 3) {
+        int result = test_binary(argv[t->pos], argv[t->pos + 1], argv[t->pos + 2], t);
+        if (result >= 0) {
+            t->pos += 3;
+            return result;
+        }
+    }
+    
+    if (strcmp(argv[t->pos], "(") == 0 && remaining >= 2) {
+        t->pos++;
+        int result = test_or(t);
+        if (t->pos >= t->end || strcmp(argv[t->pos], ")") != 0) {
+            fprintf(stderr, "test: ')' expected\n");
+            t->error = 1;
+            return 0;
+        }
+        t->pos++;
+        return result;
+    }
+    
+    if (remaining >= 2 && is_test_unary(argv[t->pos])) {
+        int result = test_unary(argv[t->pos], argv[t->pos + 1], t);
+        t->pos += 2;
+        return result;
+    }
+    
+    // A lone word is true when non-empty
+    return argv[t->pos++][0] != '\0';
+}
+
+static int test_not(TestState* t) {
+    if (t->pos < t->end - 1 && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(TestState* t) {
+    int result = test_not(t);
+    while (t->pos < t->end && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        int right = test_not(t);
+        result = result && right;
+    }
+    return result;
+}
+
+static int test_or(TestState* t) {
+    int result = test_and(t);
+    while (t->pos < t->end && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        int right = test_and(t);
+        result = result || right;
+    }
+    return result;
+}
+
+int builtin_test(Shell* self, Command* cmd) {
+    (void)self; // Unused
+    
+    int end = cmd->argc;
+    if (strcmp(cmd->argv[0], "[") == 0) {
+        if (strcmp(cmd->argv[end - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        end--;
+    }
+    
+    // No expression is false
+    if (end == 1) return 1;
+    
+    TestState t = {cmd->argv, 1, end, 0};
+    int result = test_or(&t);
+    if (!t.error && t.pos < t.end) {
+        fprintf(stderr, "test: %s: unexpected argument\n", cmd->argv[t.pos]);
+        t.error = 1;
+    }
+    
+    if (t.error) return 2;
+    return result ? 0 : 1;
+}
+
+// ---------- cat ----------
+// Copy in to out inside the kernel where the fd types allow it:
+// copy_file_range between files, sendfile from a file, splice for pipes,
+// and read/write for everything else
+static int copy_fd(int in, int out) {
+    static char buffer[128 * 1024];
+    struct stat in_st, out_st;
+    int in_file = fstat(in, &in_st) == 0 && S_ISREG(in_st.st_mode);
+    int out_pipe = fstat(out, &out_st) == 0 && S_ISFIFO(out_st.st_mode);
+    int in_pipe = !in_file && S_ISFIFO(in_st.st_mode);
+    
+    int method = in_file ? (S_ISREG(out_st.st_mode) ? 0 : 1) : (in_pipe || out_pipe ? 2 : 3);
+    
+    for (;;) {
+        ssize_t n;
+        switch (method) {
+            case 0:
+                n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+                break;
+            case 1:
+                n = sendfile(out, in, NULL, 1 << 30);
+                break;
+            case 2:
+                n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE);
+                break;
+            default:
+                n = read(in, buffer, sizeof(buffer));
+                if (n > 0) {
+                    for (ssize_t done = 0; done < n; ) {
+                        ssize_t w = write(out, buffer + done, n - done);
+                        if (w < 0) {
+                            if (errno == EINTR) continue;
+                            return -1;
+                        }
+                        done += w;
+                    }
+                }
+                break;
+        }
+        
+        if (n == 0) return 0;
+        if (n > 0) continue;
+        if (errno == EINTR) continue;
+        
+        // Descriptor pair not supported by this method (O_APPEND output,
+        // cross-filesystem copy, old kernel): step down to the next one
+        if (method < 3 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+                           errno == EBADF || errno == EOPNOTSUPP)) {
+            method = method == 0 ? 1 : 3;
+            continue;
+        }
+        return -1;
+    }
+}
+
+int builtin_cat(Shell* self, Command* cmd) {
+    // Anything already printed by the shell goes first
+    fflush(stdout);
+    
+    // Only -u (a no-op here) is handled in the shell; any other option
+    // goes to the external cat. Redirections are already in place.
+    for (int i = 1; i < cmd->argc && strcmp(cmd->argv[i], "--") != 0; i++) {
+        const char* arg = cmd->argv[i];
+        if (arg[0] == '-' && arg[1] != '\0' && strcmp(arg, "-u") != 0) {
+            Command run = *cmd;
+            run.background = 0;
+            run.pipe_next = NULL;
+            run.redirs = NULL;
+            return execute_external(self, &run);
+        }
+    }
+    
+    int status = 0;
+    int files = 0;
+    int options = 1;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char* name = cmd->argv[i];
+        if (options && strcmp(name, "--") == 0) {
+            options = 0;
+            continue;
+        }
+        if (options && strcmp(name, "-u") == 0) continue;
+        files++;
+        
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (copy_fd(fd, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    
+    if (files == 0 && copy_fd(STDIN_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "cat: -: %s\n", strerror(errno));
+        status = 1;
+    }
+    
+    return status;
+}
+
 // ==================== BUILTIN REGISTRY ====================
 static BuiltinCommand builtins[] = {
-    {"cd", builtin_cd},
-    {"exit", builtin_exit},
-    {"quit", builtin_exit},
-    {"pwd", builtin_pwd},
-    {"help", builtin_help},
-    {NULL, NULL}
+    {"cd", builtin_cd, 0},
+    {"exit", builtin_exit, 0},
+    {"quit", builtin_exit, 0},
+    {"pwd", builtin_pwd, 1},
+    {"help", builtin_help, 1},
+    {"hash", builtin_hash, 0},
+    {"stats", builtin_stats, 0},
+    {"set", builtin_set, 0},
+    {"export", builtin_export, 0},
+    {"unset", builtin_unset, 0},
+    {"run", builtin_run, 0},
+    {"jobs", builtin_jobs, 1},
+    {"fg", builtin_fg, 0},
+    {"bg", builtin_bg, 0},
+    {"wait", builtin_wait, 0},
+    {"kill", builtin_kill, 1},
+    {"true", builtin_true, 1},
+    {"false", builtin_false, 1},
+    {"echo", builtin_echo, 1},
+    {"printf", builtin_printf, 1},
+    {"test", builtin_test, 1},
+    {"[", builtin_test, 1},
+    {"cat", builtin_cat, 0},
+    {"parallel", builtin_parallel, 0},
+    {"history", builtin_history, 0},
+    {"cache", builtin_cache, 0},
+    {"logq", builtin_logq, 0},
+    {"break", builtin_break, 0},
+    {"continue", builtin_continue, 0},
+    {"return", builtin_return, 0},
+    {NULL, NULL, 0}
 };
 
 BuiltinCommand* get_builtin(const char* name) {
@@ -97,17 +1057,54 @@ BuiltinCommand* get_builtin(const char* name) {
     return NULL;
 }
 
+// Commands from the parse cache come with the lookup done
+static BuiltinCommand* command_builtin(Command* cmd) {
+    if (cmd->cmd_type == CMD_BUILTIN) return cmd->builtin;
+    if (cmd->cmd_type == CMD_EXTERNAL) return NULL;
+    
+    // A policy only means something for a process of its own
+    return cmd->policy ? NULL : get_builtin(cmd->argv[0]);
+}
+
 int is_builtin_command(Command* cmd) {
     if (!cmd || !cmd->argv || cmd->argc == 0) return 0;
     
-    return get_builtin(cmd->argv[0]) != NULL;
+    return command_builtin(cmd) != NULL;
+}
+
+int is_shell_stage(Command* cmd) {
+    if (!cmd || !cmd->argv || cmd->argc == 0) return 0;
+    
+    BuiltinCommand* builtin = command_builtin(cmd);
+    return builtin && builtin->stage;
 }
 
-int execute_builtin(Command* cmd) {
+int execute_builtin(Shell* self, Command* cmd) {
     if (!cmd || !cmd->argv || cmd->argc == 0) return 0;
     
-    BuiltinCommand* builtin = get_builtin(cmd->argv[0]);
+    BuiltinCommand* builtin = command_builtin(cmd);
     if (!builtin) return 0;
     
-    return builtin->func(cmd);
+    // Redirections apply to the shell's own descriptors for the duration,
+    // and NAME=value prefixes to the environment
+    uint64_t start = stats_now();
+    char** pushed_env = NULL;
+    int status;
+    if (setup_redirections(self, cmd) < 0) {
+        status = 1;
+    } else if (cmd->assign_count > 0 &&
+               !(pushed_env = var_environ_push(cmd->assigns, cmd->assign_count))) {
+        perror("malloc");
+        status = 1;
+    } else {
+        status = builtin->func(self, cmd);
+    }
+    if (pushed_env) var_environ_pop(pushed_env);
+    
+    // Keep builtin output ordered with the children's output, and write
+    // it to the redirection target before stdout is put back
+    fflush(stdout);
+    restore_redirections(self);
+    stats_since(STAT_BUILTIN, start);
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "builtin.h"
+#include "execute.h"
+#include "pathcache.h"
+
+#define CACHE_DEFAULT_MAX (64L * 1024 * 1024)
+#define CACHE_SUFFIX ".out"
+
+// Environment that commonly changes a command's output; more names can
+// be added with MYSHELL_CACHE_ENV="NAME1:NAME2"
+static const char* cache_env_names[] = {
+    "PATH", "HOME", "USER", "LANG", "LC_ALL", "LC_COLLATE", "LC_CTYPE", "TZ", NULL
+};
+
+// ==================== STORE FORMAT ====================
+// One file per result, named by the 128-bit key in hex:
+// header, then stdout bytes, then stderr bytes. Files are written to a
+// temporary name and renamed, so readers never see a partial entry.
+// A hit touches the file's mtime, which is what eviction orders by.
+typedef struct {
+    char magic[8];
+    int32_t status;
+    uint32_t reserved;
+    uint64_t out_len;
+    uint64_t err_len;
+} CacheHeader;
+
+static const char cache_magic[8] = "MYSHC01";
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;
+    unsigned long bypassed;       // run uncached, reading a pipe or terminal
+    unsigned long bytes_replayed;
+} CacheStats;
+
+static CacheStats stats;
+
+// ==================== KEY HASHING ====================
+// FNV-1a, 128-bit, over everything the output may depend on
+typedef unsigned __int128 CacheKey;
+
+static void key_add(CacheKey* h, const void* data, size_t len) {
+    const CacheKey prime = ((CacheKey)1 << 88) + 0x13b;
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i++) {
+        *h ^= p[i];
+        *h *= prime;
+    }
+}
+
+static void key_add_str(CacheKey* h, const char* s) {
+    key_add(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+// Identity and version of a file: a change to any of these is a miss
+static void key_add_file(CacheKey* h, const char* path) {
+    struct stat st;
+    if (!path || stat(path, &st) < 0) return;
+
+    int64_t id[5] = {st.st_dev, st.st_ino, st.st_size,
+                     st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    key_add_str(h, path);
+    key_add(h, id, sizeof(id));
+}
+
+// Standard input, as execute_builtin() left it: a here-document is keyed
+// by its text, a regular file by its identity and read offset. A pipe or
+// a terminal may carry anything, so 0 means the result cannot be cached.
+static int key_add_stdin(CacheKey* h, Command* cmd) {
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        if (r->fd == STDIN_FILENO && r->type == REDIR_HEREDOC) return 1;
+    }
+
+    struct stat st, null_st;
+    if (fstat(STDIN_FILENO, &st) < 0) return 1;    // closed: reads fail the same way
+    if (S_ISCHR(st.st_mode) && stat("/dev/null", &null_st) == 0 &&
+        st.st_rdev == null_st.st_rdev) {
+        return 1;
+    }
+    if (!S_ISREG(st.st_mode)) return 0;
+
+    int64_t id[6] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec,
+                     st.st_mtim.tv_nsec, lseek(STDIN_FILENO, 0, SEEK_CUR)};
+    key_add(h, id, sizeof(id));
+    return 1;
+}
+
+static int command_key(Command* cmd, char** argv, int argc, CacheKey* key) {
+    CacheKey h = ((CacheKey)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+
+    for (int i = 0; i < argc; i++) {
+        key_add_str(&h, argv[i]);
+    }
+
+    // The program itself, so an upgraded binary misses
+    key_add_file(&h, path_lookup(argv[0]));
+
+    char cwd[4096];
+    key_add_str(&h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+
+    for (int i = 0; cache_env_names[i]; i++) {
+        key_add_str(&h, getenv(cache_env_names[i]));
+    }
+    const char* extra = getenv("MYSHELL_CACHE_ENV");
+    if (extra) {
+        char names[1024];
+        snprintf(names, sizeof(names), "%s", extra);
+        char* save = NULL;
+        for (char* name = strtok_r(names, ":", &save); name; name = strtok_r(NULL, ":", &save)) {
+            key_add_str(&h, name);
+            key_add_str(&h, getenv(name));
+        }
+    }
+
+    // Files named by arguments and by input redirections, and here-document
+    // text. A directory only covers its own entries, not files deeper in
+    // the tree.
+    for (int i = 1; i < argc; i++) {
+        key_add_file(&h, argv[i]);
+    }
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        if (r->type == REDIR_IN || r->type == REDIR_RDWR) {
+            key_add_file(&h, r->filename);
+        } else if (r->type == REDIR_HEREDOC) {
+            key_add(&h, &r->fd, sizeof(r->fd));
+            key_add(&h, r->text, r->text_len);
+        }
+    }
+    if (!key_add_stdin(&h, cmd)) return -1;
+
+    *key = h;
+    return 0;
+}
+
+// ==================== STORE ====================
+static int cache_dir(char* buf, size_t size) {
+    const char* dir = getenv("MYSHELL_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(buf, size, "%s", dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(buf, size, "%s/myshell", dir);
+    } else if ((dir = getenv("HOME"))) {
+        snprintf(buf, size, "%s/.cache/myshell", dir);
+    } else {
+        return -1;
+    }
+
+    // mkdir -p
+    for (char* p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(buf, 0700);
+        *p = '/';
+    }
+    if (mkdir(buf, 0700) < 0 && errno != EEXIST) {
+        perror(buf);
+        return -1;
+    }
+    return 0;
+}
+
+static void entry_path(char* buf, size_t size, const char* dir, CacheKey key) {
+    snprintf(buf, size, "%s/%016llx%016llx" CACHE_SUFFIX, dir,
+             (unsigned long long)(key >> 64), (unsigned long long)key);
+}
+
+static long cache_max_bytes(void) {
+    const char* value = getenv("MYSHELL_CACHE_MAX");
+    if (!value) return CACHE_DEFAULT_MAX;
+
+    char* end;
+    long n = strtol(value, &end, 10);
+    if (*end == 'K' || *end == 'k') n <<= 10;
+    else if (*end == 'M' || *end == 'm') n <<= 20;
+    else if (*end == 'G' || *end == 'g') n <<= 30;
+    return n > 0 ? n : CACHE_DEFAULT_MAX;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Map a capture memfd; an empty capture maps to ""
+static char* map_capture(int fd, size_t len) {
+    if (len == 0) return "";
+    char* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+// Replay a stored result; -1 if there is no usable entry
+static int cache_replay(const char* path, int* status) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    CacheHeader hdr;
+    if (fstat(fd, &st) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        (uint64_t)st.st_size != sizeof(hdr) + hdr.out_len + hdr.err_len) {
+        close(fd);
+        return -1;
+    }
+
+    if (hdr.out_len + hdr.err_len > 0) {
+        char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        write_all(STDOUT_FILENO, map + sizeof(hdr), hdr.out_len);
+        write_all(STDERR_FILENO, map + sizeof(hdr) + hdr.out_len, hdr.err_len);
+        munmap(map, st.st_size);
+    }
+
+    // Most recently used
+    futimens(fd, NULL);
+    close(fd);
+
+    stats.bytes_replayed += hdr.out_len + hdr.err_len;
+    *status = hdr.status;
+    return 0;
+}
+
+typedef struct {
+    char* name;
+    off_t size;
+    struct timespec used;
+} CacheFile;
+
+static int compare_used(const void* a, const void* b) {
+    const CacheFile* x = a;
+    const CacheFile* y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// List the store; the caller frees the names and the array
+static CacheFile* cache_list(const char* dir, size_t* count, off_t* total) {
+    *count = 0;
+    *total = 0;
+
+    DIR* d = opendir(dir);
+    if (!d) return NULL;
+
+    CacheFile* files = NULL;
+    size_t cap = 0;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len <= strlen(CACHE_SUFFIX) ||
+            strcmp(ent->d_name + len - strlen(CACHE_SUFFIX), CACHE_SUFFIX) != 0) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(d), ent->d_name, &st, 0) < 0) continue;
+
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 64;
+            CacheFile* bigger = realloc(files, cap * sizeof(CacheFile));
+            if (!bigger) break;
+            files = bigger;
+        }
+        files[*count].name = strdup(ent->d_name);
+        files[*count].size = st.st_size;
+        files[*count].used = st.st_mtim;
+        *total += st.st_size;
+        (*count)++;
+    }
+    closedir(d);
+    return files;
+}
+
+// Drop least recently used entries until the store fits in max bytes
+static void cache_evict(const char* dir, long max) {
+    size_t count;
+    off_t total;
+    CacheFile* files = cache_list(dir, &count, &total);
+
+    if (total > max) {
+        qsort(files, count, sizeof(CacheFile), compare_used);
+        int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for (size_t i = 0; i < count && total > max; i++) {
+            if (unlinkat(dfd, files[i].name, 0) == 0) {
+                total -= files[i].size;
+                stats.evictions++;
+            }
+        }
+        if (dfd >= 0) close(dfd);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(files[i].name);
+    }
+    free(files);
+}
+
+static void cache_store(const char* dir, const char* path, int status,
+                        const char* out, size_t out_len, const char* err, size_t err_len) {
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s/.tmp.%d", dir, (int)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+
+    CacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+    hdr.status = status;
+    hdr.out_len = out_len;
+    hdr.err_len = err_len;
+
+    int ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+             write_all(fd, out, out_len) == 0 &&
+             write_all(fd, err, err_len) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return;
+    }
+    stats.stores++;
+}
+
+// ==================== CACHE BUILTIN ====================
+static void cache_print_stats(void) {
+    char dir[4096];
+    size_t count = 0;
+    off_t total = 0;
+    if (cache_dir(dir, sizeof(dir)) == 0) {
+        CacheFile* files = cache_list(dir, &count, &total);
+        for (size_t i = 0; i < count; i++) free(files[i].name);
+        free(files);
+    }
+
+    unsigned long lookups = stats.hits + stats.misses;
+    printf("hits\t%lu\n", stats.hits);
+    printf("misses\t%lu\n", stats.misses);
+    printf("hit_rate\t%.1f%%\n", lookups ? 100.0 * stats.hits / lookups : 0.0);
+    printf("stored\t%lu\n", stats.stores);
+    printf("evicted\t%lu\n", stats.evictions);
+    printf("bypassed\t%lu\n", stats.bypassed);
+    printf("replayed_bytes\t%lu\n", stats.bytes_replayed);
+    printf("entries\t%zu\n", count);
+    printf("size_bytes\t%lld\n", (long long)total);
+    printf("max_bytes\t%ld\n", cache_max_bytes());
+}
+
+static void cache_clear(void) {
+    char dir[4096];
+    if (cache_dir(dir, sizeof(dir)) < 0) return;
+    cache_evict(dir, 0);
+}
+
+// Run the command with stdout and stderr captured in memfds, store the
+// result and replay it; the output appears once the command is done
+static int cache_run(Shell* self, Command* cmd, int first) {
+    char** argv = cmd->argv + first;
+    int argc = cmd->argc - first;
+
+    // Redirections were applied to the shell's fds by execute_builtin()
+    Command run = *cmd;
+    run.argv = argv;
+    run.argc = argc;
+    run.background = 0;
+    run.pipe_next = NULL;
+    run.redirs = NULL;
+
+    CacheKey key;
+    if (command_key(cmd, argv, argc, &key) < 0) {
+        stats.bypassed++;
+        return execute_external(self, &run);
+    }
+
+    char dir[4096];
+    char path[4200];
+    int have_store = cache_dir(dir, sizeof(dir)) == 0;
+    if (have_store) {
+        entry_path(path, sizeof(path), dir, key);
+
+        int status;
+        if (cache_replay(path, &status) == 0) {
+            stats.hits++;
+            return status;
+        }
+    }
+    stats.misses++;
+
+    int out_fd = memfd_create("cache-stdout", MFD_CLOEXEC);
+    int err_fd = memfd_create("cache-stderr", MFD_CLOEXEC);
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (out_fd < 0 || err_fd < 0 || saved_out < 0 || saved_err < 0) {
+        perror("cache");
+        if (out_fd >= 0) close(out_fd);
+        if (err_fd >= 0) close(err_fd);
+        if (saved_out >= 0) close(saved_out);
+        if (saved_err >= 0) close(saved_err);
+        return execute_external(self, &run);
+    }
+
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    int status = execute_external(self, &run);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    off_t out_len = lseek(out_fd, 0, SEEK_END);
+    off_t err_len = lseek(err_fd, 0, SEEK_END);
+
+    char* out = map_capture(out_fd, out_len);
+    char* err = map_capture(err_fd, err_len);
+    close(out_fd);
+    close(err_fd);
+    if (!out || !err) {
+        perror("cache: mmap");
+        if (out && out_len) munmap(out, out_len);
+        if (err && err_len) munmap(err, err_len);
+        return status;
+    }
+
+    // Killed or stopped commands are not deterministic results
+    if (have_store && status >= 0 && status < 128) {
+        cache_store(dir, path, status, out, out_len, err, err_len);
+        cache_evict(dir, cache_max_bytes());
+    }
+
+    // Replay the capture
+    write_all(STDOUT_FILENO, out, out_len);
+    write_all(STDERR_FILENO, err, err_len);
+    if (out_len) munmap(out, out_len);
+    if (err_len) munmap(err, err_len);
+
+    return status;
+}
+
+int builtin_cache(Shell* self, Command* cmd) {
+    if (!self || !cmd) return 1;
+
+    int i = 1;
+    for (; i < cmd->argc && cmd->argv[i][0] == '-'; i++) {
+        const char* opt = cmd->argv[i];
+        if (strcmp(opt, "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(opt, "-s") == 0 || strcmp(opt, "--stats") == 0) {
+            cache_print_stats();
+            return 0;
+        } else if (strcmp(opt, "--clear") == 0) {
+            cache_clear();
+            return 0;
+        } else {
+            fprintf(stderr, "cache: %s: invalid option\n", opt);
+            fprintf(stderr, "cache: usage: cache [--stats | --clear | [--] command [args ...]]\n");
+            return 2;
+        }
+    }
+
+    if (i >= cmd->argc) {
+        fprintf(stderr, "cache: usage: cache [--stats | --clear | [--] command [args ...]]\n");
+        return 2;
+    }
+
+    // Output already printed by the shell must come first
+    fflush(stdout);
+    fflush(stderr);
+    return cache_run(self, cmd, i);
+}
@@ -5,37 +5,27 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include "execute.h"
 #include "builtin.h"
 #include "logger.h"
 #include "signals.h"
 #include "parse.h"
-
-// ==================== COMMAND LIFECYCLE ====================
-void command_destroy(Command* cmd) {
-    if (!cmd) return;
-    
-    // Free argv
-    if (cmd->argv) {
-        free_tokens(cmd->argv);
-    }
-    
-    // Free redirection filenames
-    if (cmd->input_redir.filename) {
-        free(cmd->input_redir.filename);
-    }
-    if (cmd->output_redir.filename) {
-        free(cmd->output_redir.filename);
-    }
-    
-    // Free piped command
-    if (cmd->pipe_next) {
-        command_destroy(cmd->pipe_next);
-    }
-    
-    free(cmd);
-}
+#include "process.h"
+#include "jobs.h"
+#include "input.h"
+#include "history.h"
+#include "stats.h"
+#include "vars.h"
+#include "parsecache.h"
+#include "script.h"
+#include "fanout.h"
 
 // ==================== SHELL LIFECYCLE ====================
 Shell* create_shell() {
@@ -57,299 +47,649 @@ void shell_init(Shell* self) {
     if (!self) return;
     
     self->running = 1;
+    self->exit_status = 0;
     self->log_fd = -1;
-    self->saved_stdin = -1;
-    self->saved_stdout = -1;
+    for (int fd = 0; fd <= REDIR_MAX_FD; fd++) {
+        self->saved_fds[fd] = -1;
+    }
+    self->last_status = 0;
+    self->pipefail = 0;
+    self->pipe_status = NULL;
+    self->pipe_status_count = 0;
+    
+    // Variables start as a copy of the environment
+    vars_init();
+    
+    // Prompt and job control only when commands come from a terminal;
+    // scripts and -c strings are opened by main() before init
+    self->interactive = self->input == NULL && isatty(STDIN_FILENO);
+    if (!self->input) {
+        self->input = input_open_fd(STDIN_FILENO);
+    }
+    self->shell_pgid = getpgrp();
     
     // Initialize logger
-    self->log_fd = open("myshell.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    self->log_fd = open("myshell.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
     if (self->log_fd < 0) {
         perror("open log file");
     }
+    logger_init(self);
     
     // Setup signal handlers
-    setup_signal_handlers();
+    setup_signal_handlers(self->interactive);
+    
+    // Start tracking background jobs
+    jobs_init(self);
+    
+    // Select process creation backend
+    spawn_init(self);
+    
+    // History for interactive use, or wherever a history file is named
+    if (self->interactive || getenv("MYSHELL_HISTFILE")) {
+        history_init(self);
+    }
 }
 
 void shell_cleanup(Shell* self) {
     if (!self) return;
     
+    jobs_cleanup(self);
+    logger_shutdown(self);
     if (self->log_fd >= 0) {
         close(self->log_fd);
         self->log_fd = -1;
     }
+    
+    free(self->pipe_status);
+    self->pipe_status = NULL;
+    self->pipe_status_count = 0;
+    
+    input_close(self->input);
+    self->input = NULL;
+    
+    history_cleanup(self);
+    free(self->policy);
+    self->policy = NULL;
+    parse_cleanup();
+    parse_cache_cleanup();
+    script_cleanup();
+    stats_dump_at_exit();
+    vars_cleanup();
 }
 
 void shell_run(Shell* self) {
-    if (!self) return;
-    
-    char input[1024];
+    if (!self || !self->input) return;
     
     while (self->running) {
-        // Display prompt
-        printf("myshell> ");
-        fflush(stdout);
+        // Report finished background jobs in one batch
+        jobs_notify(self);
+        
+        // Display prompt (interactive only)
+        if (self->interactive) {
+            printf("myshell> ");
+            fflush(stdout);
+        }
         
-        // Read input
-        if (fgets(input, sizeof(input), stdin) == NULL) {
+        // Read input, any line length (a terminal's wait is not overhead)
+        uint64_t read_start = stats_now();
+        char* input = input_next_line(self->input, NULL);
+        if (input && !self->interactive) {
+            stats_since(STAT_READ, read_start);
+        }
+        if (input == NULL) {
             // EOF (Ctrl-D) or error
-            printf("\n");
+            if (self->interactive) {
+                printf("\n");
+            }
             break;
         }
         
-        // Trim and check for empty input
+        // Trim and check for empty input or comment lines
         char* trimmed_input = trim_whitespace(input);
-        if (is_empty_string(trimmed_input)) {
+        if (is_empty_string(trimmed_input) || trimmed_input[0] == '#') {
             continue;
         }
         
-        // Parse command
-        Command* cmd = NULL;
-        if (parse_input(trimmed_input, &cmd)) {
-            if (cmd) {
-                execute_command(self, cmd);
-                command_destroy(cmd);
+        // Expand !events and record the line as it will run
+        if (self->history) {
+            const char* expanded;
+            int r = history_expand(self->history, trimmed_input, &expanded);
+            if (r < 0) {
+                self->last_status = 1;
+                continue;
             }
+            if (r > 0) {
+                printf("%s\n", expanded);
+                fflush(stdout);
+                trimmed_input = (char*)expanded;
+            }
+            history_add(self->history, trimmed_input);
+        }
+        
+        // A list or compound command may go on over the next lines, and
+        // here-document bodies follow the line of their operator. Each
+        // pipeline in it is parsed, or borrowed from the parse cache, as
+        // it runs.
+        uint64_t line_start = stats_now();
+        ScriptNode* tree;
+        if (script_read(self, trimmed_input, &tree) < 0) {
+            self->last_status = 2;
+        } else if (tree) {
+            script_execute(self, tree);
         }
+        
+        // Release this command's parse memory in one step
+        parse_reset();
+        script_reset();
+        stats_since(STAT_LINE, line_start);
     }
 }
 
 // ==================== REDIRECTION HANDLING ====================
-int setup_redirections(Shell* self, Command* cmd) {
-    if (!self || !cmd) return -1;
-    
-    // Save original file descriptors
-    self->saved_stdin = dup(STDIN_FILENO);
-    self->saved_stdout = dup(STDOUT_FILENO);
-    
-    // Setup input redirection
-    if (cmd->input_redir.type == REDIR_IN && cmd->input_redir.filename) {
-        int fd = open(cmd->input_redir.filename, O_RDONLY);
-        if (fd < 0) {
-            perror("open input");
+// Marks a saved descriptor that was closed before the redirection
+#define FD_WAS_CLOSED -2
+
+// Here-document body in a memfd, positioned at the start
+static int heredoc_fd(Redirection* r) {
+    int fd = memfd_create("heredoc", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    
+    size_t off = 0;
+    while (off < r->text_len) {
+        ssize_t n = write(fd, r->text + off, r->text_len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
             return -1;
         }
-        if (dup2(fd, STDIN_FILENO) < 0) {
-            perror("dup2 input");
+        off += n;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// An opened target must not sit on a descriptor that an earlier
+// redirection of the same command replaces or copies from
+static int keep_clear_of_targets(Command* cmd, int fd) {
+    if (fd > REDIR_MAX_FD) return fd;
+    
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        if (r->fd == fd || r->dup_fd == fd) {
+            int high = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_MAX_FD + 1);
             close(fd);
-            return -1;
+            return high;
         }
-        close(fd);
     }
-    
-    // Setup output redirection
-    if (cmd->output_redir.type == REDIR_OUT && cmd->output_redir.filename) {
-        int fd = open(cmd->output_redir.filename, 
-                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return fd;
+}
+
+// Open every file and here-document cmd redirects to, close-on-exec, so
+// errors are reported by the shell itself. On failure nothing stays open.
+int open_redirections(Command* cmd) {
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        const char* name = r->filename;
+        int fd;
+        
+        switch (r->type) {
+            case REDIR_IN:
+                fd = open(r->filename, O_RDONLY | O_CLOEXEC);
+                break;
+            case REDIR_OUT:
+                fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                break;
+            case REDIR_APPEND:
+                fd = open(r->filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                break;
+            case REDIR_RDWR:
+                fd = open(r->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                break;
+            case REDIR_HEREDOC:
+                fd = heredoc_fd(r);
+                name = "here-document";
+                break;
+            default:
+                continue;
+        }
+        
+        if (fd >= 0) fd = keep_clear_of_targets(cmd, fd);
         if (fd < 0) {
-            perror("open output");
+            fprintf(stderr, "myshell: %s: %s\n", name, strerror(errno));
+            close_redirections(cmd);
             return -1;
         }
-        if (dup2(fd, STDOUT_FILENO) < 0) {
-            perror("dup2 output");
-            close(fd);
-            return -1;
+        r->open_fd = fd;
+    }
+    return 0;
+}
+
+void close_redirections(Command* cmd) {
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        if (r->open_fd >= 0) {
+            close(r->open_fd);
+            r->open_fd = -1;
         }
-        close(fd);
-    } else if (cmd->output_redir.type == REDIR_APPEND && cmd->output_redir.filename) {
-        int fd = open(cmd->output_redir.filename,
-                     O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (fd < 0) {
-            perror("open append");
-            return -1;
+    }
+}
+
+// Descriptor r copies onto r->fd, -1 if r closes it
+int redirection_source(const Redirection* r) {
+    return r->type == REDIR_DUP ? r->dup_fd : r->open_fd;
+}
+
+// Apply opened redirections in order. With self, the first change to each
+// descriptor is saved in the shell so restore_redirections() can undo it;
+// a child passes NULL.
+int apply_redirections(Command* cmd, Shell* self) {
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        if (self && self->saved_fds[r->fd] == -1) {
+            // Standard streams are never close-on-exec; other descriptors
+            // get their flag back when restored
+            if (r->fd > STDERR_FILENO && (fcntl(r->fd, F_GETFD) & FD_CLOEXEC) > 0) {
+                self->saved_cloexec |= 1 << r->fd;
+            }
+            self->saved_fds[r->fd] = fcntl(r->fd, F_DUPFD_CLOEXEC, REDIR_MAX_FD + 1);
+            if (self->saved_fds[r->fd] < 0) self->saved_fds[r->fd] = FD_WAS_CLOSED;
         }
-        if (dup2(fd, STDOUT_FILENO) < 0) {
-            perror("dup2 append");
-            close(fd);
+        
+        int src = redirection_source(r);
+        if (src < 0) {
+            close(r->fd);
+        } else if (src == r->fd) {
+            // n>&n keeps the descriptor, but it must survive exec
+            if (fcntl(r->fd, F_SETFD, 0) < 0) {
+                fprintf(stderr, "myshell: %d: %s\n", r->fd, strerror(errno));
+                return -1;
+            }
+        } else if (dup2(src, r->fd) < 0) {
+            fprintf(stderr, "myshell: %d: %s\n", src, strerror(errno));
             return -1;
         }
-        close(fd);
     }
-    
     return 0;
 }
 
-void restore_std_fds(Shell* self) {
-    if (!self) return;
+// Redirect the shell's own descriptors for a builtin
+int setup_redirections(Shell* self, Command* cmd) {
+    if (!self || !cmd) return -1;
+    if (!cmd->redirs) return 0;
     
-    if (self->saved_stdin != -1) {
-        dup2(self->saved_stdin, STDIN_FILENO);
-        close(self->saved_stdin);
-        self->saved_stdin = -1;
-    }
-    if (self->saved_stdout != -1) {
-        dup2(self->saved_stdout, STDOUT_FILENO);
-        close(self->saved_stdout);
-        self->saved_stdout = -1;
-    }
+    if (open_redirections(cmd) < 0) return -1;
+    int result = apply_redirections(cmd, self);
+    close_redirections(cmd);
+    return result;
 }
 
-// ==================== COMMAND EXECUTION ====================
-int execute_external(Shell* self, Command* cmd) {
-    if (!self || !cmd || !cmd->argv || cmd->argc == 0) return -1;
-    
-    pid_t pid = fork();
-    
-    if (pid < 0) {
-        perror("fork");
-        return -1;
-    }
+void restore_redirections(Shell* self) {
+    if (!self) return;
     
-    if (pid == 0) { // Child process
-        // Restore default SIGINT handler (in child)
-        signal(SIGINT, SIG_DFL);
+    for (int fd = 0; fd <= REDIR_MAX_FD; fd++) {
+        int saved = self->saved_fds[fd];
+        if (saved == -1) continue;
         
-        // Setup redirections
-        if (setup_redirections(self, cmd) < 0) {
-            exit(EXIT_FAILURE);
+        if (saved == FD_WAS_CLOSED) {
+            close(fd);
+        } else if (saved >= 0) {
+            dup3(saved, fd, self->saved_cloexec & (1 << fd) ? O_CLOEXEC : 0);
+            close(saved);
         }
-        
-        // Execute command
-        execvp(cmd->argv[0], cmd->argv);
-        
-        // If execvp returns, there was an error
-        perror("execvp");
-        exit(EXIT_FAILURE);
+        self->saved_fds[fd] = -1;
     }
-    
-    // Parent process
-    if (!cmd->background) {
-        // Foreground job - wait for completion
-        int status;
-        waitpid(pid, &status, 0);
-        
-        // Build command line for logging
-        char cmd_line[1024] = {0};
-        for (int i = 0; i < cmd->argc; i++) {
-            if (i > 0) strcat(cmd_line, " ");
-            strcat(cmd_line, cmd->argv[i]);
+    self->saved_cloexec = 0;
+}
+
+// ==================== BUILTIN PIPELINE STAGES ====================
+// Builtins the registry marks as stages run in the shell when it waits
+// for their pipeline, last to first once the other stages are started:
+// they read no input, so whatever they write to has started or is done.
+// Output for a pipe goes through a pipe of the builtin's own, drained by
+// a relay thread that holds up to STAGE_RELAY_MAX bytes the reader has
+// not taken, so the shell goes on once the builtin returns even if the
+// reader is slow or stopped. Only a larger output waits for the reader.
+#define STAGE_RELAY_MAX (16 * 1024 * 1024)
+#define STAGE_RELAY_CHUNK (64 * 1024)
+
+typedef struct {
+    int src;              // read end of the builtin's own pipe
+    int dst;              // the stage's pipe to the next stage
+} StageRelay;
+
+// Move the builtin's output on as the next stage reads it. Once that
+// stage is gone the rest is read and dropped, so the builtin never
+// writes to a closed pipe.
+static void relay_stage(int src, int dst) {
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+    
+    // Partial writes: the reader's pipe takes what fits
+    fcntl(dst, F_SETFL, fcntl(dst, F_GETFL) | O_NONBLOCK);
+    
+    char* held = NULL;
+    size_t cap = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t limit = STAGE_RELAY_MAX;
+    int reading = 1;
+    for (;;) {
+        struct pollfd polls[2];
+        int n = 0;
+        if (reading && end - start < limit) {
+            polls[n++] = (struct pollfd){src, POLLIN, 0};
+        }
+        if (dst >= 0 && end > start) {
+            polls[n++] = (struct pollfd){dst, POLLOUT, 0};
+        }
+        if (n == 0) break;
+        if (poll(polls, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
         
-        int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-        log_command(self, pid, cmd_line, exit_status);
+        for (int i = 0; i < n; i++) {
+            if (!polls[i].revents) continue;
+            
+            if (polls[i].fd == src) {
+                if (end == cap && start > 0) {
+                    memmove(held, held + start, end - start);
+                    end -= start;
+                    start = 0;
+                }
+                if (end == cap) {
+                    size_t bigger = cap ? cap * 2 : STAGE_RELAY_CHUNK;
+                    char* grown = realloc(held, bigger);
+                    if (!grown) {
+                        // Hold what fits, like a full pipe
+                        limit = cap;
+                        continue;
+                    }
+                    held = grown;
+                    cap = bigger;
+                }
+                ssize_t got = read(src, held + end, cap - end);
+                if (got > 0) {
+                    end += got;
+                } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+                    reading = 0;
+                }
+                if (dst < 0) start = end = 0;
+            } else {
+                ssize_t put = write(dst, held + start, end - start);
+                if (put > 0) {
+                    start += put;
+                } else if (put < 0 && errno != EINTR && errno != EAGAIN) {
+                    // The reader went away: forget its SIGPIPE
+                    struct timespec zero = {0, 0};
+                    sigtimedwait(&pipe_set, NULL, &zero);
+                    close(dst);
+                    dst = -1;
+                    start = end;
+                }
+                if (start == end) start = end = 0;
+            }
+        }
+    }
+    
+    free(held);
+    close(src);
+    if (dst >= 0) close(dst);
+}
+
+static void* relay_thread(void* arg) {
+    StageRelay relay = *(StageRelay*)arg;
+    free(arg);
+    relay_stage(relay.src, relay.dst);
+    return NULL;
+}
+
+// The fd a builtin stage writing the pipe dst writes: a pipe with a
+// relay behind it, or dst itself if none can be started. dst is taken.
+static int start_relay(int dst) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return dst;
+    
+    StageRelay* relay = malloc(sizeof(StageRelay));
+    if (relay) {
+        relay->src = fds[0];
+        relay->dst = dst;
         
-        return exit_status;
-    } else {
-        // Background job
-        printf("[bg] started pid %d\n", pid);
-        return 0;
+        pthread_attr_t attr;
+        pthread_t thread;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&thread, &attr, relay_thread, relay);
+        pthread_attr_destroy(&attr);
+        if (err == 0) return fds[1];
+        free(relay);
     }
+    close(fds[0]);
+    close(fds[1]);
+    return dst;
 }
 
-int execute_pipeline(Shell* self, Command* cmd1, Command* cmd2) {
-    if (!self || !cmd1 || !cmd2) return -1;
-    
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        perror("pipe");
-        return -1;
+// Run a builtin stage in the shell reading in_fd and writing out_fd (-1
+// to inherit). A pipe to the next stage (to_pipe) is closed when done.
+static int run_shell_stage(Shell* self, Command* stage, int in_fd, int out_fd, int to_pipe) {
+    int target = to_pipe ? start_relay(out_fd) : out_fd;
+    
+    // Without a relay a reader that is gone must not end the shell
+    sigset_t pipe_set, mask;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &mask);
+    
+    fflush(stdout);
+    int saved_in = -1;
+    int saved_out = -1;
+    if (in_fd >= 0) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(in_fd, STDIN_FILENO);
     }
+    if (target >= 0) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(target, STDOUT_FILENO);
+    }
+    
+    int status = execute_builtin(self, stage);
     
-    // First command (writes to pipe)
-    pid_t pid1 = fork();
-    if (pid1 < 0) {
-        perror("fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return -1;
+    if (saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    if (saved_out >= 0) {
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
     }
+    if (to_pipe) close(target);
     
-    if (pid1 == 0) {
-        // Child process 1
-        signal(SIGINT, SIG_DFL);
-        
-        // Redirect stdout to pipe write end
-        close(pipefd[0]);
-        if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-            perror("dup2 pipe write");
-            exit(EXIT_FAILURE);
+    struct timespec zero = {0, 0};
+    sigtimedwait(&pipe_set, NULL, &zero);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    return status;
+}
+
+// ==================== COMMAND EXECUTION ====================
+// Fill ends[i] with the fds stage i reads and writes: in_fd and out_fd at
+// the ends, a pipe between neighbours, and for producer |> (a) (b) a
+// Fanout whose consumers each start a group. Every group but the first
+// writes out_fd like the last stage does.
+static int connect_stages(Command* cmd, int count, int in_fd, int out_fd,
+                          int (*ends)[2], Fanout** fanout) {
+    int groups = 0;
+    Command* stage = cmd;
+    for (int i = 0; i < count; i++, stage = stage->pipe_next) {
+        if (stage->fanout) groups++;
+    }
+    *fanout = groups > 0 ? fanout_open(groups) : NULL;
+    if (groups > 0 && !*fanout) return -1;
+    
+    ends[0][0] = in_fd;
+    ends[count - 1][1] = out_fd;
+    
+    int group = 0;
+    stage = cmd;
+    for (int i = 0; i < count - 1; i++, stage = stage->pipe_next) {
+        if (stage->pipe_next->fanout) {
+            ends[i][1] = group == 0 ? fanout_input(*fanout) : out_fd;
+            ends[i + 1][0] = fanout_output(*fanout, group++);
+            continue;
         }
-        close(pipefd[1]);
         
-        // Setup any redirections for cmd1
-        if (setup_redirections(self, cmd1) < 0) {
-            exit(EXIT_FAILURE);
+        int fds[2];
+        if (pipe_open_sized(fds) < 0) {
+            perror("pipe");
+            Command* made = cmd;
+            for (int j = 0; j < i; j++, made = made->pipe_next) {
+                if (made->pipe_next->fanout) continue;
+                close(ends[j][1]);
+                close(ends[j + 1][0]);
+            }
+            fanout_abort(*fanout);
+            return -1;
         }
-        
-        execvp(cmd1->argv[0], cmd1->argv);
-        perror("execvp cmd1");
-        exit(EXIT_FAILURE);
+        ends[i][1] = fds[1];
+        ends[i + 1][0] = fds[0];
+    }
+    return 0;
+}
+
+// Start the first count stages of cmd connected by pipes; the first
+// reads in_fd and the last writes out_fd (-1 to inherit). pgid 0 puts
+// them in a new group led by the first stage. Functions, compound
+// commands and builtin stages run in forked copies of the shell, but
+// for a job the caller waits for in the foreground, builtins marked as
+// stages run in the shell before this returns. A session policy needs
+// a process of its own.
+static Job* start_stages(Shell* self, Command* cmd, int count, int in_fd, int out_fd,
+                         pid_t pgid, int foreground) {
+    pid_t* pids = calloc(count, sizeof(pid_t));
+    int (*ends)[2] = malloc(count * sizeof(*ends));
+    if (!pids || !ends) {
+        perror("malloc");
+        free(pids);
+        free(ends);
+        return NULL;
     }
     
-    // Second command (reads from pipe)
-    pid_t pid2 = fork();
-    if (pid2 < 0) {
-        perror("fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return -1;
+    // Create every pipe up front
+    Fanout* fanout;
+    if (connect_stages(cmd, count, in_fd, out_fd, ends, &fanout) < 0) {
+        free(pids);
+        free(ends);
+        return NULL;
     }
     
-    if (pid2 == 0) {
-        // Child process 2
-        signal(SIGINT, SIG_DFL);
-        
-        // Redirect stdin from pipe read end
-        close(pipefd[1]);
-        if (dup2(pipefd[0], STDIN_FILENO) < 0) {
-            perror("dup2 pipe read");
-            exit(EXIT_FAILURE);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    // Start every other stage in one process group
+    int in_shell = 0;
+    Command* stage = cmd;
+    for (int i = 0; i < count; i++, stage = stage->pipe_next) {
+        int function = stage->argc > 0 && script_is_function(stage->argv[0]);
+        if (foreground && count > 1 && !self->policy && !stage->body && !function &&
+            is_shell_stage(stage)) {
+            pids[i] = 0;
+            in_shell++;
+        } else if (stage->body || function || (count > 1 && is_builtin_command(stage))) {
+            pids[i] = spawn_subshell(self, stage, ends[i][0], ends[i][1], pgid);
+        } else {
+            pids[i] = spawn_command(self, stage, ends[i][0], ends[i][1], pgid);
         }
-        close(pipefd[0]);
-        
-        // Setup any redirections for cmd2
-        if (setup_redirections(self, cmd2) < 0) {
-            exit(EXIT_FAILURE);
+        if (pids[i] > 0 && pgid == 0) {
+            pgid = pids[i];
         }
-        
-        execvp(cmd2->argv[0], cmd2->argv);
-        perror("execvp cmd2");
-        exit(EXIT_FAILURE);
     }
     
-    // Parent process
-    close(pipefd[0]);
-    close(pipefd[1]);
-    
-    // Wait for both children
-    int status1, status2;
-    waitpid(pid1, &status1, 0);
-    waitpid(pid2, &status2, 0);
-    
-    // Build command line for logging
-    char cmd_line1[512] = {0};
-    char cmd_line2[512] = {0};
+    // Parent process: the stages have their ends now, so every reader
+    // sees EOF when its writer is done; the shell keeps its own stages'
+    for (int i = 0; i < count - 1; i++) {
+        if (pids[i] != 0 && ends[i][1] != out_fd) close(ends[i][1]);
+        if (pids[i + 1] != 0) close(ends[i + 1][0]);
+    }
+    if (fanout) fanout_start(fanout);
     
-    for (int i = 0; i < cmd1->argc; i++) {
-        if (i > 0) strcat(cmd_line1, " ");
-        strcat(cmd_line1, cmd1->argv[i]);
+    Job* job = job_create(self, cmd, count, pids, pgid, &start);
+    if (!job) {
+        perror("job");
     }
     
-    for (int i = 0; i < cmd2->argc; i++) {
-        if (i > 0) strcat(cmd_line2, " ");
-        strcat(cmd_line2, cmd2->argv[i]);
+    if (in_shell > 0) {
+        // The other stages may need the terminal meanwhile
+        job_give_terminal(self, job);
+        
+        for (int i = count - 1; i >= 0; i--) {
+            if (pids[i] != 0) continue;
+            
+            stage = cmd;
+            for (int j = 0; j < i; j++) stage = stage->pipe_next;
+            int to_pipe = ends[i][1] >= 0 && ends[i][1] != out_fd;
+            int status = run_shell_stage(self, stage, ends[i][0], ends[i][1], to_pipe);
+            if (i > 0) close(ends[i][0]);
+            if (job) job->procs[i].status = status;
+        }
     }
+    free(ends);
+    free(pids);
+    return job;
+}
+
+Job* execute_start(Shell* self, Command* cmd, int count, int in_fd, int out_fd, pid_t pgid) {
+    return start_stages(self, cmd, count, in_fd, out_fd, pgid, 0);
+}
+
+// Run the first count stages as one job in its own process group
+static int run_stages(Shell* self, Command* cmd, int count) {
+    Job* job = start_stages(self, cmd, count, -1, -1, 0, !cmd->background);
+    if (!job) return -1;
     
-    char full_cmd[2048];
-    int written = snprintf(full_cmd, sizeof(full_cmd), "%s | %s", cmd_line1, cmd_line2);
-    if (written >= sizeof(full_cmd)) {
-        full_cmd[sizeof(full_cmd) - 1] = '\0';
+    if (cmd->background) {
+        // Background job
+        if (job->pgid > 0) {
+            printf("[%d] %d\n", job->id, job->pgid);
+        }
+        return 0;
     }
     
-    int exit_status = WIFEXITED(status2) ? WEXITSTATUS(status2) : -1;
-    log_command(self, pid2, full_cmd, exit_status);
+    // Foreground job - wait for completion
+    return job_wait_foreground(self, job);
+}
+
+int execute_external(Shell* self, Command* cmd) {
+    if (!self || !cmd || !cmd->argv || cmd->argc == 0) return -1;
     
-    return exit_status;
+    return run_stages(self, cmd, 1);
+}
+
+int execute_pipeline(Shell* self, Command* cmd) {
+    if (!self || !cmd) return -1;
+    
+    int count = 0;
+    for (Command* stage = cmd; stage; stage = stage->pipe_next) {
+        count++;
+    }
+    
+    return run_stages(self, cmd, count);
 }
 
 void execute_command(Shell* self, Command* cmd) {
     if (!self || !cmd) return;
     
-    if (is_builtin_command(cmd)) {
-        execute_builtin(cmd);
+    // A line of NAME=value words sets shell variables
+    if (cmd->argc == 0) {
+        int failed = setup_redirections(self, cmd) < 0 ||
+                     var_assign(cmd->assigns, cmd->assign_count) < 0;
+        restore_redirections(self);
+        self->last_status = failed;
+        return;
+    }
+    
+    // A lone builtin runs in the shell itself
+    if (!cmd->pipe_next && is_builtin_command(cmd)) {
+        self->last_status = execute_builtin(self, cmd);
     } else if (cmd->pipe_next) {
-        execute_pipeline(self, cmd, cmd->pipe_next);
+        self->last_status = execute_pipeline(self, cmd);
     } else {
-        execute_external(self, cmd);
+        self->last_status = execute_external(self, cmd);
     }
-}
\ No newline at end of file
+}
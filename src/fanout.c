@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include "fanout.h"
+
+// ==================== PIPE SIZE ====================
+static long pipe_size = -1;    // -1 until MYSHELL_PIPE_SIZE is read
+
+static long configured_pipe_size(void) {
+    const char* value = getenv("MYSHELL_PIPE_SIZE");
+    if (!value || !*value) return 0;
+
+    char* end;
+    long n = strtol(value, &end, 10);
+    if (*end == 'K' || *end == 'k') n <<= 10, end++;
+    else if (*end == 'M' || *end == 'm') n <<= 20, end++;
+    if (*end || n <= 0 || n > INT_MAX) {
+        fprintf(stderr, "myshell: MYSHELL_PIPE_SIZE: invalid size `%s'\n", value);
+        return 0;
+    }
+    return n;
+}
+
+int pipe_open_sized(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
+
+    if (pipe_size < 0) pipe_size = configured_pipe_size();
+    if (pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, (int)pipe_size) < 0) {
+        // Past /proc/sys/fs/pipe-max-size, say: warn once, keep the default
+        fprintf(stderr, "myshell: MYSHELL_PIPE_SIZE=%ld: %s\n", pipe_size, strerror(errno));
+        pipe_size = 0;
+    }
+    return 0;
+}
+
+// ==================== SETUP ====================
+struct Fanout {
+    int input[2];          // the producer's pipe
+    int count;
+    int (*outputs)[2];     // one pipe per consumer; write end -1 once it is gone
+    int (*staging)[2];     // the relay's own pipe per consumer
+    size_t* pending;       // bytes in each staging pipe
+    struct pollfd* polls;  // consumers waited on, and which they are
+    int* polled;
+};
+
+static void close_pair(int fds[2]) {
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    fds[0] = fds[1] = -1;
+}
+
+void fanout_abort(Fanout* f) {
+    if (!f) return;
+
+    close_pair(f->input);
+    for (int n = 0; f->outputs && n < f->count; n++) {
+        close_pair(f->outputs[n]);
+        close_pair(f->staging[n]);
+    }
+    free(f->outputs);
+    free(f->staging);
+    free(f->pending);
+    free(f->polls);
+    free(f->polled);
+    free(f);
+}
+
+Fanout* fanout_open(int consumers) {
+    Fanout* f = calloc(1, sizeof(Fanout));
+    if (!f) {
+        perror("calloc");
+        return NULL;
+    }
+    f->input[0] = f->input[1] = -1;
+    f->outputs = malloc(consumers * sizeof(*f->outputs));
+    f->staging = malloc(consumers * sizeof(*f->staging));
+    f->pending = calloc(consumers, sizeof(size_t));
+    f->polls = malloc(consumers * sizeof(struct pollfd));
+    f->polled = malloc(consumers * sizeof(int));
+    if (!f->outputs || !f->staging || !f->pending || !f->polls || !f->polled) {
+        perror("malloc");
+        fanout_abort(f);
+        return NULL;
+    }
+    f->count = consumers;
+    for (int n = 0; n < consumers; n++) {
+        f->outputs[n][0] = f->outputs[n][1] = -1;
+        f->staging[n][0] = f->staging[n][1] = -1;
+    }
+
+    if (pipe_open_sized(f->input) < 0) {
+        perror("pipe");
+        fanout_abort(f);
+        return NULL;
+    }
+
+    // tee() only takes what fits, and a buffer cannot be teed from the
+    // middle: an empty staging pipe must hold all the input pipe can
+    int size = fcntl(f->input[0], F_GETPIPE_SZ);
+    int fits = size;
+    for (int n = 0; n < consumers; n++) {
+        if (pipe_open_sized(f->outputs[n]) < 0 || pipe2(f->staging[n], O_CLOEXEC) < 0) {
+            perror("pipe");
+            fanout_abort(f);
+            return NULL;
+        }
+        int got = fcntl(f->staging[n][1], F_SETPIPE_SZ, size);
+        if (got < 0) got = fcntl(f->staging[n][1], F_GETPIPE_SZ);
+        if (got < fits) fits = got;
+    }
+    if (fits < size && fcntl(f->input[1], F_SETPIPE_SZ, fits) < 0) {
+        perror("fcntl");
+        fanout_abort(f);
+        return NULL;
+    }
+    return f;
+}
+
+int fanout_input(Fanout* f) {
+    return f->input[1];
+}
+
+int fanout_output(Fanout* f, int n) {
+    return f->outputs[n][0];
+}
+
+// ==================== RELAY ====================
+// Stop writing to a consumer that went away, and forget the SIGPIPE its
+// pipe raised in this thread
+static void drop_consumer(Fanout* f, int n, int* live, const sigset_t* pipe_set) {
+    struct timespec zero = {0, 0};
+    sigtimedwait(pipe_set, NULL, &zero);
+
+    close_pair(f->staging[n]);
+    close(f->outputs[n][1]);
+    f->outputs[n][1] = -1;
+    f->pending[n] = 0;
+    (*live)--;
+}
+
+// Move each staging pipe into its consumer's pipe as room appears there
+static void drain_staging(Fanout* f, int* live, const sigset_t* pipe_set) {
+    for (;;) {
+        int waiting = 0;
+        for (int n = 0; n < f->count; n++) {
+            if (f->pending[n] == 0) continue;
+
+            ssize_t moved = splice(f->staging[n][0], NULL, f->outputs[n][1], NULL, f->pending[n],
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) f->pending[n] -= moved;
+            if (moved < 0 && errno != EAGAIN && errno != EINTR) {
+                drop_consumer(f, n, live, pipe_set);
+                continue;
+            }
+            if (f->pending[n] == 0) continue;
+
+            f->polls[waiting].fd = f->outputs[n][1];
+            f->polls[waiting].events = POLLOUT;
+            f->polled[waiting++] = n;
+        }
+        if (waiting == 0) return;
+
+        if (poll(f->polls, waiting, -1) < 0 && errno != EINTR) return;
+        for (int w = 0; w < waiting; w++) {
+            if (f->polls[w].revents & (POLLERR | POLLHUP)) {
+                drop_consumer(f, f->polled[w], live, pipe_set);
+            }
+        }
+    }
+}
+
+// Copy what the producer wrote into the staging pipe of every consumer
+// still reading: tee() for all but the last, which takes the original
+// with splice(). Returns the bytes taken from the input, 0 at its end
+// and -1 after an error.
+static ssize_t take_input(Fanout* f) {
+    int last = -1;
+    for (int n = 0; n < f->count; n++) {
+        if (f->outputs[n][1] >= 0) last = n;
+    }
+
+    ssize_t len = 0;
+    for (int n = 0; n <= last; n++) {
+        if (f->outputs[n][1] < 0) continue;
+
+        // The first call waits for data and sets how much this round moves
+        size_t want = len ? (size_t)len : INT_MAX;
+        ssize_t got;
+        do {
+            got = n == last
+                ? splice(f->input[0], NULL, f->staging[n][1], NULL, want, SPLICE_F_MOVE)
+                : tee(f->input[0], f->staging[n][1], want, 0);
+        } while (got < 0 && errno == EINTR);
+
+        if (got < 0) perror("myshell: |>");
+        if (got <= 0) return got;
+        if (len && got != len) {
+            fprintf(stderr, "myshell: |>: short copy (%zd of %zd bytes)\n", got, len);
+            return -1;
+        }
+        len = got;
+        f->pending[n] = len;
+    }
+    return len;
+}
+
+static void relay(Fanout* f) {
+    // A consumer that exits must not take the shell down with SIGPIPE
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    int live = f->count;
+    while (live > 0) {
+        if (take_input(f) <= 0) break;
+        drain_staging(f, &live, &pipe_set);
+    }
+
+    // Closing the input tells a producer that nobody is left to read
+    fanout_abort(f);
+}
+
+static void* relay_thread(void* arg) {
+    relay(arg);
+    return NULL;
+}
+
+void fanout_start(Fanout* f) {
+    // The caller closed its ends, or handed them to the stages
+    f->input[1] = -1;
+    for (int n = 0; n < f->count; n++) {
+        f->outputs[n][0] = -1;
+    }
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, relay_thread, f);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        // The stages see end of input and a closed pipe and finish
+        fprintf(stderr, "myshell: |>: %s\n", strerror(err));
+        fanout_abort(f);
+    }
+}
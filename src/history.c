@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "history.h"
+
+#define HISTORY_FILE_NAME ".myshell_history"
+#define HISTORY_KEY_BYTES 4          // prefixes up to this length are hashed
+#define HISTORY_SEARCH_CHUNK (1 << 20)
+
+// ==================== HISTORY STORE ====================
+// The history file is one line per entry, written with single O_APPEND
+// writes so concurrent shells never interleave or rewrite it. It is read
+// through a shared read-only mapping that grows as the file does.
+//
+// Nothing is scanned at startup. The index is built the first time it is
+// needed and then extended with whatever was appended since:
+//   offsets[i]  start of entry i+1 (entries are numbered from 1)
+//   prefixes    hash of every 1..HISTORY_KEY_BYTES byte prefix seen, to
+//               the newest entry starting with it
+//   chain[i]    previous entry with the same HISTORY_KEY_BYTES prefix,
+//               followed for longer !prefix lookups
+typedef struct {
+    uint64_t key;         // prefix bytes and length, 0 = empty slot
+    uint32_t latest;      // entry number
+} PrefixSlot;
+
+struct History {
+    int fd;
+    const char* map;
+    size_t map_len;
+    size_t indexed;       // bytes covered by the index
+    uint64_t* offsets;
+    uint32_t* chain;
+    size_t count;
+    size_t capacity;
+    PrefixSlot* prefixes;
+    size_t prefix_cap;    // power of two
+    size_t prefix_used;
+    char* expansion;      // result of history_expand
+    size_t expansion_cap;
+};
+
+// ==================== MAPPING ====================
+// Extend the mapping to the current file size
+static int history_map(History* hist) {
+    struct stat st;
+    if (fstat(hist->fd, &st) < 0) return -1;
+
+    size_t size = st.st_size;
+    if (size <= hist->map_len) return 0;
+
+    void* map;
+    if (hist->map) {
+        map = mremap((void*)hist->map, hist->map_len, size, MREMAP_MAYMOVE);
+    } else {
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, hist->fd, 0);
+    }
+    if (map == MAP_FAILED) return -1;
+
+    hist->map = map;
+    hist->map_len = size;
+    return 0;
+}
+
+static size_t entry_length(History* hist, size_t idx) {
+    const char* start = hist->map + hist->offsets[idx];
+    const char* end = memchr(start, '\n', hist->indexed - hist->offsets[idx]);
+    return end ? (size_t)(end - start) : hist->indexed - hist->offsets[idx];
+}
+
+// ==================== PREFIX INDEX ====================
+static uint64_t prefix_key(const char* text, size_t len) {
+    uint64_t key = (uint64_t)len << 32;
+    for (size_t i = 0; i < len; i++) {
+        key |= (uint64_t)(unsigned char)text[i] << (8 * i);
+    }
+    return key;
+}
+
+static PrefixSlot* prefix_slot(History* hist, uint64_t key) {
+    size_t mask = hist->prefix_cap - 1;
+    size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+    while (hist->prefixes[i].key && hist->prefixes[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &hist->prefixes[i];
+}
+
+static int prefix_grow(History* hist) {
+    size_t cap = hist->prefix_cap ? hist->prefix_cap * 2 : 1024;
+    PrefixSlot* old = hist->prefixes;
+    size_t old_cap = hist->prefix_cap;
+
+    hist->prefixes = calloc(cap, sizeof(PrefixSlot));
+    if (!hist->prefixes) {
+        hist->prefixes = old;
+        return -1;
+    }
+    hist->prefix_cap = cap;
+
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].key) {
+            *prefix_slot(hist, old[i].key) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int index_entry(History* hist, size_t offset, size_t len) {
+    if (hist->count == hist->capacity) {
+        size_t cap = hist->capacity ? hist->capacity * 2 : 4096;
+        uint64_t* offsets = realloc(hist->offsets, cap * sizeof(uint64_t));
+        if (!offsets) return -1;
+        hist->offsets = offsets;
+        uint32_t* chain = realloc(hist->chain, cap * sizeof(uint32_t));
+        if (!chain) return -1;
+        hist->chain = chain;
+        hist->capacity = cap;
+    }
+
+    const char* text = hist->map + offset;
+    uint32_t number = hist->count + 1;
+    size_t key_len = len < HISTORY_KEY_BYTES ? len : HISTORY_KEY_BYTES;
+
+    hist->offsets[hist->count] = offset;
+    hist->chain[hist->count] = 0;
+    for (size_t n = 1; n <= key_len; n++) {
+        if ((hist->prefix_used + 1) * 2 > hist->prefix_cap && prefix_grow(hist) < 0) {
+            return -1;
+        }
+        PrefixSlot* slot = prefix_slot(hist, prefix_key(text, n));
+        if (!slot->key) {
+            slot->key = prefix_key(text, n);
+            hist->prefix_used++;
+        } else if (n == key_len) {
+            hist->chain[hist->count] = slot->latest;
+        }
+        slot->latest = number;
+    }
+
+    hist->count++;
+    return 0;
+}
+
+// Bring the index up to date with complete lines in the file
+static int history_sync(History* hist) {
+    if (history_map(hist) < 0) return -1;
+
+    const char* end = hist->map + hist->map_len;
+    const char* p = hist->map + hist->indexed;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        if (!nl) break;   // another shell is mid-write
+
+        if (nl > p && index_entry(hist, p - hist->map, nl - p) < 0) {
+            perror("history");
+            return -1;
+        }
+        p = nl + 1;
+        hist->indexed = p - hist->map;
+    }
+    return 0;
+}
+
+// ==================== LOOKUPS ====================
+static int find_prefix(History* hist, const char* prefix, size_t len) {
+    if (len == 0 || hist->prefix_cap == 0) return 0;
+
+    size_t key_len = len < HISTORY_KEY_BYTES ? len : HISTORY_KEY_BYTES;
+    PrefixSlot* slot = prefix_slot(hist, prefix_key(prefix, key_len));
+    uint32_t number = slot->key ? slot->latest : 0;
+
+    // Entries on one chain share the first HISTORY_KEY_BYTES bytes
+    while (number && len > key_len) {
+        size_t idx = number - 1;
+        if (entry_length(hist, idx) >= len &&
+            memcmp(hist->map + hist->offsets[idx], prefix, len) == 0) {
+            break;
+        }
+        number = hist->chain[idx];
+    }
+    return number;
+}
+
+static size_t entry_at_offset(History* hist, size_t offset) {
+    size_t lo = 0;
+    size_t hi = hist->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hist->offsets[mid] <= offset) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Newest entry before byte offset end containing text: search the
+// mapping backwards in chunks
+static int find_substring(History* hist, const char* text, size_t len, size_t end) {
+    if (len == 0 || len >= HISTORY_SEARCH_CHUNK || hist->count == 0) return 0;
+
+    while (end > 0) {
+        size_t start = end > HISTORY_SEARCH_CHUNK ? end - HISTORY_SEARCH_CHUNK : 0;
+        const char* last = NULL;
+        const char* p = hist->map + start;
+        const char* limit = hist->map + end;
+
+        // The next chunk ends len - 1 bytes past this one's start, so a
+        // match straddling the boundary is still seen
+        while ((p = memmem(p, limit - p, text, len)) != NULL) {
+            last = p++;
+        }
+        if (last) {
+            return entry_at_offset(hist, last - hist->map) + 1;
+        }
+        if (start == 0) break;
+        end = start + len - 1;
+    }
+    return 0;
+}
+
+// ==================== HISTORY LIFECYCLE ====================
+void history_init(Shell* self) {
+    if (!self) return;
+    self->history = NULL;
+
+    char path[4096];
+    const char* file = getenv("MYSHELL_HISTFILE");
+    if (!file || !*file) {
+        const char* home = getenv("HOME");
+        if (!home) return;
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME);
+        file = path;
+    }
+
+    int fd = open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(file);
+        return;
+    }
+
+    History* hist = calloc(1, sizeof(History));
+    if (!hist) {
+        close(fd);
+        return;
+    }
+    hist->fd = fd;
+    self->history = hist;
+}
+
+void history_cleanup(Shell* self) {
+    if (!self || !self->history) return;
+
+    History* hist = self->history;
+    if (hist->map) munmap((void*)hist->map, hist->map_len);
+    close(hist->fd);
+    free(hist->offsets);
+    free(hist->chain);
+    free(hist->prefixes);
+    free(hist->expansion);
+    free(hist);
+    self->history = NULL;
+}
+
+// ==================== RECORDING ====================
+void history_add(History* hist, const char* line) {
+    if (!hist || !line || !*line) return;
+    size_t len = strlen(line);
+
+    // Skip a repeat of the newest entry, looking only at the file's tail
+    if (history_map(hist) == 0 && hist->map_len > len) {
+        const char* end = hist->map + hist->map_len - 1;
+        if (*end == '\n' && (size_t)(end - hist->map) >= len &&
+            memcmp(end - len, line, len) == 0 &&
+            (end - len == hist->map || end[-len - 1] == '\n')) {
+            return;
+        }
+    }
+
+    // One write per entry keeps concurrent appends whole
+    struct iovec iov[2] = {
+        {(void*)line, len},
+        {"\n", 1}
+    };
+    if (writev(hist->fd, iov, 2) < 0) {
+        perror("history");
+    }
+}
+
+// ==================== EXPANSION ====================
+int history_expand(History* hist, const char* line, const char** out) {
+    if (!hist || line[0] != '!' || line[1] == '\0' || line[1] == ' ' ||
+        line[1] == '\t' || line[1] == '=' || line[1] == '(') {
+        return 0;
+    }
+
+    // The event is the first word; the rest of the line is kept
+    const char* event = line + 1;
+    const char* rest = event + strcspn(event, " \t|&<>;");
+    int number = 0;
+
+    if (history_sync(hist) < 0) return -1;
+
+    if (*event == '!') {
+        number = hist->count;
+        rest = event + 1;
+    } else if (*event == '?') {
+        const char* close = strchr(event + 1, '?');
+        size_t len = close ? (size_t)(close - event - 1) : strlen(event + 1);
+        number = find_substring(hist, event + 1, len, hist->indexed);
+        rest = close ? close + 1 : event + 1 + len;
+    } else if (*event == '-' || (*event >= '0' && *event <= '9')) {
+        char* end;
+        long n = strtol(event, &end, 10);
+        if (n < 0) n = (long)hist->count + n + 1;
+        if (n >= 1 && (size_t)n <= hist->count) number = n;
+        rest = end;
+    } else {
+        number = find_prefix(hist, event, rest - event);
+    }
+
+    if (number == 0) {
+        fprintf(stderr, "myshell: %.*s: event not found\n", (int)(rest - line), line);
+        return -1;
+    }
+
+    size_t idx = number - 1;
+    size_t entry_len = entry_length(hist, idx);
+    size_t rest_len = strlen(rest);
+    if (entry_len + rest_len + 1 > hist->expansion_cap) {
+        size_t cap = entry_len + rest_len + 1;
+        char* buf = realloc(hist->expansion, cap);
+        if (!buf) return -1;
+        hist->expansion = buf;
+        hist->expansion_cap = cap;
+    }
+    memcpy(hist->expansion, hist->map + hist->offsets[idx], entry_len);
+    memcpy(hist->expansion + entry_len, rest, rest_len + 1);
+
+    *out = hist->expansion;
+    return 1;
+}
+
+// ==================== LISTING AND SEARCH ====================
+size_t history_count(History* hist) {
+    if (!hist || history_sync(hist) < 0) return 0;
+    return hist->count;
+}
+
+void history_print(History* hist, size_t last) {
+    if (!hist || history_sync(hist) < 0) return;
+
+    size_t first = last && last < hist->count ? hist->count - last : 0;
+    for (size_t i = first; i < hist->count; i++) {
+        printf("%5zu  %.*s\n", i + 1, (int)entry_length(hist, i),
+               hist->map + hist->offsets[i]);
+    }
+}
+
+// Print the newest entry containing text, not counting the newest entry
+// (the history command itself); 0 if there was one
+int history_search(History* hist, const char* text) {
+    if (!hist || history_sync(hist) < 0 || hist->count < 2) return -1;
+
+    int number = find_substring(hist, text, strlen(text), hist->offsets[hist->count - 1]);
+    if (number == 0) return -1;
+
+    size_t idx = number - 1;
+    printf("%5d  %.*s\n", number, (int)entry_length(hist, idx), hist->map + hist->offsets[idx]);
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+// ==================== READER STATE ====================
+// Lines are handed out in place: the '\n' is overwritten with '\0' and a
+// pointer into the buffer is returned, so no per-line copy is made.
+struct InputReader {
+    int fd;               // -1 for in-memory sources
+    char* buf;
+    size_t cap;
+    size_t start;         // first unread byte
+    size_t scan;          // bytes before this offset hold no '\n'
+    size_t end;           // end of valid data
+    int eof;
+    int owns_fd;
+    size_t map_len;       // non-zero when buf is an mmap
+    char* tail;           // copy of a final unterminated line (mmap only)
+    dev_t dev;            // file open on fd when the reader was made
+    ino_t ino;
+};
+
+// ==================== INPUT SOURCES ====================
+// Buffered read() on fd; the fd is not closed by input_close
+InputReader* input_open_fd(int fd) {
+    InputReader* in = calloc(1, sizeof(InputReader));
+    if (!in) return NULL;
+
+    in->buf = malloc(INPUT_BUFFER_SIZE);
+    if (!in->buf) {
+        free(in);
+        return NULL;
+    }
+    in->fd = fd;
+    in->cap = INPUT_BUFFER_SIZE;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        in->dev = st.st_dev;
+        in->ino = st.st_ino;
+    }
+    return in;
+}
+
+// Scripts are mapped whole; anything that cannot be mapped is read
+InputReader* input_open_file(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        InputReader* in = input_open_fd(fd);
+        if (!in) {
+            close(fd);
+            return NULL;
+        }
+        in->owns_fd = 1;
+        return in;
+    }
+
+    // Private writable mapping so line ends can be replaced with '\0'
+    char* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    InputReader* in = calloc(1, sizeof(InputReader));
+    if (!in) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    in->fd = -1;
+    in->buf = map;
+    in->cap = st.st_size;
+    in->end = st.st_size;
+    in->map_len = st.st_size;
+    in->eof = 1;
+    return in;
+}
+
+InputReader* input_open_string(const char* str) {
+    InputReader* in = calloc(1, sizeof(InputReader));
+    if (!in) return NULL;
+
+    size_t len = strlen(str);
+    in->buf = malloc(len + 1);
+    if (!in->buf) {
+        free(in);
+        return NULL;
+    }
+    memcpy(in->buf, str, len + 1);
+
+    in->fd = -1;
+    in->cap = len + 1;
+    in->end = len;
+    in->eof = 1;
+    return in;
+}
+
+void input_close(InputReader* in) {
+    if (!in) return;
+
+    if (in->map_len) {
+        munmap(in->buf, in->map_len);
+    } else {
+        free(in->buf);
+    }
+    if (in->owns_fd) {
+        close(in->fd);
+    }
+    free(in->tail);
+    free(in);
+}
+
+int input_reads(const InputReader* in, int fd) {
+    struct stat st;
+    return in && in->fd == fd && fstat(fd, &st) == 0 &&
+           st.st_dev == in->dev && st.st_ino == in->ino;
+}
+
+// ==================== LINE READING ====================
+// Compact and refill the buffer; 0 at end of input
+static int refill(InputReader* in) {
+    if (in->start > 0) {
+        memmove(in->buf, in->buf + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->scan -= in->start;
+        in->start = 0;
+    }
+
+    // Line longer than the buffer: grow it, one byte is kept for '\0'
+    if (in->end + 1 >= in->cap) {
+        char* bigger = realloc(in->buf, in->cap * 2);
+        if (!bigger) return 0;
+        in->buf = bigger;
+        in->cap *= 2;
+    }
+
+    ssize_t n;
+    do {
+        n = read(in->fd, in->buf + in->end, in->cap - in->end - 1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        if (n < 0) perror("read");
+        in->eof = 1;
+        return 0;
+    }
+
+    in->end += n;
+    return 1;
+}
+
+char* input_next_line(InputReader* in, size_t* len) {
+    if (!in) return NULL;
+
+    for (;;) {
+        char* nl = memchr(in->buf + in->scan, '\n', in->end - in->scan);
+        if (nl) {
+            char* line = in->buf + in->start;
+            *nl = '\0';
+            if (len) *len = nl - line;
+            in->start = in->scan = nl - in->buf + 1;
+            return line;
+        }
+        in->scan = in->end;
+
+        if (in->eof || (in->fd >= 0 && !refill(in))) break;
+    }
+
+    // Last line without a trailing newline
+    if (in->start >= in->end) return NULL;
+
+    size_t line_len = in->end - in->start;
+    char* line = in->buf + in->start;
+
+    if (in->map_len && in->map_len % sysconf(_SC_PAGESIZE) == 0) {
+        // Mapping ends exactly at a page boundary: no room for '\0'
+        free(in->tail);
+        in->tail = malloc(line_len + 1);
+        if (!in->tail) return NULL;
+        memcpy(in->tail, line, line_len);
+        line = in->tail;
+    }
+    line[line_len] = '\0';
+
+    if (len) *len = line_len;
+    in->start = in->scan = in->end;
+    return line;
+}
@@ -0,0 +1,931 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include "jobs.h"
+#include "logger.h"
+#include "stats.h"
+
+#define JOB_EVENT_BATCH 64
+#define JOB_WAKE_TOKEN  0     // epoll data of the reaper's eventfd; job ids start at 1
+
+// ==================== JOB TABLE STATE ====================
+// Background processes are watched through pidfds in one epoll set.
+// A reaper thread wakes on exits, reaps exactly the process whose
+// pidfd fired and marks finished jobs; notices and log records are
+// produced on the main thread at the next prompt.
+struct JobTable {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;    // a background process exited
+    Job** slots;               // slots[id - 1]
+    int capacity;
+    int highest;               // largest id in use
+    int current;               // %+
+    int previous;              // %-
+    int epfd;
+    int wakefd;
+    pthread_t reaper;
+    int has_reaper;
+    int unwatched;             // background processes without a pidfd
+};
+
+// ==================== HELPERS ====================
+// Exit code of a reaped child, 128+signal if it was killed
+static int decode_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+// Render "argv0 argv1 | argv0 ..." for the log, truncating at size
+static void format_command_line(Command* cmd, int count, char* buf, size_t size) {
+    size_t len = 0;
+    int consumers = 0;
+    buf[0] = '\0';
+
+    for (int n = 0; cmd && n < count; cmd = cmd->pipe_next, n++) {
+        if (n > 0 && len < size) {
+            const char* sep = !cmd->fanout ? " | " : consumers++ ? ") (" : " |> (";
+            len += snprintf(buf + len, size - len, "%s", sep);
+        }
+        for (int i = 0; i < cmd->argc && len < size; i++) {
+            len += snprintf(buf + len, size - len, i > 0 ? " %s" : "%s", cmd->argv[i]);
+        }
+    }
+    if (consumers && len < size) snprintf(buf + len, size - len, ")");
+}
+
+static long elapsed_us(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void give_terminal(Shell* self, pid_t pgid) {
+    if (self->interactive && pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, pgid);
+    }
+}
+
+static void take_terminal(Shell* self) {
+    if (self->interactive) {
+        tcsetpgrp(STDIN_FILENO, self->shell_pgid);
+    }
+}
+
+static void record_pipe_status(Shell* self, Job* job) {
+    int* copy = realloc(self->pipe_status, job->nprocs * sizeof(int));
+    if (!copy) return;
+
+    for (int i = 0; i < job->nprocs; i++) {
+        copy[i] = job->procs[i].status;
+    }
+    self->pipe_status = copy;
+    self->pipe_status_count = job->nprocs;
+}
+
+// Pipeline status: last stage, or the rightmost failure with pipefail
+static int job_status(Shell* self, Job* job) {
+    int status = job->procs[job->nprocs - 1].status;
+    if (self->pipefail) {
+        for (int i = job->nprocs - 1; i >= 0; i--) {
+            if (job->procs[i].status != 0) {
+                status = job->procs[i].status;
+                break;
+            }
+        }
+    }
+    return status;
+}
+
+// ==================== PROCESS REAPING ====================
+// Record a reaped process. Background jobs: called with the lock held.
+static void reap_process(JobTable* tbl, Job* job, int idx, int status, struct rusage* ru) {
+    JobProcess* p = &job->procs[idx];
+    if (p->exited) return;
+
+    p->exited = 1;
+    p->status = decode_status(status);
+    p->usage.wall_us = elapsed_us(&job->start);
+    stats_record(STAT_RUN, p->usage.wall_us * 1000ULL);
+    p->usage.user_us = ru->ru_utime.tv_sec * 1000000L + ru->ru_utime.tv_usec;
+    p->usage.sys_us = ru->ru_stime.tv_sec * 1000000L + ru->ru_stime.tv_usec;
+    p->usage.maxrss_kb = ru->ru_maxrss;
+    p->usage.nvcsw = ru->ru_nvcsw;
+    p->usage.nivcsw = ru->ru_nivcsw;
+    p->usage.inblock = ru->ru_inblock;
+    p->usage.oublock = ru->ru_oublock;
+
+    if (p->pidfd >= 0) {
+        close(p->pidfd);
+        p->pidfd = -1;
+    } else if (job->background && tbl) {
+        tbl->unwatched--;
+    }
+
+    if (--job->remaining == 0) {
+        job->state = JOB_DONE;
+    }
+}
+
+static int find_process(Job* job, pid_t pid) {
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pid == pid) return i;
+    }
+    return -1;
+}
+
+static void* reaper_main(void* arg);
+
+// The reaper starts with the first background job, so a shell that never
+// has one (or is forked before it does) runs no thread of its own for it.
+// Without it every background process is polled at the prompt. Lock held.
+static void start_reaper(JobTable* tbl) {
+    // Reaper blocks all signals so they stay on the main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    if (pthread_create(&tbl->reaper, NULL, reaper_main, tbl) == 0) {
+        tbl->has_reaper = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (!tbl->has_reaper) {
+        close(tbl->wakefd);
+        close(tbl->epfd);
+        tbl->wakefd = -1;
+        tbl->epfd = -1;
+    }
+}
+
+// Hand a job's live processes to the reaper. Lock held.
+static void watch_job(JobTable* tbl, Job* job) {
+    job->background = 1;
+    if (tbl->epfd >= 0 && !tbl->has_reaper) start_reaper(tbl);
+
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        if (p->exited || p->pid <= 0) continue;
+
+        p->pidfd = tbl->epfd >= 0 ? open_pidfd(p->pid) : -1;
+        if (p->pidfd >= 0) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = ((uint64_t)job->id << 32) | (uint32_t)i;
+            if (epoll_ctl(tbl->epfd, EPOLL_CTL_ADD, p->pidfd, &ev) < 0) {
+                close(p->pidfd);
+                p->pidfd = -1;
+            }
+        }
+        if (p->pidfd < 0) {
+            tbl->unwatched++;
+        }
+    }
+}
+
+// Take a job back from the reaper before waiting on it directly. Lock held.
+static void unwatch_job(JobTable* tbl, Job* job) {
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        if (p->pidfd >= 0) {
+            close(p->pidfd);
+            p->pidfd = -1;
+        } else if (!p->exited && p->pid > 0) {
+            tbl->unwatched--;
+        }
+    }
+
+    job->background = 0;
+}
+
+// Fallback for processes without a pidfd. Lock held.
+static void poll_unwatched(JobTable* tbl) {
+    if (tbl->unwatched == 0) return;
+
+    for (int id = 1; id <= tbl->highest; id++) {
+        Job* job = tbl->slots[id - 1];
+        if (!job || !job->background) continue;
+
+        for (int i = 0; i < job->nprocs; i++) {
+            JobProcess* p = &job->procs[i];
+            if (p->exited || p->pid <= 0 || p->pidfd >= 0) continue;
+
+            int status;
+            struct rusage ru;
+            if (wait4(p->pid, &status, WNOHANG, &ru) == p->pid) {
+                reap_process(tbl, job, i, status, &ru);
+            }
+        }
+    }
+}
+
+// Pick up stop/continue events of background jobs (SIGTTIN etc). Lock held.
+static void refresh_stopped(Job* job) {
+    if (!job->background || job->state == JOB_DONE) return;
+
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        if (p->exited || p->pid <= 0) continue;
+
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_PID, p->pid, &info, WSTOPPED | WCONTINUED | WNOHANG) == 0 &&
+            info.si_pid == p->pid) {
+            job->state = info.si_code == CLD_STOPPED ? JOB_STOPPED : JOB_RUNNING;
+        }
+    }
+}
+
+static void* reaper_main(void* arg) {
+    JobTable* tbl = arg;
+    struct epoll_event events[JOB_EVENT_BATCH];
+    int stopping = 0;
+
+    while (!stopping) {
+        int n = epoll_wait(tbl->epfd, events, JOB_EVENT_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        pthread_mutex_lock(&tbl->lock);
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u64 == JOB_WAKE_TOKEN) {
+                stopping = 1;
+                continue;
+            }
+
+            int id = (int)(events[e].data.u64 >> 32);
+            int idx = (int)(events[e].data.u64 & 0xffffffffu);
+            if (id < 1 || id > tbl->highest) continue;
+
+            // Stale events (job moved to the foreground or id reused)
+            // find nothing to reap here
+            Job* job = tbl->slots[id - 1];
+            if (!job || !job->background || idx >= job->nprocs) continue;
+
+            JobProcess* p = &job->procs[idx];
+            if (p->exited || p->pidfd < 0) continue;
+
+            int status;
+            struct rusage ru;
+            if (wait4(p->pid, &status, WNOHANG, &ru) == p->pid) {
+                reap_process(tbl, job, idx, status, &ru);
+            }
+        }
+        pthread_cond_broadcast(&tbl->changed);
+        pthread_mutex_unlock(&tbl->lock);
+    }
+
+    return NULL;
+}
+
+// ==================== TABLE MAINTENANCE ====================
+static void pick_current(JobTable* tbl, int removed) {
+    if (tbl->current == removed) {
+        tbl->current = tbl->previous;
+        tbl->previous = 0;
+    } else if (tbl->previous == removed) {
+        tbl->previous = 0;
+    }
+    if (tbl->current == 0) {
+        tbl->current = tbl->highest;
+    }
+
+    // Previous is the most recent other job
+    if (tbl->previous == 0) {
+        for (int id = tbl->highest; id > 0; id--) {
+            if (tbl->slots[id - 1] && id != tbl->current) {
+                tbl->previous = id;
+                break;
+            }
+        }
+    }
+}
+
+static void make_current(JobTable* tbl, Job* job) {
+    if (tbl->current != job->id) {
+        tbl->previous = tbl->current;
+        tbl->current = job->id;
+    }
+}
+
+// Lock held
+static int insert_job(JobTable* tbl, Job* job) {
+    int id = tbl->highest + 1;
+
+    if (id > tbl->capacity) {
+        int new_capacity = tbl->capacity ? tbl->capacity * 2 : 16;
+        Job** slots = realloc(tbl->slots, new_capacity * sizeof(Job*));
+        if (!slots) return -1;
+        memset(slots + tbl->capacity, 0, (new_capacity - tbl->capacity) * sizeof(Job*));
+        tbl->slots = slots;
+        tbl->capacity = new_capacity;
+    }
+
+    job->id = id;
+    tbl->slots[id - 1] = job;
+    tbl->highest = id;
+    make_current(tbl, job);
+    return 0;
+}
+
+// Lock held
+static void remove_job(JobTable* tbl, Job* job) {
+    if (job->id == 0) return;
+
+    tbl->slots[job->id - 1] = NULL;
+    while (tbl->highest > 0 && !tbl->slots[tbl->highest - 1]) {
+        tbl->highest--;
+    }
+    pick_current(tbl, job->id);
+    job->id = 0;
+}
+
+static void free_job(Job* job) {
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pidfd >= 0) close(job->procs[i].pidfd);
+        free(job->procs[i].cmd_line);
+    }
+    free(job->procs);
+    free(job->cmd_line);
+    free(job);
+}
+
+// One record per stage, then the pipeline summary
+static void log_job(Shell* self, Job* job, int status) {
+    if (job->nprocs == 1) {
+        JobProcess* p = &job->procs[0];
+        log_command(self, p->pid, p->cmd_line, p->status, p->pid > 0 ? &p->usage : NULL, 0);
+        return;
+    }
+
+    ProcUsage total = {0};
+    int* statuses = malloc(job->nprocs * sizeof(int));
+
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        log_command(self, p->pid, p->cmd_line, p->status, p->pid > 0 ? &p->usage : NULL, 1);
+
+        if (p->usage.wall_us > total.wall_us) total.wall_us = p->usage.wall_us;
+        total.user_us += p->usage.user_us;
+        total.sys_us += p->usage.sys_us;
+        if (p->usage.maxrss_kb > total.maxrss_kb) total.maxrss_kb = p->usage.maxrss_kb;
+        total.nvcsw += p->usage.nvcsw;
+        total.nivcsw += p->usage.nivcsw;
+        total.inblock += p->usage.inblock;
+        total.oublock += p->usage.oublock;
+        if (statuses) statuses[i] = p->status;
+    }
+
+    if (statuses) {
+        log_pipeline(self, job->pgid, job->cmd_line, statuses, job->nprocs, status, &total);
+        free(statuses);
+    }
+}
+
+// Log a finished job, drop it from the table and free it (main thread)
+static int release_job(Shell* self, Job* job) {
+    JobTable* tbl = self->jobs;
+    int status = job_status(self, job);
+
+    if (job->id && tbl) {
+        pthread_mutex_lock(&tbl->lock);
+        remove_job(tbl, job);
+        pthread_mutex_unlock(&tbl->lock);
+    }
+
+    log_job(self, job, status);
+    free_job(job);
+    return status;
+}
+
+// ==================== JOB TABLE LIFECYCLE ====================
+void jobs_init(Shell* self) {
+    if (!self) return;
+
+    JobTable* tbl = calloc(1, sizeof(JobTable));
+    if (!tbl) return;
+
+    pthread_mutex_init(&tbl->lock, NULL);
+    pthread_cond_init(&tbl->changed, NULL);
+    tbl->wakefd = -1;
+
+    // Without epoll every background process is polled at the prompt
+    tbl->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (tbl->epfd >= 0) {
+        tbl->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = JOB_WAKE_TOKEN;
+        if (tbl->wakefd < 0 || epoll_ctl(tbl->epfd, EPOLL_CTL_ADD, tbl->wakefd, &ev) < 0) {
+            if (tbl->wakefd >= 0) close(tbl->wakefd);
+            close(tbl->epfd);
+            tbl->wakefd = -1;
+            tbl->epfd = -1;
+        }
+    }
+
+    self->jobs = tbl;
+}
+
+void jobs_cleanup(Shell* self) {
+    if (!self || !self->jobs) return;
+
+    JobTable* tbl = self->jobs;
+    if (tbl->has_reaper) {
+        uint64_t one = 1;
+        if (write(tbl->wakefd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(tbl->reaper, NULL);
+        } else {
+            pthread_cancel(tbl->reaper);
+            pthread_join(tbl->reaper, NULL);
+        }
+    }
+
+    // Finished jobs still get their log records; running ones are left alone
+    for (int id = 1; id <= tbl->highest; id++) {
+        Job* job = tbl->slots[id - 1];
+        if (!job) continue;
+        if (job->state == JOB_DONE) {
+            log_job(self, job, job_status(self, job));
+        }
+        free_job(job);
+    }
+
+    if (tbl->wakefd >= 0) close(tbl->wakefd);
+    if (tbl->epfd >= 0) close(tbl->epfd);
+    pthread_cond_destroy(&tbl->changed);
+    pthread_mutex_destroy(&tbl->lock);
+    free(tbl->slots);
+    free(tbl);
+    self->jobs = NULL;
+}
+
+// ==================== JOB CREATION AND WAITING ====================
+// Track the first count stages of cmd. pids[i] < 0 marks a stage that
+// failed to start (status 127), 0 a builtin stage the caller already ran.
+// Background jobs enter the table now; foreground jobs only if they get
+// stopped.
+Job* job_create(Shell* self, Command* cmd, int count, const pid_t* pids,
+                pid_t pgid, const struct timespec* start) {
+    if (!self || !cmd || count <= 0) return NULL;
+
+    Job* job = calloc(1, sizeof(Job));
+    if (!job) return NULL;
+
+    job->procs = calloc(count, sizeof(JobProcess));
+    char line[2048];
+    format_command_line(cmd, count, line, sizeof(line));
+    job->cmd_line = strdup(line);
+    if (!job->procs || !job->cmd_line) {
+        free(job->procs);
+        free(job->cmd_line);
+        free(job);
+        return NULL;
+    }
+
+    job->pgid = pgid;
+    job->state = JOB_RUNNING;
+    job->nprocs = count;
+    job->start = *start;
+
+    Command* stage = cmd;
+    for (int i = 0; i < count; i++, stage = stage->pipe_next) {
+        JobProcess* p = &job->procs[i];
+        p->pid = pids[i];
+        p->pidfd = -1;
+        if (p->pid > 0) {
+            job->remaining++;
+        } else {
+            p->exited = 1;
+            p->status = 127;
+        }
+
+        format_command_line(stage, 1, line, sizeof(line));
+        p->cmd_line = strdup(line);
+        if (!p->cmd_line) p->cmd_line = strdup("");
+    }
+    if (job->remaining == 0) {
+        job->state = JOB_DONE;
+    }
+
+    if (cmd->background && self->jobs) {
+        JobTable* tbl = self->jobs;
+        pthread_mutex_lock(&tbl->lock);
+        if (insert_job(tbl, job) == 0) {
+            watch_job(tbl, job);
+        }
+        pthread_mutex_unlock(&tbl->lock);
+    }
+
+    return job;
+}
+
+// For a job whose stages in the shell run before it is waited for
+void job_give_terminal(Shell* self, Job* job) {
+    if (self && job) give_terminal(self, job->pgid);
+}
+
+// Wait for a job that owns the terminal. Finished jobs are logged and
+// freed; a stopped job is moved to the table and stays valid.
+int job_wait_foreground(Shell* self, Job* job) {
+    if (!self || !job) return -1;
+
+    int stop_sig = 0;
+    int by_group = job->pgid > 0;
+
+    give_terminal(self, job->pgid);
+    while (job->remaining > 0) {
+        int status;
+        struct rusage ru;
+        pid_t which = -job->pgid;
+
+        if (!by_group) {
+            // Some stage left the group: wait stage by stage
+            int idx = 0;
+            while (idx < job->nprocs && (job->procs[idx].exited || job->procs[idx].pid <= 0)) {
+                idx++;
+            }
+            which = job->procs[idx].pid;
+        }
+
+        uint64_t wait_start = stats_now();
+        pid_t pid = wait4(which, &status, WUNTRACED, &ru);
+        stats_since(STAT_WAIT, wait_start);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            if (by_group && errno == ECHILD) {
+                by_group = 0;
+                continue;
+            }
+            break;
+        }
+
+        if (WIFSTOPPED(status)) {
+            stop_sig = WSTOPSIG(status);
+            break;
+        }
+
+        int idx = find_process(job, pid);
+        if (idx >= 0) {
+            reap_process(NULL, job, idx, status, &ru);
+        }
+    }
+    take_terminal(self);
+
+    if (stop_sig) {
+        JobTable* tbl = self->jobs;
+        job->state = JOB_STOPPED;
+        if (tbl) {
+            pthread_mutex_lock(&tbl->lock);
+            if (job->id || insert_job(tbl, job) == 0) {
+                make_current(tbl, job);
+                watch_job(tbl, job);
+            }
+            pthread_mutex_unlock(&tbl->lock);
+        }
+        printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->cmd_line);
+        return 128 + stop_sig;
+    }
+
+    // Processes we could not wait for count as failed
+    for (int i = 0; i < job->nprocs; i++) {
+        if (!job->procs[i].exited) {
+            job->procs[i].exited = 1;
+            job->procs[i].status = -1;
+        }
+    }
+
+    record_pipe_status(self, job);
+    return release_job(self, job);
+}
+
+// Block until a background job finishes (or is stopped)
+int job_wait(Shell* self, Job* job) {
+    if (!self || !self->jobs || !job) return -1;
+
+    JobTable* tbl = self->jobs;
+    pthread_mutex_lock(&tbl->lock);
+    for (;;) {
+        poll_unwatched(tbl);
+        refresh_stopped(job);
+        if (job->state != JOB_RUNNING) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&tbl->changed, &tbl->lock, &deadline);
+    }
+    JobState state = job->state;
+    pthread_mutex_unlock(&tbl->lock);
+
+    if (state == JOB_STOPPED) {
+        return 128 + SIGTSTP;
+    }
+    return release_job(self, job);
+}
+
+// Wait for every running background job; notices still come at the prompt
+int jobs_wait_all(Shell* self) {
+    if (!self || !self->jobs) return 0;
+
+    JobTable* tbl = self->jobs;
+    pthread_mutex_lock(&tbl->lock);
+    for (;;) {
+        poll_unwatched(tbl);
+
+        int running = 0;
+        for (int id = 1; id <= tbl->highest; id++) {
+            Job* job = tbl->slots[id - 1];
+            if (!job) continue;
+            refresh_stopped(job);
+            if (job->state == JOB_RUNNING) running = 1;
+        }
+        if (!running) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&tbl->changed, &tbl->lock, &deadline);
+    }
+    pthread_mutex_unlock(&tbl->lock);
+
+    return 0;
+}
+
+// ==================== UNTRACKED JOBS ====================
+// Jobs run by another scheduler (the parallel builtin) never enter the
+// table: the caller polls their pidfds, reaps them here without blocking
+// and releases them once nothing is left running.
+void job_open_pidfds(Job* job) {
+    if (!job) return;
+
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        if (!p->exited && p->pidfd < 0) {
+            p->pidfd = open_pidfd(p->pid);
+        }
+    }
+}
+
+// Returns the number of processes still running
+int job_reap_nowait(Job* job) {
+    if (!job) return 0;
+
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProcess* p = &job->procs[i];
+        if (p->exited) continue;
+
+        int status;
+        struct rusage ru;
+        pid_t pid;
+        do {
+            pid = wait4(p->pid, &status, WNOHANG, &ru);
+        } while (pid < 0 && errno == EINTR);
+
+        if (pid == p->pid) {
+            reap_process(NULL, job, i, status, &ru);
+        } else if (pid < 0) {
+            // Not our child any more: count it as failed
+            p->exited = 1;
+            p->status = -1;
+            if (p->pidfd >= 0) {
+                close(p->pidfd);
+                p->pidfd = -1;
+            }
+            job->remaining--;
+        }
+    }
+    return job->remaining;
+}
+
+// Log and free a finished untracked job; returns its status
+int job_finish(Shell* self, Job* job) {
+    if (!self || !job) return -1;
+
+    return release_job(self, job);
+}
+
+// ==================== JOB CONTROL ====================
+// %n, %+, %%, %-, %prefix, or a pid/pgid of one of the jobs
+Job* job_find(Shell* self, const char* spec) {
+    if (!self || !self->jobs || !spec) return NULL;
+
+    JobTable* tbl = self->jobs;
+    Job* found = NULL;
+
+    pthread_mutex_lock(&tbl->lock);
+    if (spec[0] == '%') {
+        const char* rest = spec + 1;
+        int id = 0;
+
+        if (*rest == '\0' || strcmp(rest, "+") == 0 || strcmp(rest, "%") == 0) {
+            id = tbl->current;
+        } else if (strcmp(rest, "-") == 0) {
+            id = tbl->previous;
+        } else if (*rest >= '0' && *rest <= '9') {
+            id = atoi(rest);
+        } else {
+            // Most recent job whose command starts with rest
+            for (int i = tbl->highest; i > 0 && !id; i--) {
+                Job* job = tbl->slots[i - 1];
+                if (job && strncmp(job->cmd_line, rest, strlen(rest)) == 0) {
+                    id = i;
+                }
+            }
+        }
+
+        if (id >= 1 && id <= tbl->highest) {
+            found = tbl->slots[id - 1];
+        }
+    } else {
+        pid_t pid = atoi(spec);
+        for (int i = 1; i <= tbl->highest && !found && pid > 0; i++) {
+            Job* job = tbl->slots[i - 1];
+            if (!job) continue;
+            if (job->pgid == pid || find_process(job, pid) >= 0) {
+                found = job;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tbl->lock);
+
+    return found;
+}
+
+// fg (foreground = 1) or bg a job from the table
+int job_continue(Shell* self, Job* job, int foreground) {
+    if (!self || !self->jobs || !job) return 1;
+
+    JobTable* tbl = self->jobs;
+
+    if (!foreground) {
+        pthread_mutex_lock(&tbl->lock);
+        refresh_stopped(job);
+        int was_stopped = job->state == JOB_STOPPED;
+        if (was_stopped) job->state = JOB_RUNNING;
+        make_current(tbl, job);
+        pthread_mutex_unlock(&tbl->lock);
+
+        if (was_stopped && job->pgid > 0) {
+            kill(-job->pgid, SIGCONT);
+        }
+        printf("[%d]+ %s &\n", job->id, job->cmd_line);
+        return 0;
+    }
+
+    pthread_mutex_lock(&tbl->lock);
+    poll_unwatched(tbl);
+    if (job->state == JOB_DONE) {
+        pthread_mutex_unlock(&tbl->lock);
+        printf("%s\n", job->cmd_line);
+        record_pipe_status(self, job);
+        return release_job(self, job);
+    }
+    unwatch_job(tbl, job);
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock(&tbl->lock);
+
+    printf("%s\n", job->cmd_line);
+    fflush(stdout);
+
+    give_terminal(self, job->pgid);
+    if (job->pgid > 0) {
+        kill(-job->pgid, SIGCONT);
+    }
+    return job_wait_foreground(self, job);
+}
+
+int job_signal(Shell* self, Job* job, int sig) {
+    if (!self || !self->jobs || !job || job->pgid <= 0) return -1;
+
+    if (kill(-job->pgid, sig) < 0) return -1;
+
+    JobTable* tbl = self->jobs;
+    pthread_mutex_lock(&tbl->lock);
+    if (sig == SIGCONT && job->state == JOB_STOPPED) {
+        job->state = JOB_RUNNING;
+    } else if (job->state == JOB_STOPPED && (sig == SIGTERM || sig == SIGHUP)) {
+        // Stopped processes only act on these once continued
+        kill(-job->pgid, SIGCONT);
+        job->state = JOB_RUNNING;
+    }
+    pthread_mutex_unlock(&tbl->lock);
+
+    return 0;
+}
+
+// ==================== PROMPT-TIME BOOKKEEPING ====================
+static const char* state_text(Shell* self, Job* job, char* buf, size_t size) {
+    if (job->state == JOB_RUNNING) return "Running";
+    if (job->state == JOB_STOPPED) return "Stopped";
+
+    int status = job_status(self, job);
+    if (status == 0) return "Done";
+    snprintf(buf, size, "Exit %d", status);
+    return buf;
+}
+
+static char job_marker(JobTable* tbl, Job* job) {
+    if (job->id == tbl->current) return '+';
+    if (job->id == tbl->previous) return '-';
+    return ' ';
+}
+
+// Collect notices for finished jobs and release them. The notices are
+// written with a single call before the prompt.
+static void report_jobs(Shell* self, int all, int long_format) {
+    JobTable* tbl = self->jobs;
+    char* notices = NULL;
+    size_t notices_len = 0;
+    FILE* out = open_memstream(&notices, &notices_len);
+    if (!out) return;
+
+    Job** finished = NULL;
+    int finished_count = 0;
+
+    pthread_mutex_lock(&tbl->lock);
+    poll_unwatched(tbl);
+
+    if (tbl->highest > 0) {
+        finished = malloc(tbl->highest * sizeof(Job*));
+    }
+
+    for (int id = 1; id <= tbl->highest; id++) {
+        Job* job = tbl->slots[id - 1];
+        if (!job) continue;
+        if (all) refresh_stopped(job);
+
+        int done = job->state == JOB_DONE;
+        if (!done && !all) continue;
+
+        char buf[32];
+        if (long_format) {
+            fprintf(out, "[%d]%c %d  %-22s%s%s\n", job->id, job_marker(tbl, job), job->pgid,
+                    state_text(self, job, buf, sizeof(buf)), job->cmd_line,
+                    job->state == JOB_RUNNING ? " &" : "");
+        } else {
+            fprintf(out, "[%d]%c  %-22s%s%s\n", job->id, job_marker(tbl, job),
+                    state_text(self, job, buf, sizeof(buf)), job->cmd_line,
+                    job->state == JOB_RUNNING ? " &" : "");
+        }
+
+        if (done && finished) {
+            finished[finished_count++] = job;
+        }
+    }
+    pthread_mutex_unlock(&tbl->lock);
+
+    fclose(out);
+    if (notices_len > 0) {
+        fwrite(notices, 1, notices_len, stdout);
+        fflush(stdout);
+    }
+    free(notices);
+
+    for (int i = 0; i < finished_count; i++) {
+        release_job(self, finished[i]);
+    }
+    free(finished);
+}
+
+void jobs_notify(Shell* self) {
+    // highest only changes on the main thread, so this check needs no lock
+    if (!self || !self->jobs || self->jobs->highest == 0) return;
+    report_jobs(self, 0, 0);
+}
+
+void jobs_print(Shell* self, int long_format) {
+    if (!self || !self->jobs) return;
+    report_jobs(self, 1, long_format);
+}
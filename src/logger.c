@@ -2,26 +2,552 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 #include "logger.h"
+#include "stats.h"
+
+#define LOG_RING_SIZE      (64 * 1024)   // bytes buffered before writers must flush
+#define LOG_FLUSH_BYTES    (16 * 1024)   // batch size that wakes the flusher early
+#define LOG_FLUSH_INTERVAL 1             // seconds between batched flushes
+#define LOG_INDEX_PENDING  1024          // index entries buffered with the ring
+#define LOG_DEFAULT_MAX    (64L * 1024 * 1024)
+#define LOG_DEFAULT_KEEP   8
+
+// ==================== LOGGER STATE ====================
+struct Logger {
+    int fd;
+    int idx_fd;
+    LogSyncMode mode;
+    char path[PATH_MAX];       // absolute, the shell may cd away
+    off_t max_size;            // rotate past this, 0 never
+    int keep;                  // rotated generations kept
+
+    // Ring buffer: [tail, head) holds unwritten bytes, positions grow forever
+    char* ring;
+    size_t head;
+    size_t tail;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // flusher wakeup
+    pthread_cond_t drained;    // flush finished
+    pthread_t flusher;
+    int has_flusher;
+    int tried_flusher;         // started with the first record
+    int flushing;
+    int stopping;
+
+    // Index entries of records still in the ring, offset holding the
+    // ring position; batch is the flusher's copy while the lock is dropped
+    LogIndexEntry* pending;
+    int pending_count;
+    LogIndexEntry* batch;
+
+    // Timestamp cache, refreshed once per second
+    time_t ts_sec;
+    char ts_buf[32];
+};
+
+// ==================== FILES AND ROTATION ====================
+void log_file_name(char* buf, size_t size, const char* log_path, int generation, int index) {
+    const char* suffix = index ? LOG_INDEX_SUFFIX : "";
+    if (generation == 0) {
+        snprintf(buf, size, "%s%s", log_path, suffix);
+    } else {
+        snprintf(buf, size, "%s.%d%s", log_path, generation, suffix);
+    }
+}
+
+static int same_file(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+// Point fd at a fresh open of path, keeping the descriptor number (the
+// log's is also the shell's log_fd)
+static int reopen_at(int fd, const char* path) {
+    int nfd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (nfd < 0 || fd < 0) return nfd;
+
+    dup3(nfd, fd, O_CLOEXEC);
+    close(nfd);
+    return fd;
+}
+
+// Shift <log>.N to <log>.N+1 down to <log> itself, the oldest falling
+// off the end. Each index moves before its log: a shell that sees the
+// new log will also find the new index.
+static void rotate_files(Logger* lg) {
+    char from[PATH_MAX + 32];
+    char to[PATH_MAX + 32];
+
+    for (int gen = lg->keep - 1; gen >= 0; gen--) {
+        for (int index = 1; index >= 0; index--) {
+            log_file_name(from, sizeof(from), lg->path, gen, index);
+            log_file_name(to, sizeof(to), lg->path, gen + 1, index);
+            rename(from, to);
+        }
+    }
+}
+
+// Rotate the log once it is full, and follow it when another shell has
+// rotated (or removed) it. Shells serialize on flock of the current log,
+// so a rotation is complete before anyone reopens.
+static void check_generation(Logger* lg) {
+    struct stat fd_st, path_st;
+    if (fstat(lg->fd, &fd_st) < 0) return;
+
+    int moved = lg->idx_fd < 0 || stat(lg->path, &path_st) < 0 || !same_file(&fd_st, &path_st);
+    if (!moved && (lg->max_size == 0 || fd_st.st_size < lg->max_size)) return;
+
+    if (flock(lg->fd, LOCK_EX) < 0) return;
+
+    // Whoever held the lock before us may have rotated already
+    if (fstat(lg->fd, &fd_st) == 0 && stat(lg->path, &path_st) == 0 &&
+        same_file(&fd_st, &path_st) && lg->max_size > 0 && fd_st.st_size >= lg->max_size) {
+        rotate_files(lg);
+    }
+
+    char idx_path[PATH_MAX + 32];
+    log_file_name(idx_path, sizeof(idx_path), lg->path, 0, 1);
+    lg->idx_fd = reopen_at(lg->idx_fd, idx_path);
+
+    // Replacing the old log's description also drops its lock
+    if (stat(lg->path, &path_st) < 0 || !same_file(&fd_st, &path_st)) {
+        reopen_at(lg->fd, lg->path);
+    } else {
+        flock(lg->fd, LOCK_UN);
+    }
+}
+
+// ==================== RING BUFFER ====================
+static size_t ring_used(Logger* lg) {
+    return lg->head - lg->tail;
+}
+
+// writev all of a batch; returns the log offset it landed at, -1 if it
+// could not be written
+static off_t write_batch(int fd, struct iovec* iov, int iovcnt, size_t len) {
+    off_t at = -1;
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        // O_APPEND moved our offset to the end of what we wrote
+        if (done == 0) at = lseek(fd, 0, SEEK_CUR) - n;
+        done += n;
+
+        // Short writes only happen on a full disk: go on with the rest
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return at;
+}
+
+// Turn ring positions into log offsets and append the entries
+static void write_index(Logger* lg, int count, off_t at, size_t start) {
+    if (lg->idx_fd < 0 || count == 0) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    for (int i = 0; i < count; i++) {
+        LogIndexEntry* e = &lg->batch[i];
+        e->offset = at + (e->offset - start);
+        int64_t delay = now_ms - e->time_ms;
+        e->delay_ms = delay < 0 ? 0 : delay > UINT32_MAX ? UINT32_MAX : (uint32_t)delay;
+    }
+
+    // One append of whole entries keeps the file aligned
+    ssize_t n;
+    do {
+        n = write(lg->idx_fd, lg->batch, count * sizeof(LogIndexEntry));
+    } while (n < 0 && errno == EINTR);
+}
+
+// Write out everything queued up to now. Called with lock held; the
+// lock is released during the write so producers keep appending.
+static void drain_locked(Logger* lg) {
+    while (lg->flushing) {
+        pthread_cond_wait(&lg->drained, &lg->lock);
+    }
+
+    while (ring_used(lg) > 0) {
+        size_t start = lg->tail;
+        size_t end = lg->head;
+        size_t off = start % LOG_RING_SIZE;
+        size_t len = end - start;
+
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = lg->ring + off;
+        if (off + len > LOG_RING_SIZE) {
+            iov[0].iov_len = LOG_RING_SIZE - off;
+            iov[1].iov_base = lg->ring;
+            iov[1].iov_len = len - iov[0].iov_len;
+            iovcnt = 2;
+        } else {
+            iov[0].iov_len = len;
+        }
+
+        // Every pending entry belongs to this batch
+        int count = lg->pending_count;
+        memcpy(lg->batch, lg->pending, count * sizeof(LogIndexEntry));
+        lg->pending_count = 0;
+
+        lg->flushing = 1;
+        pthread_mutex_unlock(&lg->lock);
+        check_generation(lg);
+        off_t at = write_batch(lg->fd, iov, iovcnt, len);
+        if (at >= 0) {
+            write_index(lg, count, at, start);
+        }
+        pthread_mutex_lock(&lg->lock);
+        lg->flushing = 0;
+
+        // A failed batch is dropped rather than block commands on a broken log
+        lg->tail = end;
+    }
+
+    pthread_cond_broadcast(&lg->drained);
+}
+
+static void* flusher_main(void* arg) {
+    Logger* lg = arg;
+
+    pthread_mutex_lock(&lg->lock);
+    while (!lg->stopping) {
+        if (ring_used(lg) < LOG_FLUSH_BYTES) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += LOG_FLUSH_INTERVAL;
+            pthread_cond_timedwait(&lg->wake, &lg->lock, &deadline);
+        }
+        drain_locked(lg);
+    }
+    pthread_mutex_unlock(&lg->lock);
+
+    return NULL;
+}
+
+// Batched mode flushes from a background thread, started with the first
+// record so a shell forked before it logs anything has no thread missing.
+// If it cannot be started, records are still flushed when the ring fills
+// or at exit. The thread blocks all signals so SIGCHLD is only seen by
+// the shell. Lock held.
+static void start_flusher(Logger* lg) {
+    lg->tried_flusher = 1;
+
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    if (pthread_create(&lg->flusher, NULL, flusher_main, lg) == 0) {
+        lg->has_flusher = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+static void append_record(Logger* lg, const char* record, size_t len, LogIndexEntry* entry) {
+    if (len > LOG_RING_SIZE) {
+        len = LOG_RING_SIZE;
+    }
+
+    pthread_mutex_lock(&lg->lock);
+    if (lg->mode == LOG_SYNC_BATCH && !lg->tried_flusher) start_flusher(lg);
+
+    // Full: flush in the caller instead of dropping records
+    if (ring_used(lg) + len > LOG_RING_SIZE || lg->pending_count == LOG_INDEX_PENDING) {
+        drain_locked(lg);
+    }
+
+    entry->offset = lg->head;
+    entry->length = len;
+    lg->pending[lg->pending_count++] = *entry;
+
+    size_t off = lg->head % LOG_RING_SIZE;
+    size_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+    memcpy(lg->ring + off, record, first);
+    memcpy(lg->ring, record + first, len - first);
+    lg->head += len;
+
+    if (lg->mode == LOG_SYNC_COMMAND) {
+        drain_locked(lg);
+    } else if (lg->has_flusher && ring_used(lg) >= LOG_FLUSH_BYTES) {
+        pthread_cond_signal(&lg->wake);
+    }
+
+    pthread_mutex_unlock(&lg->lock);
+}
+
+static const char* cached_timestamp(Logger* lg, int64_t* time_ms) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    *time_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    if (now.tv_sec != lg->ts_sec) {
+        struct tm tm_info;
+        localtime_r(&now.tv_sec, &tm_info);
+        strftime(lg->ts_buf, sizeof(lg->ts_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
+        lg->ts_sec = now.tv_sec;
+    }
+
+    return lg->ts_buf;
+}
+
+// ==================== LOGGER LIFECYCLE ====================
+static LogSyncMode parse_sync_mode(const char* value) {
+    if (!value) return LOG_SYNC_BATCH;
+    if (strcmp(value, "command") == 0) return LOG_SYNC_COMMAND;
+    if (strcmp(value, "exit") == 0) return LOG_SYNC_EXIT;
+    return LOG_SYNC_BATCH;
+}
+
+static long env_size(const char* name, long fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) return fallback;
+
+    char* end;
+    long n = strtol(value, &end, 10);
+    if (*end == 'K' || *end == 'k') n <<= 10;
+    else if (*end == 'M' || *end == 'm') n <<= 20;
+    else if (*end == 'G' || *end == 'g') n <<= 30;
+    return n >= 0 ? n : fallback;
+}
+
+void logger_init(Shell* self) {
+    if (!self || self->log_fd < 0) return;
+
+    Logger* lg = calloc(1, sizeof(Logger));
+    if (!lg) return;
+
+    lg->ring = malloc(LOG_RING_SIZE);
+    lg->pending = malloc(LOG_INDEX_PENDING * sizeof(LogIndexEntry));
+    lg->batch = malloc(LOG_INDEX_PENDING * sizeof(LogIndexEntry));
+    if (!lg->ring || !lg->pending || !lg->batch) {
+        free(lg->ring);
+        free(lg->pending);
+        free(lg->batch);
+        free(lg);
+        return;
+    }
+
+    // Same file shell_init just opened, by absolute path
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) ||
+        snprintf(lg->path, sizeof(lg->path), "%s/myshell.log", cwd) >= (int)sizeof(lg->path)) {
+        snprintf(lg->path, sizeof(lg->path), "myshell.log");
+    }
+
+    lg->fd = self->log_fd;
+    lg->idx_fd = -1;
+    lg->max_size = env_size("MYSHELL_LOG_MAX", LOG_DEFAULT_MAX);
+    lg->keep = (int)env_size("MYSHELL_LOG_KEEP", LOG_DEFAULT_KEEP);
+    if (lg->keep < 1) lg->keep = 1;
+    lg->mode = parse_sync_mode(getenv("MYSHELL_LOG_SYNC"));
+    lg->ts_sec = (time_t)-1;
+
+    // Opens the index, and catches a rotation racing with shell_init
+    check_generation(lg);
+
+    pthread_mutex_init(&lg->lock, NULL);
+    pthread_cond_init(&lg->wake, NULL);
+    pthread_cond_init(&lg->drained, NULL);
+
+    self->logger = lg;
+}
+
+void logger_flush(Shell* self) {
+    if (!self || !self->logger) return;
+
+    Logger* lg = self->logger;
+    pthread_mutex_lock(&lg->lock);
+    drain_locked(lg);
+    pthread_mutex_unlock(&lg->lock);
+}
+
+void logger_shutdown(Shell* self) {
+    if (!self || !self->logger) return;
+
+    Logger* lg = self->logger;
+    if (lg->has_flusher) {
+        pthread_mutex_lock(&lg->lock);
+        lg->stopping = 1;
+        pthread_cond_signal(&lg->wake);
+        pthread_mutex_unlock(&lg->lock);
+        pthread_join(lg->flusher, NULL);
+    }
+
+    logger_flush(self);
+
+    pthread_cond_destroy(&lg->drained);
+    pthread_cond_destroy(&lg->wake);
+    pthread_mutex_destroy(&lg->lock);
+    if (lg->idx_fd >= 0) close(lg->idx_fd);
+    free(lg->ring);
+    free(lg->pending);
+    free(lg->batch);
+    free(lg);
+    self->logger = NULL;
+}
+
+const char* logger_path(Shell* self) {
+    return self && self->logger ? self->logger->path : NULL;
+}
 
 // ==================== LOGGING FUNCTIONS ====================
-void log_command(Shell* self, pid_t pid, const char* cmd_line, int status) {
-    if (!self || self->log_fd < 0 || !cmd_line) return;
-    
-    // Get current time
-    time_t now = time(NULL);
-    char time_buf[64];
-    struct tm* tm_info = localtime(&now);
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
-    
+// Escape cmd for its quotes, cutting it short with "..." past size
+static void escape_field(char* out, size_t size, const char* s) {
+    size_t n = 0;
+
+    for (; *s; s++) {
+        unsigned char c = *s;
+        char tmp[5];
+        size_t k = 2;
+        tmp[0] = '\\';
+        if (c == '\\' || c == '"') {
+            tmp[1] = c;
+        } else if (c == '\n') {
+            tmp[1] = 'n';
+        } else if (c == '\t') {
+            tmp[1] = 't';
+        } else if (c < 0x20 || c == 0x7f) {
+            k = snprintf(tmp, sizeof(tmp), "\\x%02x", c);
+        } else {
+            tmp[0] = c;
+            k = 1;
+        }
+
+        if (n + k + 4 > size) {
+            memcpy(out + n, "...", 3);
+            n += 3;
+            break;
+        }
+        memcpy(out + n, tmp, k);
+        n += k;
+    }
+    out[n] = '\0';
+}
+
+static uint64_t hash_command(const char* s) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Cap a formatted record at the buffer, still ending in a newline
+static int finish_record(char* buf, size_t size, int len) {
+    if (len >= (int)size) {
+        len = size - 1;
+        buf[len - 1] = '\n';
+    }
+    return len;
+}
+
+// " wall_ms=... user_ms=... sys_ms=... maxrss_kb=... ctxsw=v/i io=in/out"
+static void format_usage(char* buf, size_t size, const ProcUsage* usage) {
+    if (!usage) {
+        buf[0] = '\0';
+        return;
+    }
+
+    snprintf(buf, size,
+             " wall_ms=%.3f user_ms=%.3f sys_ms=%.3f maxrss_kb=%ld ctxsw=%ld/%ld io=%ld/%ld",
+             usage->wall_us / 1000.0, usage->user_us / 1000.0, usage->sys_us / 1000.0,
+             usage->maxrss_kb, usage->nvcsw, usage->nivcsw,
+             usage->inblock, usage->oublock);
+}
+
+void log_command(Shell* self, pid_t pid, const char* cmd_line, int status,
+                 const ProcUsage* usage, int stage) {
+    if (!self || !self->logger || !cmd_line) return;
+
+    Logger* lg = self->logger;
+    uint64_t start = stats_now();
+
+    char usage_buf[160];
+    format_usage(usage_buf, sizeof(usage_buf), usage);
+
+    char cmd_buf[640];
+    escape_field(cmd_buf, sizeof(cmd_buf), cmd_line);
+
+    LogIndexEntry entry = {0};
+    entry.cmd_hash = hash_command(cmd_line);
+    entry.status = status;
+    entry.kind = stage ? LOG_KIND_STAGE : LOG_KIND_COMMAND;
+    entry.magic = LOG_INDEX_MAGIC;
+
+    // Format log entry
+    char log_entry[1024];
+    int len = snprintf(log_entry, sizeof(log_entry),
+                      "[%s] pid=%d cmd=\"%s\" status=%d%s\n",
+                      cached_timestamp(lg, &entry.time_ms), pid, cmd_buf, status, usage_buf);
+
+    len = finish_record(log_entry, sizeof(log_entry), len);
+    if (len > 0) {
+        append_record(lg, log_entry, len, &entry);
+    }
+    stats_since(STAT_LOG, start);
+}
+
+void log_pipeline(Shell* self, pid_t pgid, const char* cmd_line,
+                  const int* statuses, int count, int status,
+                  const ProcUsage* usage) {
+    if (!self || !self->logger || !cmd_line || !statuses) return;
+
+    Logger* lg = self->logger;
+    uint64_t start = stats_now();
+
+    // Per-stage statuses, comma separated
+    char stage_buf[256];
+    int stage_len = 0;
+    for (int i = 0; i < count && stage_len < (int)sizeof(stage_buf); i++) {
+        stage_len += snprintf(stage_buf + stage_len, sizeof(stage_buf) - stage_len,
+                              i > 0 ? ",%d" : "%d", statuses[i]);
+    }
+
+    char usage_buf[160];
+    format_usage(usage_buf, sizeof(usage_buf), usage);
+
+    char cmd_buf[512];
+    escape_field(cmd_buf, sizeof(cmd_buf), cmd_line);
+
+    LogIndexEntry entry = {0};
+    entry.cmd_hash = hash_command(cmd_line);
+    entry.status = status;
+    entry.kind = LOG_KIND_PIPELINE;
+    entry.magic = LOG_INDEX_MAGIC;
+
     // Format log entry
     char log_entry[1024];
     int len = snprintf(log_entry, sizeof(log_entry),
-                      "[%s] pid=%d cmd=\"%s\" status=%d\n",
-                      time_buf, pid, cmd_line, status);
-    
+                      "[%s] pgid=%d cmd=\"%s\" status=%d pipestatus=%s%s\n",
+                      cached_timestamp(lg, &entry.time_ms), pgid, cmd_buf, status,
+                      stage_buf, usage_buf);
+
+    len = finish_record(log_entry, sizeof(log_entry), len);
     if (len > 0) {
-        write(self->log_fd, log_entry, len);
+        append_record(lg, log_entry, len, &entry);
     }
-}
\ No newline at end of file
+    stats_since(STAT_LOG, start);
+}
@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "builtin.h"
+#include "logger.h"
+
+#define LOGQ_MAX_GENERATIONS 1000
+
+#define LOGQ_USAGE "logq: usage: logq [--since TIME] [--until TIME] [--failed | --status N] " \
+                   "[--grep TEXT] [--stages] [--last N | --count | --top N] [--file LOG]\n"
+
+// ==================== QUERY ====================
+typedef struct {
+    int64_t since_ms;
+    int64_t until_ms;
+    int failed;
+    int has_status;
+    int status;
+    const char* grep;
+    long last;
+    long top;
+    int count_only;
+    int stages;        // also the records of each pipeline stage
+} LogQuery;
+
+// One generation: its index mapped whole, its log mapped when a query
+// needs record text
+typedef struct {
+    char log_path[PATH_MAX + 32];
+    const LogIndexEntry* entries;
+    size_t count;
+    size_t idx_size;
+    const char* log;
+    size_t log_size;
+    int log_mapped;
+} LogFile;
+
+static void* map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* data = NULL;
+    if (fstat(fd, &st) == 0) {
+        *size = st.st_size;
+        if (st.st_size == 0) {
+            // Nothing to map, but the file is there
+            data = (void*)"";
+        } else if ((data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            data = NULL;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+static int open_generation(LogFile* f, const char* log_path, int generation) {
+    char idx_path[PATH_MAX + 32];
+    memset(f, 0, sizeof(*f));
+    log_file_name(f->log_path, sizeof(f->log_path), log_path, generation, 0);
+    log_file_name(idx_path, sizeof(idx_path), log_path, generation, 1);
+
+    f->entries = map_file(idx_path, &f->idx_size);
+    if (!f->entries) return -1;
+
+    // A torn last entry is ignored
+    f->count = f->idx_size / sizeof(LogIndexEntry);
+    return 0;
+}
+
+static void close_generation(LogFile* f) {
+    if (f->idx_size > 0) munmap((void*)f->entries, f->idx_size);
+    if (f->log_mapped && f->log_size > 0) munmap((void*)f->log, f->log_size);
+}
+
+// Text of a record, NULL if the log lacks it
+static const char* record_text(LogFile* f, const LogIndexEntry* e) {
+    if (!f->log_mapped) {
+        f->log = map_file(f->log_path, &f->log_size);
+        f->log_mapped = 1;
+        if (!f->log) f->log_size = 0;
+    }
+    if (!f->log || e->length == 0 || e->offset > f->log_size ||
+        e->length > f->log_size - e->offset) {
+        return NULL;
+    }
+    return f->log + e->offset;
+}
+
+// The escaped command between cmd=" and its closing quote
+static const char* record_command(const char* text, size_t length, size_t* cmd_len) {
+    const char* cmd = memmem(text, length, " cmd=\"", 6);
+    if (!cmd) return NULL;
+
+    cmd += 6;
+    const char* end = cmd;
+    const char* limit = text + length;
+    while (end < limit && *end != '"') {
+        end += *end == '\\' ? 2 : 1;
+    }
+    if (end >= limit) return NULL;
+
+    *cmd_len = end - cmd;
+    return cmd;
+}
+
+static int64_t written_ms(const LogIndexEntry* e) {
+    return e->time_ms + e->delay_ms;
+}
+
+// First entry that can be at or after since_ms. Entries are in write
+// order, which only lags between shells by up to LOG_INDEX_SLACK_MS.
+static size_t first_candidate(const LogFile* f, int64_t since_ms) {
+    if (since_ms == INT64_MIN) return 0;
+
+    int64_t key = since_ms - LOG_INDEX_SLACK_MS;
+    size_t lo = 0;
+    size_t hi = f->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (written_ms(&f->entries[mid]) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int matches(LogFile* f, const LogIndexEntry* e, const LogQuery* q) {
+    if (e->magic != LOG_INDEX_MAGIC) return 0;
+    if (e->time_ms < q->since_ms || e->time_ms > q->until_ms) return 0;
+    if (q->failed && e->status == 0) return 0;
+    if (q->has_status && e->status != q->status) return 0;
+
+    // A pipeline stands for its stages unless they are asked for
+    if (!q->stages && e->kind == LOG_KIND_STAGE) return 0;
+
+    if (q->grep) {
+        const char* text = record_text(f, e);
+        size_t cmd_len;
+        const char* cmd = text ? record_command(text, e->length, &cmd_len) : NULL;
+        if (!cmd || !memmem(cmd, cmd_len, q->grep, strlen(q->grep))) return 0;
+    }
+    return 1;
+}
+
+// Records written this long after until_ms cannot be older than it,
+// unless held back by MYSHELL_LOG_SYNC=exit
+static int past_until(const LogIndexEntry* e, const LogQuery* q) {
+    return q->until_ms != INT64_MAX && written_ms(e) > q->until_ms + LOG_INDEX_SLACK_MS;
+}
+
+static void print_record(LogFile* f, const LogIndexEntry* e) {
+    const char* text = record_text(f, e);
+    if (text) fwrite(text, 1, e->length, stdout);
+}
+
+// ==================== TOP COMMANDS ====================
+typedef struct {
+    uint64_t hash;
+    unsigned long count;
+    LogFile* file;
+    const LogIndexEntry* entry;   // latest record, for the text
+} TopSlot;
+
+typedef struct {
+    TopSlot* slots;
+    size_t capacity;
+    size_t used;
+} TopTable;
+
+static int top_add(TopTable* t, LogFile* f, const LogIndexEntry* e) {
+    if (t->used + 1 > t->capacity / 2) {
+        size_t capacity = t->capacity ? t->capacity * 2 : 1024;
+        TopSlot* slots = calloc(capacity, sizeof(TopSlot));
+        if (!slots) return -1;
+
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (!t->slots[i].count) continue;
+            size_t j = t->slots[i].hash & (capacity - 1);
+            while (slots[j].count) j = (j + 1) & (capacity - 1);
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->capacity = capacity;
+    }
+
+    size_t i = e->cmd_hash & (t->capacity - 1);
+    while (t->slots[i].count && t->slots[i].hash != e->cmd_hash) {
+        i = (i + 1) & (t->capacity - 1);
+    }
+    if (!t->slots[i].count) {
+        t->slots[i].hash = e->cmd_hash;
+        t->used++;
+    }
+    t->slots[i].count++;
+    t->slots[i].file = f;
+    t->slots[i].entry = e;
+    return 0;
+}
+
+static int compare_top(const void* a, const void* b) {
+    const TopSlot* sa = a;
+    const TopSlot* sb = b;
+    return (sa->count < sb->count) - (sa->count > sb->count);
+}
+
+static void print_top(TopTable* t, long n) {
+    // Pack the used slots to the front, then sort by count
+    size_t used = 0;
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->slots[i].count) t->slots[used++] = t->slots[i];
+    }
+    qsort(t->slots, used, sizeof(TopSlot), compare_top);
+
+    for (size_t i = 0; i < used && (long)i < n; i++) {
+        TopSlot* s = &t->slots[i];
+        const char* text = record_text(s->file, s->entry);
+        size_t cmd_len = 0;
+        const char* cmd = text ? record_command(text, s->entry->length, &cmd_len) : NULL;
+        printf("%8lu  %.*s\n", s->count, (int)cmd_len, cmd ? cmd : "");
+    }
+}
+
+// ==================== TIME ARGUMENTS ====================
+// HH:MM[:SS] today, YYYY-MM-DD[ HH:MM[:SS]], -N{s,m,h,d} ago or @epoch
+static int parse_time(const char* arg, int64_t* ms) {
+    time_t now = time(NULL);
+    char* end;
+
+    if (arg[0] == '-' || arg[0] == '@') {
+        long n = strtol(arg + 1, &end, 10);
+        if (end == arg + 1 || n < 0) return -1;
+        if (arg[0] == '@') {
+            if (*end) return -1;
+            *ms = (int64_t)n * 1000;
+            return 0;
+        }
+
+        long unit;
+        switch (*end) {
+            case 's': case '\0': unit = 1; break;
+            case 'm': unit = 60; break;
+            case 'h': unit = 3600; break;
+            case 'd': unit = 86400; break;
+            default: return -1;
+        }
+        if (*end && end[1]) return -1;
+        *ms = ((int64_t)now - (int64_t)n * unit) * 1000;
+        return 0;
+    }
+
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    tm_info.tm_hour = tm_info.tm_min = tm_info.tm_sec = 0;
+
+    const char* rest = arg;
+    if (strchr(arg, '-')) {
+        rest = strptime(arg, "%Y-%m-%d", &tm_info);
+        if (!rest) return -1;
+        if (*rest == ' ' || *rest == 'T') rest++;
+    }
+    if (*rest) {
+        const char* done = strptime(rest, "%H:%M:%S", &tm_info);
+        if (!done) {
+            tm_info.tm_sec = 0;
+            done = strptime(rest, "%H:%M", &tm_info);
+        }
+        if (!done || *done) return -1;
+    }
+
+    tm_info.tm_isdst = -1;
+    time_t t = mktime(&tm_info);
+    if (t == (time_t)-1) return -1;
+    *ms = (int64_t)t * 1000;
+    return 0;
+}
+
+static int parse_count(const char* arg, long* n) {
+    char* end;
+    *n = strtol(arg, &end, 10);
+    return *end || end == arg || *n <= 0 ? -1 : 0;
+}
+
+// ==================== BUILTIN ====================
+// Last N matches: walk back from the newest entry and stop once found
+static void print_last(LogFile* files, int nfiles, const LogQuery* q) {
+    typedef struct { LogFile* file; const LogIndexEntry* entry; } Hit;
+    Hit* hits = malloc(q->last * sizeof(Hit));
+    if (!hits) {
+        perror("malloc");
+        return;
+    }
+
+    long found = 0;
+    for (int g = nfiles - 1; g >= 0 && found < q->last; g--) {
+        LogFile* f = &files[g];
+        size_t first = first_candidate(f, q->since_ms);
+        for (size_t i = f->count; i > first && found < q->last; i--) {
+            const LogIndexEntry* e = &f->entries[i - 1];
+            if (matches(f, e, q)) {
+                hits[found].file = f;
+                hits[found].entry = e;
+                found++;
+            }
+        }
+    }
+
+    while (found > 0) {
+        found--;
+        print_record(hits[found].file, hits[found].entry);
+    }
+    free(hits);
+}
+
+int builtin_logq(Shell* self, Command* cmd) {
+    if (!self || !cmd) return 1;
+
+    LogQuery q = {INT64_MIN, INT64_MAX, 0, 0, 0, NULL, 0, 0, 0, 0};
+    const char* path = NULL;
+
+    for (int i = 1; i < cmd->argc; i++) {
+        const char* opt = cmd->argv[i];
+        const char* arg = i + 1 < cmd->argc ? cmd->argv[i + 1] : NULL;
+        int takes_arg = 1;
+
+        if (strcmp(opt, "--failed") == 0) {
+            q.failed = 1;
+            takes_arg = 0;
+        } else if (strcmp(opt, "--count") == 0) {
+            q.count_only = 1;
+            takes_arg = 0;
+        } else if (strcmp(opt, "--stages") == 0) {
+            q.stages = 1;
+            takes_arg = 0;
+        } else if (!arg) {
+            fprintf(stderr, "logq: %s: missing argument\n", opt);
+            fprintf(stderr, LOGQ_USAGE);
+            return 2;
+        } else if (strcmp(opt, "--since") == 0 || strcmp(opt, "--until") == 0) {
+            int64_t* ms = opt[2] == 's' ? &q.since_ms : &q.until_ms;
+            if (parse_time(arg, ms) < 0) {
+                fprintf(stderr, "logq: %s: invalid time\n", arg);
+                return 2;
+            }
+        } else if (strcmp(opt, "--status") == 0) {
+            char* end;
+            q.status = (int)strtol(arg, &end, 10);
+            if (*end || end == arg) {
+                fprintf(stderr, "logq: %s: invalid status\n", arg);
+                return 2;
+            }
+            q.has_status = 1;
+        } else if (strcmp(opt, "--last") == 0 || strcmp(opt, "--top") == 0) {
+            if (parse_count(arg, opt[2] == 'l' ? &q.last : &q.top) < 0) {
+                fprintf(stderr, "logq: %s: invalid count\n", arg);
+                return 2;
+            }
+        } else if (strcmp(opt, "--grep") == 0) {
+            q.grep = arg;
+        } else if (strcmp(opt, "--file") == 0) {
+            path = arg;
+        } else {
+            fprintf(stderr, "logq: %s: invalid option\n", opt);
+            fprintf(stderr, LOGQ_USAGE);
+            return 2;
+        }
+        i += takes_arg;
+    }
+
+    if (!!q.last + !!q.top + q.count_only > 1) {
+        fprintf(stderr, LOGQ_USAGE);
+        return 2;
+    }
+
+    // Our own records still in the ring must be visible
+    if (!path) {
+        logger_flush(self);
+        path = logger_path(self);
+        if (!path) path = "myshell.log";
+    }
+
+    // Rotated generations, oldest first, then the current log
+    int nfiles = 0;
+    while (nfiles < LOGQ_MAX_GENERATIONS) {
+        char idx_path[PATH_MAX + 32];
+        log_file_name(idx_path, sizeof(idx_path), path, nfiles + 1, 1);
+        if (access(idx_path, R_OK) < 0) break;
+        nfiles++;
+    }
+
+    LogFile* files = calloc(nfiles + 1, sizeof(LogFile));
+    if (!files) {
+        perror("calloc");
+        return 1;
+    }
+
+    int opened = 0;
+    for (int gen = nfiles; gen >= 0; gen--) {
+        // A generation rotated away meanwhile is just skipped
+        if (open_generation(&files[opened], path, gen) == 0) opened++;
+    }
+    if (opened == 0) {
+        fprintf(stderr, "logq: %s%s: no index\n", path, LOG_INDEX_SUFFIX);
+        free(files);
+        return 1;
+    }
+
+    int status = 0;
+    if (q.last > 0) {
+        print_last(files, opened, &q);
+    } else {
+        TopTable top = {NULL, 0, 0};
+        unsigned long count = 0;
+
+        for (int g = 0; g < opened && status == 0; g++) {
+            LogFile* f = &files[g];
+            for (size_t i = first_candidate(f, q.since_ms); i < f->count; i++) {
+                const LogIndexEntry* e = &f->entries[i];
+                if (past_until(e, &q)) break;
+                if (!matches(f, e, &q)) continue;
+
+                count++;
+                if (q.top > 0) {
+                    if (top_add(&top, f, e) < 0) {
+                        perror("calloc");
+                        status = 1;
+                        break;
+                    }
+                } else if (!q.count_only) {
+                    print_record(f, e);
+                }
+            }
+        }
+
+        if (q.count_only) printf("%lu\n", count);
+        if (q.top > 0 && status == 0) print_top(&top, q.top);
+        free(top.slots);
+    }
+
+    for (int g = 0; g < opened; g++) {
+        close_generation(&files[g]);
+    }
+    free(files);
+    fflush(stdout);
+    return status;
+}
@@ -1,13 +1,40 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "shell.h"
 #include "execute.h"
+#include "input.h"
+#include "server.h"
+#include "vars.h"
 
-int main(int argc, char** argv) {
-    (void)argc; // Unused
-    (void)argv; // Unused
-    
+static void usage(void) {
+    fprintf(stderr, "usage: myshell [-c command [name args...] | script [args...]]\n");
+    fprintf(stderr, "       myshell --server socket [--workers N]\n");
+}
+
+// myshell --server socket [--workers N]
+static int run_server(int argc, char** argv) {
+    int workers = SERVER_DEFAULT_WORKERS;
+    if (argc < 3 || (argc != 3 && argc != 5) ||
+        (argc == 5 && strcmp(argv[3], "--workers") != 0)) {
+        usage();
+        return 2;
+    }
+    if (argc == 5) {
+        workers = atoi(argv[4]);
+        if (workers < 1) {
+            fprintf(stderr, "myshell: %s: invalid worker count\n", argv[4]);
+            return 2;
+        }
+    }
+    return server_run(argv[2], workers);
+}
 
+int main(int argc, char** argv) {
+    // Server mode forks its shells itself
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        return run_server(argc, argv);
+    }
     
     // Create shell instance
     Shell* shell = create_shell();
@@ -16,15 +43,50 @@ int main(int argc, char** argv) {
         return 1;
     }
     
+    // Pick the input source: -c string, script file, or stdin
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                fprintf(stderr, "myshell: -c: option requires an argument\n");
+                usage();
+                free(shell);
+                return 2;
+            }
+            shell->input = input_open_string(argv[2]);
+        } else if (argv[1][0] == '-' && argv[1][1] != '\0') {
+            fprintf(stderr, "myshell: %s: invalid option\n", argv[1]);
+            usage();
+            free(shell);
+            return 2;
+        } else {
+            shell->input = input_open_file(argv[1]);
+            if (!shell->input) {
+                perror(argv[1]);
+                free(shell);
+                return 127;
+            }
+        }
+    }
+    
     // Initialize shell
     shell_init(shell);
     
+    // The script, or the name after -c string as in sh, is $0 and the
+    // arguments after it are $1...
+    int first_arg = argc > 1 && strcmp(argv[1], "-c") == 0 ? 4 : 2;
+    if (argc >= first_arg) var_set_name(argv[first_arg - 1]);
+    if (argc > first_arg) var_set_positional(argv + first_arg, argc - first_arg);
+    
     // Run shell main loop
     shell_run(shell);
     
-    // Cleanup
+    // Cleanup: exit status is the one given to exit, or the last command's
+    int interactive = shell->interactive;
+    int status = shell->running ? shell->last_status : shell->exit_status;
     destroy_shell(shell);
     
-    printf("Shell terminated. Goodbye!\n");
-    return 0;
+    if (interactive) {
+        printf("Shell terminated. Goodbye!\n");
+    }
+    return status;
 }
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "builtin.h"
+#include "execute.h"
+#include "jobs.h"
+#include "input.h"
+#include "script.h"
+
+#define PARALLEL_READ_SIZE (64 * 1024)
+#define PARALLEL_MAX_STATUS 101
+
+// ==================== SCHEDULER STATE ====================
+// parallel keeps at most max_jobs jobs running. Each job writes its
+// stdout into a pipe the scheduler drains, so output from different jobs
+// is never interleaved mid-line. Jobs stay out of the job table; exits
+// are noticed through their pidfds in the same poll() as the pipes.
+typedef struct {
+    Job* job;             // NULL when the slot is free
+    int out_fd;           // read end of the job's stdout, -1 after EOF
+    char* buf;            // output not yet written
+    size_t len;
+    size_t cap;
+} ParallelSlot;
+
+typedef struct {
+    int max_jobs;
+    int line_buffer;      // write whole lines as they arrive
+    char** template;      // command words, may contain {}
+    int template_len;
+    int has_placeholder;
+    char** args;          // ::: arguments, or NULL to read stdin
+    int nargs;
+    int next_arg;
+    InputReader* input;
+    int owns_input;       // input is not the shell's own reader
+    char* line;           // command line being built
+    size_t line_len;
+    size_t line_cap;
+    int devnull;
+    ParallelSlot* slots;
+    struct pollfd* fds;
+    int* fd_slot;
+    int fds_cap;
+    int running;
+    int started;
+    int failed;
+    int interrupted;
+} Parallel;
+
+// ==================== OUTPUT ====================
+static void write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("parallel: write");
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Read what the job wrote; in line-buffered mode pass on complete lines
+static void drain_slot(Parallel* par, ParallelSlot* slot) {
+    if (slot->cap - slot->len < PARALLEL_READ_SIZE) {
+        size_t cap = slot->cap ? slot->cap * 2 : PARALLEL_READ_SIZE * 2;
+        while (cap - slot->len < PARALLEL_READ_SIZE) cap *= 2;
+        char* bigger = realloc(slot->buf, cap);
+        if (!bigger) {
+            // Drop the rest of this job's output rather than stall it
+            perror("parallel: realloc");
+            close(slot->out_fd);
+            slot->out_fd = -1;
+            return;
+        }
+        slot->buf = bigger;
+        slot->cap = cap;
+    }
+
+    ssize_t n = read(slot->out_fd, slot->buf + slot->len, slot->cap - slot->len);
+    if (n < 0 && errno == EINTR) return;
+    if (n <= 0) {
+        close(slot->out_fd);
+        slot->out_fd = -1;
+        return;
+    }
+    slot->len += n;
+
+    if (par->line_buffer) {
+        char* last = memrchr(slot->buf, '\n', slot->len);
+        if (last) {
+            size_t done = last - slot->buf + 1;
+            write_all(STDOUT_FILENO, slot->buf, done);
+            memmove(slot->buf, slot->buf + done, slot->len - done);
+            slot->len -= done;
+        }
+    }
+}
+
+// ==================== COMMAND LINES ====================
+static int line_append(Parallel* par, const char* text, size_t len) {
+    if (par->line_len + len + 1 > par->line_cap) {
+        size_t cap = par->line_cap ? par->line_cap : 256;
+        while (par->line_len + len + 1 > cap) cap *= 2;
+        char* bigger = realloc(par->line, cap);
+        if (!bigger) {
+            perror("parallel: realloc");
+            return -1;
+        }
+        par->line = bigger;
+        par->line_cap = cap;
+    }
+    memcpy(par->line + par->line_len, text, len);
+    par->line_len += len;
+    par->line[par->line_len] = '\0';
+    return 0;
+}
+
+// Single-quote text so the lexer hands it back as one literal word
+static int line_append_quoted(Parallel* par, const char* text, size_t len) {
+    if (line_append(par, "'", 1) < 0) return -1;
+
+    const char* end = text + len;
+    for (const char* q; (q = memchr(text, '\'', end - text)) != NULL; text = q + 1) {
+        if (line_append(par, text, q - text) < 0 || line_append(par, "'\\''", 4) < 0) {
+            return -1;
+        }
+    }
+    if (line_append(par, text, end - text) < 0) return -1;
+    return line_append(par, "'", 1);
+}
+
+// Template with {} replaced by arg (or arg appended). A template given as
+// one word is a command line of its own ("gzip < {} > {}.gz", or a list
+// like "sleep 1; echo {}"); several words are kept as the arguments they
+// already are. With no template the argument is itself the command line.
+static int build_line(Parallel* par, const char* arg) {
+    par->line_len = 0;
+
+    if (par->template_len == 0) {
+        return line_append(par, arg, strlen(arg));
+    }
+
+    int literal = par->template_len > 1;
+    for (int i = 0; i < par->template_len; i++) {
+        const char* word = par->template[i];
+        if (i > 0 && line_append(par, " ", 1) < 0) return -1;
+
+        // Quoted pieces are adjacent, so the lexer joins them into one word
+        for (const char* ph; (ph = strstr(word, "{}")) != NULL; word = ph + 2) {
+            if (literal ? line_append_quoted(par, word, ph - word) < 0
+                        : line_append(par, word, ph - word) < 0) {
+                return -1;
+            }
+            if (line_append_quoted(par, arg, strlen(arg)) < 0) return -1;
+        }
+        if (literal ? line_append_quoted(par, word, strlen(word)) < 0
+                    : line_append(par, word, strlen(word)) < 0) {
+            return -1;
+        }
+    }
+
+    if (!par->has_placeholder) {
+        if (line_append(par, " ", 1) < 0 || line_append_quoted(par, arg, strlen(arg)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const char* next_argument(Parallel* par) {
+    if (par->args) {
+        return par->next_arg < par->nargs ? par->args[par->next_arg++] : NULL;
+    }
+
+    char* arg;
+    while ((arg = input_next_line(par->input, NULL)) != NULL) {
+        if (arg[0] != '\0') return arg;
+    }
+    return NULL;
+}
+
+// ==================== JOB SCHEDULING ====================
+static void start_job(Shell* self, Parallel* par, ParallelSlot* slot, const char* arg) {
+    par->started++;
+    if (build_line(par, arg) < 0) {
+        par->failed++;
+        return;
+    }
+
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        perror("parallel: pipe");
+        par->failed++;
+        return;
+    }
+
+    // A line is read like a command of the shell's own. Jobs share the
+    // shell's process group so the terminal's ^C reaches them.
+    Job* job = script_start(self, par->line, par->devnull, out[1], self->shell_pgid);
+    close(out[1]);
+
+    if (!job) {
+        close(out[0]);
+        par->failed++;
+        return;
+    }
+
+    job_open_pidfds(job);
+    slot->job = job;
+    slot->out_fd = out[0];
+    slot->len = 0;
+    par->running++;
+}
+
+static void finish_job(Shell* self, Parallel* par, ParallelSlot* slot) {
+    if (slot->len > 0) {
+        write_all(STDOUT_FILENO, slot->buf, slot->len);
+        slot->len = 0;
+    }
+
+    int status = job_finish(self, slot->job);
+    if (status != 0) {
+        par->failed++;
+    }
+    if (status == 128 + SIGINT) {
+        par->interrupted = 1;
+    }
+
+    slot->job = NULL;
+    par->running--;
+}
+
+// Poll job output and pidfds; returns -1 if nothing could be polled
+static int wait_for_events(Parallel* par) {
+    int need = 0;
+    for (int i = 0; i < par->max_jobs; i++) {
+        if (par->slots[i].job) need += 1 + par->slots[i].job->nprocs;
+    }
+    if (need > par->fds_cap) {
+        struct pollfd* fds = realloc(par->fds, need * sizeof(struct pollfd));
+        if (!fds) return -1;
+        par->fds = fds;
+        int* owners = realloc(par->fd_slot, need * sizeof(int));
+        if (!owners) return -1;
+        par->fd_slot = owners;
+        par->fds_cap = need;
+    }
+
+    int n = 0;
+    int timeout = -1;
+    for (int i = 0; i < par->max_jobs; i++) {
+        ParallelSlot* slot = &par->slots[i];
+        if (!slot->job) continue;
+
+        if (slot->out_fd >= 0) {
+            par->fds[n] = (struct pollfd){slot->out_fd, POLLIN, 0};
+            par->fd_slot[n++] = i;
+        }
+        for (int p = 0; p < slot->job->nprocs; p++) {
+            JobProcess* proc = &slot->job->procs[p];
+            if (proc->exited) continue;
+            if (proc->pidfd < 0) {
+                // No pidfd: fall back to checking on a timer
+                timeout = 50;
+                continue;
+            }
+            par->fds[n] = (struct pollfd){proc->pidfd, POLLIN, 0};
+            par->fd_slot[n++] = i;
+        }
+    }
+
+    if (poll(par->fds, n, timeout) < 0 && errno != EINTR) {
+        perror("parallel: poll");
+        return -1;
+    }
+
+    for (int k = 0; k < n; k++) {
+        if (!par->fds[k].revents) continue;
+        ParallelSlot* slot = &par->slots[par->fd_slot[k]];
+        if (par->fds[k].fd == slot->out_fd) {
+            drain_slot(par, slot);
+        }
+    }
+    return 0;
+}
+
+static void parallel_run(Shell* self, Parallel* par) {
+    int more = 1;
+
+    for (;;) {
+        // Fill free slots; a job stopped by ^C ends scheduling
+        for (int i = 0; i < par->max_jobs && more && !par->interrupted; i++) {
+            if (par->slots[i].job) continue;
+            const char* arg = next_argument(par);
+            if (!arg) {
+                more = 0;
+                break;
+            }
+            start_job(self, par, &par->slots[i], arg);
+        }
+
+        if (par->running == 0) {
+            if (!more || par->interrupted) break;
+            continue;
+        }
+
+        if (wait_for_events(par) < 0) break;
+
+        // A job is done once its output hit EOF and every process is reaped
+        for (int i = 0; i < par->max_jobs; i++) {
+            ParallelSlot* slot = &par->slots[i];
+            if (slot->job && job_reap_nowait(slot->job) == 0 && slot->out_fd < 0) {
+                finish_job(self, par, slot);
+            }
+        }
+    }
+
+    // Only reached early on a poll failure: collect whatever is left
+    for (int i = 0; i < par->max_jobs; i++) {
+        ParallelSlot* slot = &par->slots[i];
+        if (!slot->job) continue;
+        while (slot->out_fd >= 0) {
+            drain_slot(par, slot);
+        }
+        while (job_reap_nowait(slot->job) > 0) {
+            usleep(10000);
+        }
+        finish_job(self, par, slot);
+    }
+}
+
+// ==================== PARALLEL BUILTIN ====================
+static void parallel_usage(void) {
+    fprintf(stderr, "parallel: usage: parallel [-j N] [--line-buffer] [command ...] [::: arg ...]\n");
+}
+
+int builtin_parallel(Shell* self, Command* cmd) {
+    if (!self || !cmd) return 1;
+
+    Parallel par;
+    memset(&par, 0, sizeof(par));
+    par.max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (par.max_jobs < 1) par.max_jobs = 1;
+
+    // Options, then the template up to ":::", then the arguments
+    int i = 1;
+    for (; i < cmd->argc && cmd->argv[i][0] == '-'; i++) {
+        const char* opt = cmd->argv[i];
+        const char* value = NULL;
+
+        if (strcmp(opt, "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(opt, "-j") == 0 || strcmp(opt, "--jobs") == 0) {
+            if (i + 1 >= cmd->argc) {
+                parallel_usage();
+                return 2;
+            }
+            value = cmd->argv[++i];
+        } else if (strncmp(opt, "-j", 2) == 0) {
+            value = opt + 2;
+        } else if (strcmp(opt, "--line-buffer") == 0) {
+            par.line_buffer = 1;
+        } else if (strcmp(opt, "--group") == 0) {
+            par.line_buffer = 0;
+        } else {
+            fprintf(stderr, "parallel: %s: invalid option\n", opt);
+            parallel_usage();
+            return 2;
+        }
+
+        if (value) {
+            char* end;
+            long n = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n < 1 || n > 4096) {
+                fprintf(stderr, "parallel: %s: invalid job count\n", value);
+                return 2;
+            }
+            par.max_jobs = n;
+        }
+    }
+
+    par.template = cmd->argv + i;
+    for (; i < cmd->argc && strcmp(cmd->argv[i], ":::") != 0; i++) {
+        par.template_len++;
+        if (strstr(cmd->argv[i], "{}")) par.has_placeholder = 1;
+    }
+    if (i < cmd->argc) {
+        par.args = cmd->argv + i + 1;
+        par.nargs = cmd->argc - i - 1;
+    }
+
+    // Arguments from the stdin the shell reads its own commands from are
+    // its next lines: a second buffered reader would take lines meant
+    // for the shell, and miss those already in its buffer. A terminal or
+    // a redirected stdin gets a reader of its own.
+    par.slots = calloc(par.max_jobs, sizeof(ParallelSlot));
+    par.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (!par.args && !self->interactive && input_reads(self->input, STDIN_FILENO)) {
+        par.input = self->input;
+    } else if (!par.args) {
+        par.input = input_open_fd(STDIN_FILENO);
+        par.owns_input = 1;
+    }
+    if (!par.slots || par.devnull < 0 || (!par.args && !par.input)) {
+        perror("parallel");
+        free(par.slots);
+        if (par.devnull >= 0) close(par.devnull);
+        if (par.owns_input) input_close(par.input);
+        return 1;
+    }
+
+    // Jobs write straight to fd 1; put earlier builtin output first
+    fflush(stdout);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    parallel_run(self, &par);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "parallel: %d jobs, %d failed, %.3f s, %.1f jobs/s (-j %d)\n",
+            par.started, par.failed, seconds,
+            seconds > 0 ? par.started / seconds : 0.0, par.max_jobs);
+
+    for (int k = 0; k < par.max_jobs; k++) {
+        free(par.slots[k].buf);
+    }
+    free(par.slots);
+    free(par.fds);
+    free(par.fd_slot);
+    free(par.line);
+    close(par.devnull);
+    if (par.owns_input) input_close(par.input);
+
+    // Like GNU parallel: the number of failed jobs, capped
+    if (par.interrupted) return 128 + SIGINT;
+    return par.failed > PARALLEL_MAX_STATUS ? PARALLEL_MAX_STATUS : par.failed;
+}
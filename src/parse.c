@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "parse.h"
+#include "wildcard.h"
+#include "vars.h"
+#include "policy.h"
 
 // ==================== UTILITY FUNCTIONS ====================
 char* trim_whitespace(char* str) {
@@ -38,240 +41,1141 @@ int is_empty_string(const char* str) {
     return 1;
 }
 
-char** tokenize(const char* input, int* token_count) {
-    if (!input || is_empty_string(input)) {
-        *token_count = 0;
-        return NULL;
+// ==================== LINE MEMORY ====================
+// Everything a parsed line points to (argv, token text, filenames) lives
+// in one arena that shell_run() rewinds after each line, and Command
+// structs are recycled through a free list, so steady-state parsing makes
+// no heap allocations.
+#define PARSE_ARENA_CHUNK (16 * 1024)
+
+static Arena parse_arena = {NULL, NULL, PARSE_ARENA_CHUNK, 0};
+static Command* command_pool = NULL;
+static unsigned long command_allocs = 0;
+
+// Token vector reused across lines; it only grows
+static Token* lex_tokens = NULL;
+static int lex_capacity = 0;
+static unsigned long lex_allocs = 0;
+
+// Offsets of quoted glob metacharacters in the word being lexed, and of
+// the field breaks made by unquoted expansions
+static size_t* lex_escapes = NULL;
+static int escape_capacity = 0;
+static size_t* lex_breaks = NULL;
+static int break_capacity = 0;
+
+// Set when the line read variables, globbed or has a here-document: its
+// parse cannot be reused for the same text later
+static int line_volatile = 0;
+
+// Words that grow through an expansion are built here
+static char* word_buf = NULL;
+static size_t word_cap = 0;
+
+// Here-document bodies of the current line, back to back. The buffer is
+// reused, but one that grew past HEREDOC_KEEP is released at reset.
+#define HEREDOC_KEEP (64 * 1024)
+
+static char* heredoc_buf = NULL;
+static size_t heredoc_len = 0;
+static size_t heredoc_cap = 0;
+
+void parse_reset(void) {
+    arena_reset(&parse_arena);
+    wildcard_next_line();
+    heredoc_len = 0;
+    if (heredoc_cap > HEREDOC_KEEP) {
+        free(heredoc_buf);
+        heredoc_buf = NULL;
+        heredoc_cap = 0;
+    }
+}
+
+// Commands parsed after a mark can be dropped early, e.g. by builtins
+// that parse one command line per job, or by loops running the same
+// commands over and over
+ParseMark parse_mark(void) {
+    ParseMark mark = {arena_mark(&parse_arena), heredoc_len};
+    return mark;
+}
+
+void parse_rewind(ParseMark mark) {
+    arena_rewind(&parse_arena, mark.arena);
+    heredoc_len = mark.heredoc_len;
+}
+
+void parse_cleanup(void) {
+    arena_destroy(&parse_arena);
+    wildcard_cleanup();
+    while (command_pool) {
+        Command* next = command_pool->pipe_next;
+        free(command_pool);
+        command_pool = next;
+    }
+    free(lex_tokens);
+    lex_tokens = NULL;
+    lex_capacity = 0;
+    free(lex_escapes);
+    lex_escapes = NULL;
+    escape_capacity = 0;
+    free(lex_breaks);
+    lex_breaks = NULL;
+    break_capacity = 0;
+    free(word_buf);
+    word_buf = NULL;
+    word_cap = 0;
+    free(heredoc_buf);
+    heredoc_buf = NULL;
+    heredoc_len = 0;
+    heredoc_cap = 0;
+}
+
+int parse_line_cacheable(void) {
+    return !line_volatile;
+}
+
+unsigned long parse_heap_allocs(void) {
+    return parse_arena.chunk_allocs + command_allocs + lex_allocs;
+}
+
+// ==================== LEXER ====================
+// One left-to-right pass over a writable line. Words are unquoted in place
+// (the result is never longer than the source) and NUL-terminated, so most
+// tokens are spans into the line itself; only a word that an expansion
+// makes longer than its source is built in word_buf and copied out. Runs
+// of ordinary characters are skipped with strcspn(), which glibc vectorises.
+#define WORD_BREAK " \t\n|&;<>()'\"\\*?[$"
+
+// Characters escaped in the glob pattern of a word when they were quoted
+#define GLOB_SPECIAL "*?[]\\"
+
+static int push_token(TokenType type, char* text, size_t len, int quoted, int* count) {
+    if (*count == lex_capacity) {
+        int capacity = lex_capacity ? lex_capacity * 2 : 64;
+        Token* bigger = realloc(lex_tokens, capacity * sizeof(Token));
+        if (!bigger) {
+            perror("realloc");
+            return -1;
+        }
+        lex_tokens = bigger;
+        lex_capacity = capacity;
+        lex_allocs++;
     }
     
-    char* input_copy = strdup(input);
-    if (!input_copy) return NULL;
-    
-    // Count tokens
-    int count = 0;
-    int in_token = 0;
+    Token* tok = &lex_tokens[(*count)++];
+    tok->type = type;
+    tok->text = text;
+    tok->len = len;
+    tok->quoted = quoted;
+    tok->pattern = NULL;
+    tok->assignment = 0;
+    return 0;
+}
+
+// Append offset to one of the per-word offset lists
+static int push_offset(size_t** list, int* capacity, int* count, size_t offset) {
+    if (*count == *capacity) {
+        int bigger_cap = *capacity ? *capacity * 2 : 16;
+        size_t* bigger = realloc(*list, bigger_cap * sizeof(size_t));
+        if (!bigger) {
+            perror("realloc");
+            return -1;
+        }
+        *list = bigger;
+        *capacity = bigger_cap;
+        lex_allocs++;
+    }
+    (*list)[(*count)++] = offset;
+    return 0;
+}
+
+// The field's text with a backslash before each quoted metacharacter;
+// offsets are relative to base
+static char* escaped_pattern(const char* text, size_t len, const size_t* offsets,
+                             int escapes, size_t base) {
+    char* pattern = arena_alloc(&parse_arena, len + escapes + 1);
+    if (!pattern) return NULL;
     
-    for (int i = 0; input_copy[i]; i++) {
-        if (input_copy[i] != ' ' && input_copy[i] != '\t' && input_copy[i] != '\n') {
-            if (!in_token) {
-                count++;
-                in_token = 1;
+    char* w = pattern;
+    size_t from = 0;
+    for (int i = 0; i < escapes; i++) {
+        size_t at = offsets[i] - base;
+        memcpy(w, text + from, at - from);
+        w += at - from;
+        *w++ = '\\';
+        from = at;
+    }
+    memcpy(w, text + from, len - from);
+    w[len - from] = '\0';
+    return pattern;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+int lex_operator(const char* p, TokenType* type) {
+    switch (*p) {
+        case '|':
+            if (p[1] == '|') {
+                *type = TOK_OR_IF;
+                return 2;
+            }
+            if (p[1] == '>') {
+                *type = TOK_FANOUT;
+                return 2;
+            }
+            *type = TOK_PIPE;
+            return 1;
+        case '(': *type = TOK_LPAREN; return 1;
+        case ')': *type = TOK_RPAREN; return 1;
+        case ';': *type = TOK_SEMI; return 1;
+        case '&':
+            if (p[1] == '&') {
+                *type = TOK_AND_IF;
+                return 2;
+            }
+            if (p[1] == '>') {
+                if (p[2] == '>') {
+                    *type = TOK_ANDDGREAT;
+                    return 3;
+                }
+                *type = TOK_ANDGREAT;
+                return 2;
+            }
+            *type = TOK_AMP;
+            return 1;
+        case '<':
+            if (p[1] == '<') {
+                if (p[2] == '<') {
+                    *type = TOK_TLESS;
+                    return 3;
+                }
+                if (p[2] == '-') {
+                    *type = TOK_DLESSDASH;
+                    return 3;
+                }
+                *type = TOK_DLESS;
+                return 2;
+            }
+            if (p[1] == '>') {
+                *type = TOK_LESSGREAT;
+                return 2;
             }
+            if (p[1] == '&') {
+                *type = TOK_LESSAND;
+                return 2;
+            }
+            *type = TOK_LESS;
+            return 1;
+        case '>':
+            if (p[1] == '>') {
+                *type = TOK_DGREAT;
+                return 2;
+            }
+            if (p[1] == '&') {
+                *type = TOK_GREATAND;
+                return 2;
+            }
+            if (p[1] == '|') {
+                *type = TOK_GREAT;   // no noclobber, so >| is plain >
+                return 2;
+            }
+            *type = TOK_GREAT;
+            return 1;
+    }
+    return 0;
+}
+
+// End of the quoted or escaped section at p, NULL if it is not closed.
+// In double quotes a backslash takes the next character along whether
+// or not it escapes it, so \" never closes them.
+static const char* quote_end(const char* p) {
+    if (*p == '\\') return p[1] ? p + 2 : NULL;
+    if (*p == '\'') {
+        const char* close = strchr(p + 1, '\'');
+        return close ? close + 1 : NULL;
+    }
+    
+    for (p++;;) {
+        p += strcspn(p, "\"\\");
+        if (*p == '"') return p + 1;
+        if (*p == '\0' || p[1] == '\0') return NULL;
+        p += 2;
+    }
+}
+
+const char* lex_word_end(const char* p) {
+    for (;;) {
+        p += strcspn(p, WORD_BREAK);
+        if (*p == '*' || *p == '?' || *p == '[' || *p == '$') {
+            p++;
+        } else if (*p == '\'' || *p == '"' || *p == '\\') {
+            if (!(p = quote_end(p))) return NULL;
         } else {
-            in_token = 0;
+            return p;
         }
     }
+}
+
+static int all_digits(const char* s) {
+    if (*s == '\0') return 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return 0;
+    }
+    return 1;
+}
+
+// The word being lexed: its text runs from start to w, in the line
+// behind the read position or, once moved, in word_buf
+typedef struct {
+    char* start;
+    char* w;
+    const char* line_end;
+    int moved;
+    int quoted;        // had quotes or escapes
+    int expanded;      // had a $ expansion
+    int glob;          // had an unquoted * ? or [
+    int escapes;       // entries in lex_escapes
+    int breaks;        // entries in lex_breaks
+    int failed;        // error already reported
+    int fields;        // a quoted "$@" gives a field per parameter
+    int no_params;     // had a "$@" with no parameters
+} Word;
+
+// Make room for more bytes at w plus whatever the rest of the line from r
+// can still add, moving the word out of the line if it is not yet
+static int word_reserve(Word* word, const char* r, size_t more) {
+    size_t len = word->w - word->start;
+    size_t need = len + more + (word->line_end - r) + 1;
+    
+    if (need > word_cap) {
+        size_t cap = word_cap ? word_cap : 256;
+        while (cap < need) cap *= 2;
+        char* bigger = realloc(word_buf, cap);
+        if (!bigger) {
+            perror("realloc");
+            word->failed = 1;
+            return -1;
+        }
+        word_buf = bigger;
+        word_cap = cap;
+        lex_allocs++;
+    }
+    if (!word->moved) {
+        memcpy(word_buf, word->start, len);
+        word->moved = 1;
+    }
+    word->start = word_buf;
+    word->w = word_buf + len;
+    return 0;
+}
+
+// Parameters named by one punctuation character
+#define DOLLAR_SPECIAL "?$#@*"
+
+// "$@": the positional parameters with a field break between each two
+static char* expand_parameters(char* r, char* next, Word* word) {
+    char** args;
+    int count;
+    var_get_positional(&args, &count);
     
-    // Allocate array
-    char** tokens = malloc((count + 1) * sizeof(char*));
-    if (!tokens) {
-        free(input_copy);
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += strlen(args[i]);
+    word->expanded = 1;
+    word->no_params |= count == 0;
+    if ((word->moved || total > (size_t)(next - r)) && word_reserve(word, next, total) < 0) {
         return NULL;
     }
     
-    // Tokenize
-    int i = 0;
-    char* token = strtok(input_copy, " \t\n");
-    while (token) {
-        tokens[i] = strdup(token);
-        if (!tokens[i]) {
-            // Cleanup on error
-            for (int j = 0; j < i; j++) free(tokens[j]);
-            free(tokens);
-            free(input_copy);
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && push_offset(&lex_breaks, &break_capacity, &word->breaks,
+                                 word->w - word->start) < 0) {
+            word->failed = 1;
             return NULL;
         }
-        i++;
-        token = strtok(NULL, " \t\n");
+        size_t len = strlen(args[i]);
+        memcpy(word->w, args[i], len);
+        word->w += len;
     }
-    tokens[i] = NULL;
+    return next;
+}
+
+// Length of the $NAME, ${NAME}, $N, ${N} or special parameter reference
+// at r, with the name it looks up in *name and *len; 0 for a $ that
+// starts none of these, -1 (reported) for a bad ${...}
+static int dollar_ref(const char* r, const char** name, size_t* len) {
+    const char* p = r + 1;
     
-    *token_count = count;
-    free(input_copy);
-    return tokens;
+    if (*p == '{') {
+        p++;
+        if (*p && strchr(DOLLAR_SPECIAL, *p)) {
+            *len = 1;
+        } else if (*p >= '0' && *p <= '9') {
+            *len = strspn(p, "0123456789");
+        } else {
+            *len = var_name_length(p);
+        }
+        if (*len == 0 || p[*len] != '}') {
+            fprintf(stderr, "myshell: syntax error: bad substitution\n");
+            return -1;
+        }
+        *name = p;
+        return (int)(p + *len + 1 - r);
+    }
+    
+    // $10 is $1 followed by 0
+    *name = p;
+    if ((*p && strchr(DOLLAR_SPECIAL, *p)) || (*p >= '0' && *p <= '9')) {
+        *len = 1;
+    } else {
+        *len = var_name_length(p);
+    }
+    return *len ? (int)(*len + 1) : 0;
 }
 
-void free_tokens(char** tokens) {
-    if (!tokens) return;
+// Expand the parameter reference at r and return the position after it;
+// a $ that starts none is literal. A split expansion is an unquoted one:
+// its blanks separate fields and * ? [ in it are globbed.
+static char* expand_dollar(char* r, Word* word, int split) {
+    const char* name;
+    size_t len;
+    int ref = dollar_ref(r, &name, &len);
+    if (ref < 0) {
+        word->failed = 1;
+        return NULL;
+    }
+    if (ref == 0) {
+        *word->w++ = '$';
+        return r + 1;
+    }
+    char* next = r + ref;
+    
+    line_volatile = 1;
+    if (!split && word->fields && len == 1 && *name == '@') {
+        return expand_parameters(r, next, word);
+    }
+    const char* value = var_lookup(name, len);
+    if (!value) value = "";
+    size_t value_len = strlen(value);
+    word->expanded = 1;
+    
+    // A value no longer than the reference still fits behind r
+    if ((word->moved || value_len > (size_t)(next - r)) &&
+        word_reserve(word, next, value_len) < 0) {
+        return NULL;
+    }
     
-    for (int i = 0; tokens[i]; i++) {
-        free(tokens[i]);
+    if (!split) {
+        memcpy(word->w, value, value_len);
+        word->w += value_len;
+        return next;
+    }
+    for (const char* v = value; *v; v++) {
+        if (is_blank(*v)) {
+            if (push_offset(&lex_breaks, &break_capacity, &word->breaks,
+                            word->w - word->start) < 0) {
+                word->failed = 1;
+                return NULL;
+            }
+            continue;
+        }
+        if (*v == '*' || *v == '?' || *v == '[') word->glob = 1;
+        *word->w++ = *v;
+    }
+    return next;
+}
+
+// Copy one quoted or escaped section from r to the word; returns the new
+// read position or NULL on an unterminated quote or a bad expansion
+static char* unquote(char* r, Word* word) {
+    if (*r == '\'') {
+        char* end = (char*)quote_end(r);
+        if (!end) return NULL;
+        size_t n = end - 1 - (r + 1);
+        memmove(word->w, r + 1, n);
+        word->w += n;
+        return end;
+    }
+    
+    if (*r == '\\') {
+        if (r[1] == '\0') return r + 1;
+        if (r[1] != '\n') *word->w++ = r[1];    // backslash-newline joins lines
+        return r + 2;
+    }
+    
+    // Double quotes: backslash only escapes ", \, $, ` and newline
+    r++;
+    for (;;) {
+        size_t n = strcspn(r, "\"\\$");
+        memmove(word->w, r, n);
+        word->w += n;
+        r += n;
+        
+        if (*r == '\0') return NULL;
+        if (*r == '"') break;
+        
+        if (*r == '$') {
+            r = expand_dollar(r, word, 0);
+            if (!r) return NULL;
+        } else if (r[1] == '\n') {
+            r += 2;
+        } else if (r[1] != '\0' && strchr("\"\\$`", r[1])) {
+            *word->w++ = r[1];
+            r += 2;
+        } else {
+            *word->w++ = *r++;
+        }
+    }
+    return r + 1;
+}
+
+// Push the word, or each field of a word split by unquoted expansions.
+// Fields that an expansion left empty are dropped, and so is a word
+// that was only a "$@" with no parameters.
+static int push_word(Word* word, int assignment, int* count) {
+    size_t len = word->w - word->start;
+    size_t from = 0;
+    int e = 0;
+    
+    for (int b = 0; b <= word->breaks; b++) {
+        size_t to = b < word->breaks ? lex_breaks[b] : len;
+        int keep = to > from || !word->expanded ||
+                   (word->quoted && word->breaks == 0 && !(word->no_params && len == 0));
+        
+        int first = e;
+        while (e < word->escapes && lex_escapes[e] < to) e++;
+        while (first < e && lex_escapes[first] < from) first++;
+        
+        if (keep) {
+            char* text = word->moved || word->breaks > 0
+                ? arena_strndup(&parse_arena, word->start + from, to - from)
+                : word->start;
+            if (!text || push_token(TOK_WORD, text, to - from, word->quoted, count) < 0) {
+                return -1;
+            }
+            
+            Token* tok = &lex_tokens[*count - 1];
+            tok->assignment = assignment;
+            if (word->glob && !assignment) {
+                tok->pattern = e > first
+                    ? escaped_pattern(text, to - from, lex_escapes + first, e - first, from)
+                    : text;
+                if (!tok->pattern) return -1;
+            }
+        }
+        from = to;
+    }
+    return 0;
+}
+
+int lex_line(char* line, Token** tokens, int* token_count) {
+    int count = 0;
+    char* p = line;
+    const char* line_end = line + strlen(line);
+    TokenType op;
+    
+    for (;;) {
+        while (is_blank(*p)) p++;
+        if (*p == '\0' || *p == '#') break;
+        
+        int op_len = lex_operator(p, &op);
+        if (op_len > 0) {
+            if (push_token(op, NULL, 0, 0, &count) < 0) return -1;
+            p += op_len;
+            continue;
+        }
+        
+        // Word: r reads the source, the word is written behind it.
+        // NAME=value is an assignment, whose value is neither split nor
+        // globbed.
+        Word word = {p, p, line_end, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        char* r = p;
+        size_t name_len = var_name_length(p);
+        int assignment = name_len > 0 && p[name_len] == '=';
+        word.fields = !assignment;
+        
+        for (;;) {
+            size_t run = strcspn(r, WORD_BREAK);
+            if (word.w != r) memmove(word.w, r, run);
+            r += run;
+            word.w += run;
+            
+            if (*r == '*' || *r == '?' || *r == '[') {
+                word.glob = 1;
+                *word.w++ = *r++;
+                continue;
+            }
+            if (*r == '$') {
+                r = expand_dollar(r, &word, !assignment);
+                if (!r) return -1;
+                continue;
+            }
+            if (*r != '\'' && *r != '"' && *r != '\\') break;
+            
+            // A lone trailing backslash is dropped, anything else is quoting
+            if (!(*r == '\\' && r[1] == '\0')) word.quoted = 1;
+            size_t section = word.w - word.start;
+            r = unquote(r, &word);
+            if (!r) {
+                if (!word.failed) {
+                    fprintf(stderr, "myshell: syntax error: unterminated quote\n");
+                }
+                return -1;
+            }
+            
+            // Quoted metacharacters must stay literal if the word is globbed
+            for (char* c = word.start + section; c < word.w; c++) {
+                if (strchr(GLOB_SPECIAL, *c) &&
+                    push_offset(&lex_escapes, &escape_capacity, &word.escapes,
+                                c - word.start) < 0) {
+                    return -1;
+                }
+            }
+        }
+        
+        // The terminator may land on the delimiter, so classify it first
+        char delim = *r;
+        op_len = lex_operator(r, &op);
+        *word.w = '\0';
+        
+        // Unquoted digits right before < or > name the descriptor (2>file)
+        if (!word.quoted && !word.expanded && (delim == '<' || delim == '>') &&
+            all_digits(word.start)) {
+            if (push_token(TOK_IO_NUMBER, word.start, word.w - word.start, 0, &count) < 0) {
+                return -1;
+            }
+        } else if (push_word(&word, assignment, &count) < 0) {
+            return -1;
+        }
+        
+        if (op_len > 0) {
+            if (push_token(op, NULL, 0, 0, &count) < 0) return -1;
+            p = r + op_len;
+        } else if (delim == '\0') {
+            break;
+        } else {
+            p = r + 1;
+        }
     }
-    free(tokens);
+    
+    *tokens = lex_tokens;
+    *token_count = count;
+    return 0;
 }
 
 // ==================== COMMAND CREATION ====================
 Command* create_command() {
-    Command* cmd = malloc(sizeof(Command));
-    if (!cmd) return NULL;
+    Command* cmd = command_pool;
+    if (cmd) {
+        command_pool = cmd->pipe_next;
+    } else {
+        cmd = malloc(sizeof(Command));
+        if (!cmd) return NULL;
+        command_allocs++;
+    }
     
     memset(cmd, 0, sizeof(Command));
     cmd->argv = NULL;
     cmd->argc = 0;
     cmd->background = 0;
-    cmd->cmd_type = CMD_EXTERNAL;
+    cmd->cmd_type = CMD_UNRESOLVED;
     cmd->pipe_next = NULL;
-    cmd->input_redir.type = REDIR_NONE;
-    cmd->output_redir.type = REDIR_NONE;
-    cmd->input_redir.filename = NULL;
-    cmd->output_redir.filename = NULL;
+    cmd->redirs = NULL;
+    cmd->assigns = NULL;
+    cmd->assign_count = 0;
+    cmd->policy = NULL;
+    cmd->fanout = 0;
     
     return cmd;
 }
 
-// ==================== REDIRECTION PARSING ====================
-RedirectionType get_redir_type(const char* token) {
-    if (!token) return REDIR_NONE;
+// Return a command chain to the pool; its strings go with the arena
+void command_destroy(Command* cmd) {
+    while (cmd) {
+        Command* next = cmd->pipe_next;
+        cmd->pipe_next = command_pool;
+        command_pool = cmd;
+        cmd = next;
+    }
+}
+
+// ==================== MAIN PARSING FUNCTION ====================
+static const char* token_name(TokenType type) {
+    switch (type) {
+        case TOK_PIPE: return "|";
+        case TOK_AMP: return "&";
+        case TOK_LESS: return "<";
+        case TOK_GREAT: return ">";
+        case TOK_DGREAT: return ">>";
+        case TOK_LESSGREAT: return "<>";
+        case TOK_LESSAND: return "<&";
+        case TOK_GREATAND: return ">&";
+        case TOK_DLESS: return "<<";
+        case TOK_DLESSDASH: return "<<-";
+        case TOK_TLESS: return "<<<";
+        case TOK_ANDGREAT: return "&>";
+        case TOK_ANDDGREAT: return "&>>";
+        case TOK_FANOUT: return "|>";
+        case TOK_LPAREN: return "(";
+        case TOK_RPAREN: return ")";
+        case TOK_SEMI: return ";";
+        case TOK_AND_IF: return "&&";
+        case TOK_OR_IF: return "||";
+        default: return "newline";
+    }
+}
+
+static void syntax_error(const Token* tok) {
+    fprintf(stderr, "myshell: syntax error near unexpected token `%s'\n",
+            !tok ? "newline" : tok->text ? tok->text : token_name(tok->type));
+}
+
+// ==================== REDIRECTIONS ====================
+static Redirection* add_redirection(Redirection*** tail, RedirectionType type, int fd) {
+    Redirection* r = arena_alloc(&parse_arena, sizeof(Redirection));
+    if (!r) return NULL;
+    
+    memset(r, 0, sizeof(Redirection));
+    r->type = type;
+    r->fd = fd;
+    r->dup_fd = -1;
+    r->open_fd = -1;
+    **tail = r;
+    *tail = &r->next;
+    return r;
+}
+
+// Append the redirection for operator op with target word; fd is the
+// descriptor written before the operator, -1 for the default
+static int parse_redirection(Redirection*** tail, TokenType op, int fd, Token* target) {
+    Redirection* r = NULL;
+    Redirection* err;
+    char* text;
+    
+    // A globbed file name must name exactly one file; here-document
+    // delimiters and here-strings are never globbed
+    if (target->pattern && op != TOK_DLESS && op != TOK_DLESSDASH && op != TOK_TLESS) {
+        char** matches;
+        line_volatile = 1;
+        int n = wildcard_expand(target->pattern, &parse_arena, &matches);
+        if (n < 0) {
+            perror("glob");
+            return -1;
+        }
+        if (n > 1) {
+            fprintf(stderr, "myshell: %s: ambiguous redirect\n", target->text);
+            return -1;
+        }
+        if (n == 1) {
+            target->text = matches[0];
+            target->len = strlen(matches[0]);
+        }
+    }
+    
+    switch (op) {
+        case TOK_LESS:
+        case TOK_LESSGREAT:
+            r = add_redirection(tail, op == TOK_LESS ? REDIR_IN : REDIR_RDWR, fd < 0 ? 0 : fd);
+            if (r) r->filename = target->text;
+            break;
+            
+        case TOK_GREAT:
+        case TOK_DGREAT:
+            r = add_redirection(tail, op == TOK_GREAT ? REDIR_OUT : REDIR_APPEND, fd < 0 ? 1 : fd);
+            if (r) r->filename = target->text;
+            break;
+            
+        case TOK_DLESS:
+        case TOK_DLESSDASH:
+            // The body is read by parse_heredocs() once the line is parsed
+            line_volatile = 1;
+            r = add_redirection(tail, REDIR_HEREDOC, fd < 0 ? 0 : fd);
+            if (r) {
+                r->filename = target->text;
+                r->strip_tabs = op == TOK_DLESSDASH;
+                r->expand = !target->quoted;
+            }
+            break;
+            
+        case TOK_TLESS:
+            // Here-string: the word plus a newline
+            text = arena_alloc(&parse_arena, target->len + 1);
+            r = text ? add_redirection(tail, REDIR_HEREDOC, fd < 0 ? 0 : fd) : NULL;
+            if (r) {
+                memcpy(text, target->text, target->len);
+                text[target->len] = '\n';
+                r->text = text;
+                r->text_len = target->len + 1;
+            }
+            break;
+            
+        case TOK_LESSAND:
+        case TOK_GREATAND:
+            if (strcmp(target->text, "-") == 0 || (!target->quoted && all_digits(target->text))) {
+                r = add_redirection(tail, REDIR_DUP, fd >= 0 ? fd : op == TOK_LESSAND ? 0 : 1);
+                if (r && target->text[0] != '-') r->dup_fd = atoi(target->text);
+                break;
+            }
+            if (op == TOK_LESSAND || fd >= 0) {
+                fprintf(stderr, "myshell: %s: ambiguous redirect\n", target->text);
+                return -1;
+            }
+            // >&file is &>file
+            /* fall through */
+        case TOK_ANDGREAT:
+        case TOK_ANDDGREAT:
+            r = add_redirection(tail, op == TOK_ANDDGREAT ? REDIR_APPEND : REDIR_OUT, 1);
+            if (r) r->filename = target->text;
+            err = r ? add_redirection(tail, REDIR_DUP, 2) : NULL;
+            if (err) err->dup_fd = 1;
+            else r = NULL;
+            break;
+            
+        default:
+            break;
+    }
     
-    if (strcmp(token, "<") == 0) return REDIR_IN;
-    if (strcmp(token, ">") == 0) return REDIR_OUT;
-    if (strcmp(token, ">>") == 0) return REDIR_APPEND;
-    return REDIR_NONE;
+    if (!r) {
+        perror("redirection");
+        return -1;
+    }
+    return 0;
 }
 
-void parse_redirections(Command* cmd, char*** tokens_ptr, int* count_ptr) {
-    if (!cmd || !tokens_ptr || !count_ptr) return;
+// Add the paths matching a glob word to argv, or the word itself when
+// nothing matches. argv has room for words more arguments plus the NULL
+// and is moved to a bigger array when the matches need it.
+static int expand_word(Command* command, int* room, int words, Token* tok) {
+    char** matches = NULL;
+    int n = 0;
+    if (tok->pattern) {
+        line_volatile = 1;
+        n = wildcard_expand(tok->pattern, &parse_arena, &matches);
+    }
+    if (n < 0) {
+        perror("glob");
+        return -1;
+    }
+    if (n == 0) {
+        command->argv[command->argc++] = tok->text;
+        return 0;
+    }
     
-    char** tokens = *tokens_ptr;
-    int count = *count_ptr;
+    if (command->argc + n + words > *room) {
+        int bigger = command->argc + n + words;
+        char** argv = arena_alloc(&parse_arena, (bigger + 1) * sizeof(char*));
+        if (!argv) {
+            perror("glob");
+            return -1;
+        }
+        memcpy(argv, command->argv, command->argc * sizeof(char*));
+        command->argv = argv;
+        *room = bigger;
+    }
+    memcpy(command->argv + command->argc, matches, n * sizeof(char*));
+    command->argc += n;
+    return 0;
+}
+
+// run OPTIONS cmd args: the options become cmd's policy. Without a
+// command (or with --default) run is left to the builtin.
+static int parse_run(Command* command) {
+    if (command->argc < 2 || strcmp(command->argv[0], "run") != 0 ||
+        strcmp(command->argv[1], "--default") == 0) {
+        return 0;
+    }
+
+    JobPolicy* policy = arena_alloc(&parse_arena, sizeof(JobPolicy));
+    if (!policy) return -1;
+
+    int used = policy_parse(policy, command->argc - 1, command->argv + 1);
+    if (used < 0) return -1;
+    if (used + 1 >= command->argc) return 0;
+
+    command->argv += used + 1;
+    command->argc -= used + 1;
+    command->policy = policy;
+    return 0;
+}
+
+// Build one pipeline stage from tokens[0..count)
+static Command* parse_stage(Token* tokens, int count, int background) {
+    Command* command = create_command();
+    if (!command) return NULL;
+    command->background = background;
     
+    int words = 0;
+    int assigns = 0;
     for (int i = 0; i < count; i++) {
-        RedirectionType type = get_redir_type(tokens[i]);
-        if (type != REDIR_NONE) {
-            if (i + 1 < count) {
-                // Found redirection symbol with filename
-                if (type == REDIR_IN) {
-                    cmd->input_redir.type = type;
-                    cmd->input_redir.filename = strdup(tokens[i + 1]);
-                } else {
-                    cmd->output_redir.type = type;
-                    cmd->output_redir.filename = strdup(tokens[i + 1]);
-                }
-                
-                // Remove redirection token and filename from array
-                free(tokens[i]);
-                free(tokens[i + 1]);
-                
-                // Shift remaining tokens
-                for (int j = i; j < count - 2; j++) {
-                    tokens[j] = tokens[j + 2];
-                }
-                count -= 2;
-                tokens[count] = NULL;
-                i--; // Adjust index
+        if (tokens[i].type == TOK_WORD) words++;
+        if (tokens[i].assignment) assigns++;
+    }
+    
+    // Redirection targets are counted above but not kept in argv
+    int room = words;
+    command->argv = arena_alloc(&parse_arena, (words + 1) * sizeof(char*));
+    if (assigns > 0) command->assigns = arena_alloc(&parse_arena, assigns * sizeof(char*));
+    if (!command->argv || (assigns > 0 && !command->assigns)) {
+        command_destroy(command);
+        return NULL;
+    }
+    
+    Redirection** tail = &command->redirs;
+    for (int i = 0; i < count; i++) {
+        Token* tok = &tokens[i];
+        if (tok->type == TOK_WORD) {
+            words--;
+            // NAME=value before the command name is an assignment
+            if (tok->assignment && command->argc == 0) {
+                command->assigns[command->assign_count++] = tok->text;
+                continue;
+            }
+            if (expand_word(command, &room, words, tok) < 0) {
+                command_destroy(command);
+                return NULL;
             }
+            continue;
+        }
+        
+        // The lexer only makes an IO number right before an operator
+        int fd = -1;
+        if (tok->type == TOK_IO_NUMBER) {
+            fd = tok->len > 2 ? REDIR_MAX_FD + 1 : atoi(tok->text);
+            if (fd > REDIR_MAX_FD) {
+                fprintf(stderr, "myshell: %s: bad file descriptor\n", tok->text);
+                command_destroy(command);
+                return NULL;
+            }
+            tok = &tokens[++i];
+        }
+        
+        Token* target = i + 1 < count ? &tokens[i + 1] : NULL;
+        if (!target || target->type != TOK_WORD) {
+            syntax_error(target);
+            command_destroy(command);
+            return NULL;
+        }
+        
+        if (parse_redirection(&tail, tok->type, fd, target) < 0) {
+            command_destroy(command);
+            return NULL;
         }
+        i++;
+    }
+    command->argv[command->argc] = NULL;
+    
+    if (parse_run(command) < 0) {
+        command_destroy(command);
+        return NULL;
     }
     
-    *tokens_ptr = tokens;
-    *count_ptr = count;
+    if (command->argc == 0 && command->assign_count == 0) {
+        syntax_error(count > 0 ? &tokens[count - 1] : NULL);
+        command_destroy(command);
+        return NULL;
+    }
+    return command;
 }
 
-// ==================== MAIN PARSING FUNCTION ====================
 int parse_input(const char* input, Command** cmd) {
     if (!input || is_empty_string(input)) {
         return 0;
     }
     
-    // Check for background job
-    int background = 0;
-    char* input_copy = strdup(input);
-    trim_whitespace(input_copy);
+    line_volatile = 0;
+    
+    // The lexer works in place on a single copy of the line
+    char* line = arena_strdup(&parse_arena, input);
+    if (!line) return 0;
+    
+    Token* tokens;
+    int count;
+    if (lex_line(line, &tokens, &count) < 0 || count == 0) {
+        return 0;
+    }
     
-    int len = strlen(input_copy);
-    if (len > 0 && input_copy[len - 1] == '&') {
+    // A trailing '&' runs the whole pipeline in the background
+    int background = 0;
+    if (tokens[count - 1].type == TOK_AMP) {
         background = 1;
-        input_copy[len - 1] = '\0';
-        trim_whitespace(input_copy);
+        count--;
     }
     
-    // Check for pipe
-    char* pipe_ptr = strchr(input_copy, '|');
-    if (pipe_ptr) {
-        // Split into two commands
-        *pipe_ptr = '\0';
-        char* first_part = trim_whitespace(input_copy);
-        char* second_part = trim_whitespace(pipe_ptr + 1);
-        
-        if (is_empty_string(first_part) || is_empty_string(second_part)) {
-            free(input_copy);
-            return 0;
+    // Split on every pipe and chain the stages through pipe_next. After
+    // producer |> come the consumers, (pipeline) (pipeline) ..., chained
+    // on with the first stage of each marked.
+    Command* head = NULL;
+    Command** tail = &head;
+    int first = 0;
+    int fanout = 0;        // seen |>
+    int in_group = 0;      // inside a consumer's parentheses
+    int group_start = 0;   // the next stage opens a consumer
+    
+    for (int i = 0; i <= count; i++) {
+        TokenType type = i < count ? tokens[i].type : TOK_WORD;
+        if (i < count && type != TOK_PIPE && type != TOK_AMP && type != TOK_FANOUT &&
+            type != TOK_LPAREN && type != TOK_RPAREN && type < TOK_SEMI) {
+            continue;
         }
         
-        // Parse first command
-        Command* cmd1 = create_command();
-        if (!cmd1) {
-            free(input_copy);
-            return 0;
+        // '&' is only accepted at the end of the line, a consumer's
+        // parentheses only after |> or another consumer, and list
+        // operators never
+        int bad = type == TOK_AMP || type >= TOK_SEMI;
+        if (type == TOK_LPAREN) {
+            bad = !fanout || in_group || i != first;
+        } else if (type == TOK_RPAREN || type == TOK_FANOUT) {
+            bad = in_group != (type == TOK_RPAREN) || (type == TOK_FANOUT && fanout);
+        } else if (fanout && !in_group) {
+            // Only more consumers may follow one; at the end there must be one
+            bad = i < count || i != first || group_start;
+        } else if (in_group && i == count) {
+            bad = 1;
+        }
+        if (!bad && type == TOK_LPAREN) {
+            in_group = 1;
+            group_start = 1;
+            first = i + 1;
+            continue;
         }
-        cmd1->background = background;
+        if (!bad && fanout && !in_group) break;
         
-        int count1;
-        char** tokens1 = tokenize(first_part, &count1);
-        if (!tokens1) {
-            free(cmd1);
-            free(input_copy);
+        if (bad || i == first) {
+            // Empty stage ("a | | b", "| a", "a |", "a |> ()")
+            syntax_error(i < count ? &tokens[i] : NULL);
+            command_destroy(head);
             return 0;
         }
         
-        parse_redirections(cmd1, &tokens1, &count1);
-        cmd1->argc = count1;
-        cmd1->argv = tokens1;
-        
-        // Parse second command
-        Command* cmd2 = create_command();
-        if (!cmd2) {
-            free_tokens(tokens1);
-            free(cmd1);
-            free(input_copy);
+        Command* stage = parse_stage(&tokens[first], i - first, background);
+        if (!stage) {
+            command_destroy(head);
             return 0;
         }
-        cmd2->background = background;
         
-        int count2;
-        char** tokens2 = tokenize(second_part, &count2);
-        if (!tokens2) {
-            free_tokens(tokens1);
-            free(cmd1);
-            free(cmd2);
-            free(input_copy);
+        // Assignments alone only make sense as a whole line
+        if (stage->argc == 0 && (head || i < count)) {
+            syntax_error(i < count ? &tokens[i] : NULL);
+            command_destroy(stage);
+            command_destroy(head);
             return 0;
         }
+        stage->fanout = group_start;
+        group_start = 0;
+        *tail = stage;
+        tail = &stage->pipe_next;
+        first = i + 1;
         
-        parse_redirections(cmd2, &tokens2, &count2);
-        cmd2->argc = count2;
-        cmd2->argv = tokens2;
+        if (type == TOK_FANOUT) {
+            fanout = 1;
+            group_start = 1;
+        } else if (type == TOK_RPAREN) {
+            in_group = 0;
+        }
+    }
+    
+    *cmd = head;
+    return 1;
+}
+
+// ==================== HERE-DOCUMENTS ====================
+static int heredoc_append(const char* text, size_t len) {
+    if (heredoc_len + len > heredoc_cap) {
+        size_t capacity = heredoc_cap ? heredoc_cap : 4096;
+        while (capacity < heredoc_len + len) capacity *= 2;
+        char* bigger = realloc(heredoc_buf, capacity);
+        if (!bigger) {
+            perror("realloc");
+            return -1;
+        }
+        heredoc_buf = bigger;
+        heredoc_cap = capacity;
+    }
+    memcpy(heredoc_buf + heredoc_len, text, len);
+    heredoc_len += len;
+    return 0;
+}
+
+// A body line of <<WORD with WORD unquoted: parameters expand as they
+// would in double quotes, and a backslash only escapes $, ` and itself.
+// 1 if a backslash at the end joins the line to the next.
+static int heredoc_append_expanded(const char* line, size_t len) {
+    const char* end = line + len;
+    while (line < end) {
+        size_t run = strcspn(line, "$\\");
+        if (heredoc_append(line, run) < 0) return -1;
+        line += run;
+        if (line == end) break;
         
-        // Link them
-        cmd1->pipe_next = cmd2;
-        *cmd = cmd1;
+        if (*line == '\\') {
+            if (line + 1 == end) return 1;
+            int escape = strchr("$`\\", line[1]) != NULL;
+            if (heredoc_append(line + escape, 1) < 0) return -1;
+            line += 1 + escape;
+            continue;
+        }
         
-        free(input_copy);
-        return 1;
+        const char* name;
+        size_t name_len;
+        int ref = dollar_ref(line, &name, &name_len);
+        if (ref < 0) return -1;
+        if (ref == 0) {
+            if (heredoc_append("$", 1) < 0) return -1;
+            line++;
+            continue;
+        }
+        const char* value = var_lookup(name, name_len);
+        if (value && heredoc_append(value, strlen(value)) < 0) return -1;
+        line += ref;
     }
+    return 0;
+}
+
+int parse_heredocs(Command* cmd, InputReader* input, const char* prompt) {
+    size_t base = heredoc_len;
     
-    // No pipe - single command
-    Command* command = create_command();
-    if (!command) {
-        free(input_copy);
-        return 0;
+    // Bodies follow the line in the order their operators appear
+    for (Command* stage = cmd; stage; stage = stage->pipe_next) {
+        for (Redirection* r = stage->redirs; r; r = r->next) {
+            if (r->type != REDIR_HEREDOC || r->text) continue;
+            
+            size_t start = heredoc_len;
+            for (;;) {
+                if (prompt) {
+                    fputs(prompt, stdout);
+                    fflush(stdout);
+                }
+                size_t len;
+                char* line = input_next_line(input, &len);
+                if (!line) {
+                    fprintf(stderr, "myshell: warning: here-document delimited by end-of-file (wanted `%s')\n",
+                            r->filename);
+                    break;
+                }
+                if (r->strip_tabs) {
+                    while (*line == '\t') {
+                        line++;
+                        len--;
+                    }
+                }
+                if (strcmp(line, r->filename) == 0) break;
+                
+                int joined = r->expand ? heredoc_append_expanded(line, len) : heredoc_append(line, len);
+                if (joined < 0 || (!joined && heredoc_append("\n", 1) < 0)) return -1;
+            }
+            r->text_len = heredoc_len - start;
+        }
     }
-    command->background = background;
     
-    int count;
-    char** tokens = tokenize(input_copy, &count);
-    if (!tokens) {
-        free(command);
-        free(input_copy);
-        return 0;
+    // The buffer has stopped moving; point the redirections into it
+    size_t offset = base;
+    for (Command* stage = cmd; stage; stage = stage->pipe_next) {
+        for (Redirection* r = stage->redirs; r; r = r->next) {
+            if (r->type != REDIR_HEREDOC || r->text) continue;
+            r->text = heredoc_buf ? heredoc_buf + offset : "";
+            offset += r->text_len;
+        }
     }
-    
-    parse_redirections(command, &tokens, &count);
-    command->argc = count;
-    command->argv = tokens;
-    command->pipe_next = NULL;
-    
-    *cmd = command;
-    free(input_copy);
-    return 1;
-}
\ No newline at end of file
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "parsecache.h"
+#include "arena.h"
+#include "builtin.h"
+#include "policy.h"
+
+#define PARSE_CACHE_DEFAULT 256
+#define PARSE_ENTRY_CHUNK   512
+
+// ==================== CACHE STATE ====================
+// Each entry owns an arena holding its key and a deep copy of the tree
+typedef struct ParseEntry {
+    uint64_t hash;
+    char* key;
+    size_t key_len;
+    Command* cmd;
+    Arena arena;
+    struct ParseEntry* next;       // bucket chain
+    struct ParseEntry* newer;      // LRU list, most recent at lru_head
+    struct ParseEntry* older;
+} ParseEntry;
+
+static ParseEntry** buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static long capacity = -1;         // read from the environment on first use
+static ParseEntry* lru_head = NULL;
+static ParseEntry* lru_tail = NULL;
+
+static struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long uncacheable;
+    unsigned long evictions;
+} stats;
+
+// Normalized line of the last lookup, reused by the store that follows
+static char* key_buf = NULL;
+static size_t key_cap = 0;
+static size_t key_len = 0;
+static uint64_t key_hash = 0;
+
+static int cache_enabled(void) {
+    if (capacity < 0) {
+        const char* value = getenv("MYSHELL_PARSE_CACHE");
+        capacity = value && *value ? strtol(value, NULL, 10) : PARSE_CACHE_DEFAULT;
+        if (capacity < 0) capacity = 0;
+    }
+    return capacity > 0;
+}
+
+// ==================== KEYS ====================
+// Runs of unquoted blanks separate words the same way however long they
+// are, so they become one space. Sets key_buf, key_len and key_hash.
+static int make_key(const char* line) {
+    size_t len = strlen(line);
+    if (len + 1 > key_cap) {
+        size_t cap = key_cap ? key_cap : 256;
+        while (cap < len + 1) cap *= 2;
+        char* bigger = realloc(key_buf, cap);
+        if (!bigger) return -1;
+        key_buf = bigger;
+        key_cap = cap;
+    }
+
+    char quote = 0;
+    int blank = 0;
+    size_t n = 0;
+    for (const char* p = line; *p; p++) {
+        char c = *p;
+        if (!quote && (c == ' ' || c == '\t')) {
+            if (!blank) key_buf[n++] = ' ';
+            blank = 1;
+            continue;
+        }
+        blank = 0;
+
+        if (c == '\\' && p[1] && quote != '\'') {
+            key_buf[n++] = c;
+            c = *++p;
+        } else if (quote && c == quote) {
+            quote = 0;
+        } else if (!quote && (c == '\'' || c == '"')) {
+            quote = c;
+        }
+        key_buf[n++] = c;
+    }
+    key_buf[n] = '\0';
+    key_len = n;
+
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)key_buf[i];
+        h *= 1099511628211ull;
+    }
+    key_hash = h;
+    return 0;
+}
+
+// ==================== LRU LIST ====================
+static void lru_unlink(ParseEntry* e) {
+    if (e->newer) e->newer->older = e->older;
+    else lru_head = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else lru_tail = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void lru_push(ParseEntry* e) {
+    e->newer = NULL;
+    e->older = lru_head;
+    if (lru_head) lru_head->newer = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static void evict_oldest(void) {
+    ParseEntry* e = lru_tail;
+    if (!e) return;
+
+    for (ParseEntry** link = &buckets[e->hash & (bucket_count - 1)]; *link; link = &(*link)->next) {
+        if (*link == e) {
+            *link = e->next;
+            break;
+        }
+    }
+    lru_unlink(e);
+    arena_destroy(&e->arena);
+    free(e);
+    entry_count--;
+    stats.evictions++;
+}
+
+// ==================== LOOKUP ====================
+Command* parse_cache_lookup(const char* line) {
+    if (!cache_enabled() || make_key(line) < 0) return NULL;
+
+    if (buckets) {
+        for (ParseEntry* e = buckets[key_hash & (bucket_count - 1)]; e; e = e->next) {
+            if (e->hash == key_hash && e->key_len == key_len &&
+                memcmp(e->key, key_buf, key_len) == 0) {
+                if (e != lru_head) {
+                    lru_unlink(e);
+                    lru_push(e);
+                }
+                stats.hits++;
+                return e->cmd;
+            }
+        }
+    }
+    stats.misses++;
+    return NULL;
+}
+
+// ==================== STORE ====================
+static char** clone_strings(Arena* a, char** src, int count, int terminated) {
+    if (!src) return NULL;
+
+    char** out = arena_alloc(a, (count + terminated) * sizeof(char*));
+    if (!out) return NULL;
+    for (int i = 0; i < count; i++) {
+        if (!(out[i] = arena_strdup(a, src[i]))) return NULL;
+    }
+    if (terminated) out[count] = NULL;
+    return out;
+}
+
+static Redirection* clone_redirections(Arena* a, const Redirection* src, int* failed) {
+    Redirection* head = NULL;
+    Redirection** tail = &head;
+
+    for (; src; src = src->next) {
+        Redirection* r = arena_alloc(a, sizeof(Redirection));
+        if (!r) {
+            *failed = 1;
+            return NULL;
+        }
+        *r = *src;
+        r->open_fd = -1;
+        r->next = NULL;
+        if (src->filename && !(r->filename = arena_strdup(a, src->filename))) *failed = 1;
+        if (src->text) {
+            // Here-string body, not NUL-terminated
+            r->text = arena_alloc(a, src->text_len ? src->text_len : 1);
+            if (r->text) memcpy(r->text, src->text, src->text_len);
+            else *failed = 1;
+        }
+        *tail = r;
+        tail = &r->next;
+    }
+    return head;
+}
+
+// Deep copy of the pipeline, builtins looked up once here
+static Command* clone_commands(Arena* a, const Command* src) {
+    Command* head = NULL;
+    Command** tail = &head;
+
+    for (; src; src = src->pipe_next) {
+        Command* c = arena_alloc(a, sizeof(Command));
+        if (!c) return NULL;
+        *c = *src;
+        c->pipe_next = NULL;
+
+        int failed = 0;
+        c->argv = clone_strings(a, src->argv, src->argc, 1);
+        c->assigns = clone_strings(a, src->assigns, src->assign_count, 0);
+        c->redirs = clone_redirections(a, src->redirs, &failed);
+        if ((src->argv && !c->argv) || (src->assigns && !c->assigns) || failed) return NULL;
+
+        if (src->policy) {
+            if (!(c->policy = arena_alloc(a, sizeof(JobPolicy)))) return NULL;
+            *c->policy = *src->policy;
+        }
+
+        c->builtin = c->argc > 0 && !c->policy ? get_builtin(c->argv[0]) : NULL;
+        c->cmd_type = c->builtin ? CMD_BUILTIN : CMD_EXTERNAL;
+
+        *tail = c;
+        tail = &c->pipe_next;
+    }
+    return head;
+}
+
+static int grow_table(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : 64;
+    ParseEntry** new_buckets = calloc(new_count, sizeof(ParseEntry*));
+    if (!new_buckets) return -1;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        ParseEntry* e = buckets[i];
+        while (e) {
+            ParseEntry* next = e->next;
+            size_t idx = e->hash & (new_count - 1);
+            e->next = new_buckets[idx];
+            new_buckets[idx] = e;
+            e = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+// Called right after a lookup of the same line missed
+void parse_cache_store(const char* line, const Command* cmd, int cacheable) {
+    if (!cache_enabled() || !cmd) return;
+    if (!cacheable) {
+        stats.uncacheable++;
+        return;
+    }
+    (void)line;    // its key is still in key_buf from the lookup
+
+    if (entry_count + 1 > bucket_count && grow_table() < 0) return;
+    while (entry_count >= (size_t)capacity) evict_oldest();
+
+    ParseEntry* e = calloc(1, sizeof(ParseEntry));
+    if (!e) return;
+    arena_init(&e->arena, PARSE_ENTRY_CHUNK);
+    e->hash = key_hash;
+    e->key_len = key_len;
+    e->key = arena_strndup(&e->arena, key_buf, key_len);
+    e->cmd = e->key ? clone_commands(&e->arena, cmd) : NULL;
+    if (!e->cmd) {
+        arena_destroy(&e->arena);
+        free(e);
+        return;
+    }
+
+    size_t idx = e->hash & (bucket_count - 1);
+    e->next = buckets[idx];
+    buckets[idx] = e;
+    lru_push(e);
+    entry_count++;
+}
+
+// ==================== REPORTING ====================
+void parse_cache_print(FILE* out) {
+    cache_enabled();
+    fprintf(out, "parse cache: %lu hits, %lu misses, %lu uncacheable, %lu evictions, %zu/%ld entries\n",
+            stats.hits, stats.misses, stats.uncacheable, stats.evictions, entry_count, capacity);
+}
+
+void parse_cache_print_json(FILE* out) {
+    cache_enabled();
+    fprintf(out, "  \"parse_cache\": {\"hits\": %lu, \"misses\": %lu, \"uncacheable\": %lu, "
+            "\"evictions\": %lu, \"entries\": %zu, \"capacity\": %ld}",
+            stats.hits, stats.misses, stats.uncacheable, stats.evictions, entry_count, capacity);
+}
+
+void parse_cache_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+void parse_cache_cleanup(void) {
+    while (lru_tail) evict_oldest();
+    free(buckets);
+    buckets = NULL;
+    bucket_count = 0;
+    free(key_buf);
+    key_buf = NULL;
+    key_cap = 0;
+    key_len = 0;
+}
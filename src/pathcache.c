@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "pathcache.h"
+
+// ==================== CACHE STATE ====================
+typedef struct PathEntry {
+    char* name;
+    char* path;
+    unsigned long hits;
+    uint32_t hash;
+    struct PathEntry* next;
+} PathEntry;
+
+static PathEntry** buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static char* cached_path_var = NULL;   // $PATH the entries were resolved against
+
+static uint32_t hash_name(const char* name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void path_cache_clear(void) {
+    for (size_t i = 0; i < bucket_count; i++) {
+        PathEntry* e = buckets[i];
+        while (e) {
+            PathEntry* next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    entry_count = 0;
+
+    free(cached_path_var);
+    cached_path_var = NULL;
+}
+
+// Drop everything if $PATH changed since the entries were resolved
+static void check_path_var(void) {
+    const char* path_var = getenv("PATH");
+    if (!path_var) path_var = "";
+
+    if (cached_path_var && strcmp(cached_path_var, path_var) == 0) return;
+
+    path_cache_clear();
+    cached_path_var = strdup(path_var);
+}
+
+static int grow_table(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : 64;
+    PathEntry** new_buckets = calloc(new_count, sizeof(PathEntry*));
+    if (!new_buckets) return -1;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        PathEntry* e = buckets[i];
+        while (e) {
+            PathEntry* next = e->next;
+            size_t idx = e->hash & (new_count - 1);
+            e->next = new_buckets[idx];
+            new_buckets[idx] = e;
+            e = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+static PathEntry* find_entry(const char* name, uint32_t h) {
+    if (!buckets) return NULL;
+
+    for (PathEntry* e = buckets[h & (bucket_count - 1)]; e; e = e->next) {
+        if (e->hash == h && strcmp(e->name, name) == 0) return e;
+    }
+    return NULL;
+}
+
+static PathEntry* insert_entry(const char* name, uint32_t h, const char* path) {
+    if (entry_count + 1 > bucket_count * 3 / 4 && grow_table() < 0) return NULL;
+
+    PathEntry* e = malloc(sizeof(PathEntry));
+    if (!e) return NULL;
+
+    e->name = strdup(name);
+    e->path = strdup(path);
+    if (!e->name || !e->path) {
+        free(e->name);
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    e->hits = 0;
+    e->hash = h;
+
+    size_t idx = h & (bucket_count - 1);
+    e->next = buckets[idx];
+    buckets[idx] = e;
+    entry_count++;
+    return e;
+}
+
+// ==================== PATH SEARCH ====================
+static int is_executable(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walk path_var once; *cacheable is cleared for hits in relative directories
+static char* search_dirs(const char* name, const char* path_var, int* cacheable) {
+    size_t name_len = strlen(name);
+    const char* dir = path_var;
+
+    *cacheable = 1;
+
+    for (;;) {
+        const char* end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        char* candidate = malloc(dir_len + name_len + 3);
+        if (!candidate) return NULL;
+
+        if (dir_len == 0) {
+            // Empty entry means current directory
+            sprintf(candidate, "./%s", name);
+        } else {
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            memcpy(candidate + dir_len + 1, name, name_len + 1);
+        }
+
+        if (is_executable(candidate)) {
+            *cacheable = (candidate[0] == '/');
+            return candidate;
+        }
+        free(candidate);
+
+        if (!end) break;
+        dir = end + 1;
+    }
+
+    return NULL;
+}
+
+// The same for $PATH as of the last check_path_var()
+static char* search_path(const char* name, int* cacheable) {
+    return search_dirs(name, cached_path_var ? cached_path_var : "", cacheable);
+}
+
+// ==================== PUBLIC API ====================
+// Returned pointer stays valid until the entry is forgotten or the
+// cache is cleared. Names containing '/' are returned unchanged.
+const char* path_lookup(const char* name) {
+    if (!name || !*name) return NULL;
+    if (strchr(name, '/')) return name;
+
+    check_path_var();
+
+    uint32_t h = hash_name(name);
+    PathEntry* e = find_entry(name, h);
+    if (e) {
+        e->hits++;
+        return e->path;
+    }
+
+    int cacheable;
+    char* path = search_path(name, &cacheable);
+    if (!path) return NULL;
+
+    // Relative hits depend on the cwd: keep one slot, replaced each lookup
+    if (!cacheable) {
+        static char* relative_hit = NULL;
+        free(relative_hit);
+        relative_hit = path;
+        return relative_hit;
+    }
+
+    e = insert_entry(name, h, path);
+    free(path);
+    if (!e) return NULL;
+
+    e->hits++;
+    return e->path;
+}
+
+char* path_search(const char* name, const char* path_var) {
+    if (!name || !*name) return NULL;
+    if (strchr(name, '/')) return strdup(name);
+
+    int cacheable;
+    return search_dirs(name, path_var, &cacheable);
+}
+
+// Called when a cached path turned out to be stale (ENOENT on exec)
+void path_cache_forget(const char* name) {
+    if (!name || !buckets) return;
+
+    uint32_t h = hash_name(name);
+    PathEntry** link = &buckets[h & (bucket_count - 1)];
+    while (*link) {
+        PathEntry* e = *link;
+        if (e->hash == h && strcmp(e->name, name) == 0) {
+            *link = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            entry_count--;
+            return;
+        }
+        link = &e->next;
+    }
+}
+
+// Resolve and remember name without counting a hit
+int path_cache_add(const char* name) {
+    if (!name || !*name || strchr(name, '/')) return -1;
+
+    check_path_var();
+
+    uint32_t h = hash_name(name);
+    if (find_entry(name, h)) return 0;
+
+    int cacheable;
+    char* path = search_path(name, &cacheable);
+    if (!path) return -1;
+
+    PathEntry* e = cacheable ? insert_entry(name, h, path) : NULL;
+    free(path);
+    return e ? 0 : -1;
+}
+
+void path_cache_print(void) {
+    check_path_var();
+
+    if (entry_count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < bucket_count; i++) {
+        for (PathEntry* e = buckets[i]; e; e = e->next) {
+            printf("%4lu\t%s\n", e->hits, e->path);
+        }
+    }
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include "policy.h"
+
+// From linux/ioprio.h, which older kernel headers lack
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static const char* io_class_names[] = {"none", "realtime", "best-effort", "idle"};
+
+// ==================== OPTION PARSING ====================
+// "0-3,8,10-11"
+static int parse_cpus(const char* arg, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    const char* p = arg;
+
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) return -1;
+
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        if (last >= CPU_SETSIZE) return -1;
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (*end == ',') end++;
+        else if (*end) return -1;
+        p = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+static int parse_number(const char* arg, long* n, int sizes) {
+    char* end;
+    *n = strtol(arg, &end, 10);
+    if (end == arg || *n < 0) return -1;
+
+    if (sizes && (*end == 'K' || *end == 'k')) *n <<= 10, end++;
+    else if (sizes && (*end == 'M' || *end == 'm')) *n <<= 20, end++;
+    else if (sizes && (*end == 'G' || *end == 'g')) *n <<= 30, end++;
+    return *end ? -1 : 0;
+}
+
+// "idle", "best-effort[:0-7]" or "realtime[:0-7]"
+static int parse_io(const char* arg, int* io_class, int* level) {
+    size_t len = strcspn(arg, ":");
+    *level = 4;
+
+    *io_class = 0;
+    for (int c = IOPRIO_CLASS_RT; c <= IOPRIO_CLASS_IDLE; c++) {
+        if (strlen(io_class_names[c]) == len && strncmp(arg, io_class_names[c], len) == 0) {
+            *io_class = c;
+        }
+    }
+    if (*io_class == 0) return -1;
+
+    if (arg[len] == ':') {
+        long n;
+        if (*io_class == IOPRIO_CLASS_IDLE || parse_number(arg + len + 1, &n, 0) < 0 || n > 7) {
+            return -1;
+        }
+        *level = (int)n;
+    }
+    if (*io_class == IOPRIO_CLASS_IDLE) *level = 0;
+    return 0;
+}
+
+// A group directory of the cgroup v2 tree, relative paths under its
+// root. The child only has to open its cgroup.procs, so the path is
+// built here.
+static int parse_cgroup(const char* arg, JobPolicy* policy) {
+    char* out = policy->cgroup;
+    size_t size = sizeof(policy->cgroup);
+    int len = arg[0] == '/' ? snprintf(out, size, "%s", arg)
+                            : snprintf(out, size, "%s/%s", CGROUP_ROOT, arg);
+    if (len >= (int)size) {
+        fprintf(stderr, "run: %s: path too long\n", arg);
+        return -1;
+    }
+
+    char* procs = policy->cgroup_procs;
+    snprintf(procs, sizeof(policy->cgroup_procs), "%s/cgroup.procs", out);
+    if (access(procs, W_OK) < 0) {
+        fprintf(stderr, "run: %s: %s\n", procs, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int policy_parse(JobPolicy* policy, int argc, char** argv) {
+    memset(policy, 0, sizeof(*policy));
+
+    int i = 0;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const char* opt = argv[i];
+        if (strcmp(opt, "--") == 0) {
+            return i + 1;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "run: %s: missing argument\n", opt);
+            return -1;
+        }
+
+        const char* arg = argv[++i];
+        long n;
+        int bad = 0;
+        if (strcmp(opt, "-c") == 0 || strcmp(opt, "--cpus") == 0) {
+            bad = parse_cpus(arg, &policy->cpus);
+            policy->set |= POLICY_CPUS;
+        } else if (strcmp(opt, "-n") == 0 || strcmp(opt, "--nice") == 0) {
+            char* end;
+            n = strtol(arg, &end, 10);
+            bad = end == arg || *end || n < -20 || n > 19;
+            policy->nice = (int)n;
+            policy->set |= POLICY_NICE;
+        } else if (strcmp(opt, "-i") == 0 || strcmp(opt, "--io") == 0) {
+            bad = parse_io(arg, &policy->io_class, &policy->io_level);
+            policy->set |= POLICY_IO;
+        } else if (strcmp(opt, "-m") == 0 || strcmp(opt, "--mem") == 0) {
+            bad = parse_number(arg, &n, 1) < 0 || n == 0;
+            policy->mem = n;
+            policy->set |= POLICY_MEM;
+        } else if (strcmp(opt, "-t") == 0 || strcmp(opt, "--cpu-time") == 0) {
+            bad = parse_number(arg, &n, 0) < 0 || n == 0;
+            policy->cpu_time = n;
+            policy->set |= POLICY_CPU_TIME;
+        } else if (strcmp(opt, "-f") == 0 || strcmp(opt, "--nofile") == 0) {
+            bad = parse_number(arg, &n, 0) < 0 || n == 0;
+            policy->nofile = n;
+            policy->set |= POLICY_NOFILE;
+        } else if (strcmp(opt, "-g") == 0 || strcmp(opt, "--cgroup") == 0) {
+            if (parse_cgroup(arg, policy) < 0) return -1;
+            policy->set |= POLICY_CGROUP;
+        } else {
+            fprintf(stderr, "run: %s: invalid option\n", opt);
+            return -1;
+        }
+
+        if (bad) {
+            fprintf(stderr, "run: %s: invalid value for %s\n", arg, opt);
+            return -1;
+        }
+    }
+    return i;
+}
+
+// ==================== APPLYING ====================
+// "myshell: run: what: reason" with write(2) alone: stdio and a
+// translated strerror() may wait on locks a thread of the parent held
+// at fork. strerrordesc_np() is a plain table lookup.
+static int apply_error(const char* what) {
+    const char* reason = strerrordesc_np(errno);
+    if (!reason) reason = "Unknown error";
+
+    const char* parts[] = {"myshell: run: ", what, ": ", reason, "\n"};
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        if (write(STDERR_FILENO, parts[i], strlen(parts[i])) < 0) break;
+    }
+    return -1;
+}
+
+static int set_limit(int resource, rlim_t value, const char* name) {
+    struct rlimit limit = {value, value};
+    return setrlimit(resource, &limit) < 0 ? apply_error(name) : 0;
+}
+
+int policy_apply(const JobPolicy* policy) {
+    if (!policy) return 0;
+
+    // Join the group first, so everything after is charged to it
+    if (policy->set & POLICY_CGROUP) {
+        int fd = open(policy->cgroup_procs, O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || write(fd, "0", 1) != 1) {
+            int err = errno;
+            if (fd >= 0) close(fd);
+            errno = err;
+            return apply_error(policy->cgroup_procs);
+        }
+        close(fd);
+    }
+
+    if ((policy->set & POLICY_CPUS) &&
+        sched_setaffinity(0, sizeof(cpu_set_t), &policy->cpus) < 0) {
+        return apply_error("cpus");
+    }
+    if ((policy->set & POLICY_NICE) && setpriority(PRIO_PROCESS, 0, policy->nice) < 0) {
+        return apply_error("nice");
+    }
+    if ((policy->set & POLICY_IO) &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                (policy->io_class << IOPRIO_CLASS_SHIFT) | policy->io_level) < 0) {
+        return apply_error("io");
+    }
+
+    if ((policy->set & POLICY_MEM) && set_limit(RLIMIT_AS, policy->mem, "mem") < 0) return -1;
+    if ((policy->set & POLICY_CPU_TIME) &&
+        set_limit(RLIMIT_CPU, policy->cpu_time, "cpu-time") < 0) return -1;
+    if ((policy->set & POLICY_NOFILE) &&
+        set_limit(RLIMIT_NOFILE, policy->nofile, "nofile") < 0) return -1;
+    return 0;
+}
+
+// ==================== LISTING ====================
+static void print_cpus(FILE* out, const cpu_set_t* cpus) {
+    const char* sep = "";
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpus)) continue;
+
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)) last++;
+        if (last > cpu) {
+            fprintf(out, "%s%d-%d", sep, cpu, last);
+        } else {
+            fprintf(out, "%s%d", sep, cpu);
+        }
+        sep = ",";
+        cpu = last;
+    }
+}
+
+void policy_print(FILE* out, const JobPolicy* policy) {
+    if (policy->set & POLICY_CPUS) {
+        fputs(" --cpus ", out);
+        print_cpus(out, &policy->cpus);
+    }
+    if (policy->set & POLICY_NICE) fprintf(out, " --nice %d", policy->nice);
+    if (policy->set & POLICY_IO) {
+        fprintf(out, " --io %s", io_class_names[policy->io_class]);
+        if (policy->io_class != IOPRIO_CLASS_IDLE) fprintf(out, ":%d", policy->io_level);
+    }
+    if (policy->set & POLICY_MEM) fprintf(out, " --mem %llu", (unsigned long long)policy->mem);
+    if (policy->set & POLICY_CPU_TIME) {
+        fprintf(out, " --cpu-time %llu", (unsigned long long)policy->cpu_time);
+    }
+    if (policy->set & POLICY_NOFILE) {
+        fprintf(out, " --nofile %llu", (unsigned long long)policy->nofile);
+    }
+    if (policy->set & POLICY_CGROUP) fprintf(out, " --cgroup %s", policy->cgroup);
+}
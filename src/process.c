@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "process.h"
+#include "execute.h"
+#include "pathcache.h"
+#include "stats.h"
+#include "vars.h"
+#include "policy.h"
+#include "script.h"
+
+extern char** environ;
+
+// ==================== BACKEND SELECTION ====================
+void spawn_init(Shell* self) {
+    if (!self) return;
+
+    // posix_spawn (clone(CLONE_VM|CLONE_VFORK) in glibc) by default,
+    // MYSHELL_SPAWN=fork forces the classic fork()+exec path
+    const char* mode = getenv("MYSHELL_SPAWN");
+    if (mode && strcmp(mode, "fork") == 0) {
+        self->spawn_backend = SPAWN_FORK;
+    } else {
+        self->spawn_backend = SPAWN_POSIX;
+    }
+}
+
+// The value of a PATH=... prefix of cmd, or NULL
+static const char* prefix_path(Command* cmd) {
+    const char* value = NULL;
+    for (int i = 0; i < cmd->assign_count; i++) {
+        if (strncmp(cmd->assigns[i], "PATH=", 5) == 0) value = cmd->assigns[i] + 5;
+    }
+    return value;
+}
+
+// ==================== POSIX_SPAWN BACKEND ====================
+// Returns 0 on success, a positive errno if the command could not be
+// started, or -1 if the spawn attributes could not be built (the caller
+// then falls back to fork)
+static int spawn_posix(Command* cmd, const char* path, char** envp, int in_fd,
+                       int out_fd, pid_t pgid, pid_t* pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdefault, sigmask;
+    int err = -1;
+
+    if (posix_spawn_file_actions_init(&actions) != 0) return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    // Child gets default job-control signals, an empty signal mask and
+    // joins (or leads) the pipeline's process group
+    sigemptyset(&sigdefault);
+    sigaddset(&sigdefault, SIGINT);
+    sigaddset(&sigdefault, SIGTSTP);
+    sigaddset(&sigdefault, SIGTTIN);
+    sigaddset(&sigdefault, SIGTTOU);
+    sigemptyset(&sigmask);
+    if (posix_spawnattr_setsigdefault(&attr, &sigdefault) != 0 ||
+        posix_spawnattr_setsigmask(&attr, &sigmask) != 0 ||
+        posix_spawnattr_setpgroup(&attr, pgid) != 0 ||
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                        POSIX_SPAWN_SETSIGMASK |
+                                        POSIX_SPAWN_SETPGROUP) != 0) {
+        goto out;
+    }
+
+    // Pipe ends first, then the redirections in order override them
+    if (in_fd >= 0 && posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO) != 0) {
+        goto out;
+    }
+    if (out_fd >= 0 && posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO) != 0) {
+        goto out;
+    }
+    for (Redirection* r = cmd->redirs; r; r = r->next) {
+        int src = redirection_source(r);
+        if ((src < 0 ? posix_spawn_file_actions_addclose(&actions, r->fd)
+                     : posix_spawn_file_actions_adddup2(&actions, src, r->fd)) != 0) {
+            goto out;
+        }
+    }
+
+    err = posix_spawn(pid, path, &actions, &attr, cmd->argv, envp);
+    if ((err == ENOENT || err == ENOTDIR) && path != cmd->argv[0] && !prefix_path(cmd)) {
+        // Cached location went stale, search $PATH again
+        path_cache_forget(cmd->argv[0]);
+        path = path_lookup(cmd->argv[0]);
+        if (path) {
+            err = posix_spawn(pid, path, &actions, &attr, cmd->argv, envp);
+        }
+    }
+    if (err != 0) {
+        fprintf(stderr, "myshell: %s: %s\n", cmd->argv[0], strerror(err));
+    }
+
+out:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+
+// ==================== FORK BACKEND ====================
+static pid_t spawn_fork(Command* cmd, const char* path, char** envp, int in_fd,
+                        int out_fd, pid_t pgid, const JobPolicy* session) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0) { // Child process
+        // Restore default signal dispositions and mask (in child)
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        setpgid(0, pgid);
+
+        // Connect pipe ends
+        if (in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) {
+            perror("dup2 pipe read");
+            _exit(EXIT_FAILURE);
+        }
+        if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) {
+            perror("dup2 pipe write");
+            _exit(EXIT_FAILURE);
+        }
+
+        // Redirections were opened by the parent; nothing to save here
+        if (apply_redirections(cmd, NULL) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+
+        // Session default first, the command's own run options over it
+        if (policy_apply(session) < 0 || policy_apply(cmd->policy) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+
+        // Execute command
+        execve(path, cmd->argv, envp);
+
+        // If execve returns, there was an error
+        perror("execve");
+        _exit(EXIT_FAILURE);
+    }
+
+    // Also set it from the parent so the group exists before we use it
+    setpgid(pid, pgid ? pgid : pid);
+    return pid;
+}
+
+// ==================== SUBSHELL STAGES ====================
+// A fork keeps every descriptor, and O_CLOEXEC does nothing without an
+// exec: close the other stages' pipe ends (and those of relays still
+// running for other jobs) or their readers never see EOF. Descriptors a
+// redirection put on the shell have no FD_CLOEXEC and stay open.
+static void close_job_pipes(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) return;
+
+    int own = dirfd(dir);
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        int fd = atoi(entry->d_name);
+        if (fd <= STDERR_FILENO || fd == own) continue;
+
+        struct stat st;
+        int flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && (flags & FD_CLOEXEC) && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+// Run a builtin, function or compound stage of a pipeline in a forked
+// copy of the shell, like an external stage: its output streams to the
+// next stage as it is written, and cd, export or exit in it leave this
+// shell alone
+pid_t spawn_subshell(Shell* self, Command* cmd, int in_fd, int out_fd, pid_t pgid) {
+    if (!self || !cmd) return -1;
+
+    // Nothing buffered may be written twice
+    fflush(stdout);
+    fflush(stderr);
+
+    uint64_t start = stats_now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0) {
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        setpgid(0, pgid);
+
+        if ((in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) ||
+            (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0)) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        close_job_pipes();
+
+        // The same policies as an external stage, inherited by whatever
+        // this stage starts
+        if (policy_apply(self->policy) < 0 || policy_apply(cmd->policy) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+
+        // The logger's and reaper's threads did not come along, and the
+        // terminal stays with the job this stage belongs to
+        self->logger = NULL;
+        self->jobs = NULL;
+        self->interactive = 0;
+
+        int status = script_run_stage(self, cmd);
+        fflush(stdout);
+        _exit(status & 0xff);
+    }
+
+    setpgid(pid, pgid ? pgid : pid);
+    stats_since(STAT_SPAWN, start);
+    return pid;
+}
+
+// ==================== SPAWN ENTRY POINT ====================
+// Start cmd with in_fd/out_fd (or -1 to inherit) as stdin/stdout, in
+// process group pgid (0 = new group led by the child).
+// The fds should be O_CLOEXEC so no other pipe ends leak into the child.
+pid_t spawn_command(Shell* self, Command* cmd, int in_fd, int out_fd, pid_t pgid) {
+    if (!self || !cmd || !cmd->argv || cmd->argc == 0) return -1;
+
+    // Resolve in the parent so the lookup is cached for the next spawn;
+    // PATH=dirs cmd searches those dirs instead, past the cache
+    uint64_t start = stats_now();
+    const char* prefix = prefix_path(cmd);
+    char* own_path = prefix ? path_search(cmd->argv[0], prefix) : NULL;
+    const char* path = prefix ? own_path : path_lookup(cmd->argv[0]);
+    stats_since(STAT_LOOKUP, start);
+    if (!path) {
+        fprintf(stderr, "myshell: %s: command not found\n", cmd->argv[0]);
+        return -1;
+    }
+
+    // Open the redirection targets here so errors are reported by the
+    // shell instead of being hidden inside the spawn call
+    start = stats_now();
+    if (open_redirections(cmd) < 0) {
+        free(own_path);
+        return -1;
+    }
+
+    // The shell's environment is passed as is; only NAME=value cmd needs
+    // an array of its own
+    char** envp = environ;
+    if (cmd->assign_count > 0) {
+        envp = var_environ_with(cmd->assigns, cmd->assign_count);
+        if (!envp) {
+            perror("malloc");
+            close_redirections(cmd);
+            free(own_path);
+            return -1;
+        }
+    }
+
+    // posix_spawn has no attributes for affinity, priority, limits or
+    // cgroups: a command under a policy always forks
+    pid_t pid = -1;
+    int err = -1;
+    if (self->spawn_backend == SPAWN_POSIX && !self->policy && !cmd->policy) {
+        err = spawn_posix(cmd, path, envp, in_fd, out_fd, pgid, &pid);
+    }
+    if (err < 0) {
+        // Fork requested or needed, or the spawn attributes could not be built
+        pid = spawn_fork(cmd, path, envp, in_fd, out_fd, pgid, self->policy);
+    } else if (err > 0) {
+        pid = -1;
+    }
+
+    if (envp != environ) free(envp);
+    free(own_path);
+    close_redirections(cmd);
+    stats_since(STAT_SPAWN, start);
+    return pid;
+}
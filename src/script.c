@@ -0,0 +1,1483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "script.h"
+#include "builtin.h"
+#include "execute.h"
+#include "parse.h"
+#include "parsecache.h"
+#include "input.h"
+#include "history.h"
+#include "stats.h"
+#include "vars.h"
+#include "wildcard.h"
+#include "arena.h"
+
+#define SCRIPT_ARENA_CHUNK (16 * 1024)
+#define FUNCTION_ARENA_CHUNK 1024
+#define FUNCTION_DEPTH_MAX 1000
+#define LINE_HEREDOC_MAX 32
+
+// ==================== SYNTAX TREE ====================
+typedef enum {
+    NODE_LEAF,      // a pipeline, parsed when it runs
+    NODE_AND,       // a && b
+    NODE_OR,        // a || b
+    NODE_NOT,       // ! a
+    NODE_IF,        // if a; then b; else c; fi (c is an IF for elif)
+    NODE_FOR,       // for text in words; do a; done
+    NODE_WHILE,     // while a; do b; done
+    NODE_UNTIL,     // until a; do b; done
+    NODE_GROUP,     // { a; }
+    NODE_FUNCTION,  // text() a
+    NODE_PIPE       // a | b ... with a compound stage, from a along pipe
+} NodeType;
+
+struct ScriptNode {
+    NodeType type;
+    char* text;          // leaf: pipeline; for: variable; function: name
+    char* words;         // for: ": words" to expand, NULL for "$@"
+    char* redirs;        // compound: ": redirections" after it, or NULL
+    char* heredocs;      // bodies of the << operators in text or redirs
+    ScriptNode* a;
+    ScriptNode* b;
+    ScriptNode* c;
+    ScriptNode* next;    // next command of the list
+    ScriptNode* pipe;    // next stage of a NODE_PIPE
+    int background;      // NODE_PIPE: ended with &
+};
+
+// Trees of the current command; reset before the next prompt
+static Arena script_arena = {NULL, NULL, SCRIPT_ARENA_CHUNK, 0};
+
+// The command's text so far, its lines joined by newlines
+static char* text_buf = NULL;
+static size_t text_len = 0;
+static size_t text_cap = 0;
+
+// Here-document bodies in operator order, each up to and including its
+// delimiter line, back to back
+static char* body_buf = NULL;
+static size_t body_len = 0;
+static size_t body_cap = 0;
+static size_t* body_ends = NULL;
+static int body_count = 0;
+static int body_capacity = 0;
+
+// Where the search for << operators goes on in text_buf: past what was
+// read, or at a word whose quote the last line left open
+static size_t heredoc_scan = 0;
+
+// A leaf's text while it is scanned, copied to the arena at its size
+static char* leaf_buf = NULL;
+static size_t leaf_len = 0;
+static size_t leaf_cap = 0;
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static int buffer_append(char** buf, size_t* len, size_t* cap, const char* s, size_t n) {
+    if (*len + n + 1 > *cap) {
+        size_t capacity = *cap ? *cap : 1024;
+        while (capacity < *len + n + 1) capacity *= 2;
+        char* bigger = realloc(*buf, capacity);
+        if (!bigger) {
+            perror("realloc");
+            return -1;
+        }
+        *buf = bigger;
+        *cap = capacity;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+    return 0;
+}
+
+// ==================== STRUCTURE PARSER ====================
+typedef struct {
+    const char* src;
+    size_t pos;
+    int incomplete;      // ran out of text inside a construct
+    int failed;          // syntax error, already reported
+    int background;      // the last pipeline ended with &
+    int heredoc_index;   // next here-document body to hand out
+    int depth;           // compound commands entered and not closed
+    int open;            // incomplete: fi, done or } words still needed
+} Scanner;
+
+static ScriptNode* parse_list(Scanner* s);
+static ScriptNode* parse_command(Scanner* s);
+
+static const char* list_enders[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+
+static ScriptNode* new_node(Scanner* s, NodeType type) {
+    ScriptNode* n = arena_alloc(&script_arena, sizeof(ScriptNode));
+    if (!n) {
+        perror("malloc");
+        s->failed = 1;
+        return NULL;
+    }
+    memset(n, 0, sizeof(ScriptNode));
+    n->type = type;
+    return n;
+}
+
+// Blanks, line continuations and comments, up to the end of the line.
+// The parser only stops between tokens, so a # here starts a comment.
+static void skip_blanks(Scanner* s) {
+    for (;;) {
+        const char* p = s->src + s->pos;
+        if (is_blank(*p)) {
+            s->pos++;
+        } else if (p[0] == '\\' && p[1] == '\n') {
+            s->pos += 2;
+        } else if (*p == '#') {
+            s->pos += strcspn(p, "\n");
+        } else {
+            return;
+        }
+    }
+}
+
+// Out of text: the command goes on in the next line. Each compound
+// command still open needs its fi, done or } first, unless a word
+// (a quote) is what was left open.
+static void ran_out(Scanner* s, int in_word) {
+    if (s->incomplete) return;
+    s->incomplete = 1;
+    s->open = in_word ? 0 : s->depth;
+}
+
+static void skip_newlines(Scanner* s) {
+    for (;;) {
+        skip_blanks(s);
+        if (s->src[s->pos] != '\n') return;
+        s->pos++;
+    }
+}
+
+// Length of the unquoted word at the position; 0 for an operator or a
+// word with quotes, escapes or expansions, which is never reserved
+static size_t word_at(Scanner* s) {
+    const char* p = s->src + s->pos;
+    const char* end = lex_word_end(p);
+    if (!end) return 0;
+
+    size_t n = end - p;
+    for (size_t i = 0; i < n; i++) {
+        if (strchr("'\"\\$", p[i])) return 0;
+    }
+    return n;
+}
+
+static int keyword_at(Scanner* s, const char* keyword) {
+    size_t n = word_at(s);
+    return n == strlen(keyword) && strncmp(s->src + s->pos, keyword, n) == 0;
+}
+
+// { if for while until: a compound command starts at the position
+static int compound_at(Scanner* s) {
+    return keyword_at(s, "{") || keyword_at(s, "if") || keyword_at(s, "for") ||
+           keyword_at(s, "while") || keyword_at(s, "until");
+}
+
+static int at_list_end(Scanner* s) {
+    if (s->src[s->pos] == '\0') return 1;
+    for (const char** k = list_enders; *k; k++) {
+        if (keyword_at(s, *k)) return 1;
+    }
+    return 0;
+}
+
+// Report the token at the position; at the end of the text the command
+// is only incomplete
+static void unexpected(Scanner* s) {
+    if (s->failed || s->incomplete) return;
+
+    const char* p = s->src + s->pos;
+    if (*p == '\0') {
+        ran_out(s, 0);
+        return;
+    }
+    s->failed = 1;
+
+    if (*p == '\n') {
+        fprintf(stderr, "myshell: syntax error near unexpected token `newline'\n");
+        return;
+    }
+    TokenType op;
+    size_t n = lex_operator(p, &op);
+    if (n == 0) {
+        const char* end = lex_word_end(p);
+        n = end ? (size_t)(end - p) : 1;
+    }
+    fprintf(stderr, "myshell: syntax error near unexpected token `%.*s'\n", (int)n, p);
+}
+
+static int expect(Scanner* s, const char* keyword) {
+    skip_newlines(s);
+    if (!keyword_at(s, keyword)) {
+        unexpected(s);
+        return 0;
+    }
+    s->pos += strlen(keyword);
+    return 1;
+}
+
+// The fi, done or } that closes a compound command
+static int expect_close(Scanner* s, const char* keyword) {
+    if (!expect(s, keyword)) return 0;
+    s->depth--;
+    return 1;
+}
+
+// The bodies of count here-documents, in the order they were read
+static char* take_heredocs(Scanner* s, int count) {
+    int first = s->heredoc_index;
+    s->heredoc_index += count;
+    if (first >= body_count) return arena_strdup(&script_arena, "");
+
+    int last = s->heredoc_index < body_count ? s->heredoc_index : body_count;
+    size_t start = first ? body_ends[first - 1] : 0;
+    return arena_strndup(&script_arena, body_buf + start, body_ends[last - 1] - start);
+}
+
+// A | at the position, followed by a compound command
+static int compound_stage_at(Scanner* s, size_t pos) {
+    Scanner next = *s;
+    next.pos = pos + 1;
+    skip_newlines(&next);
+    return compound_at(&next);
+}
+
+// Add n bytes at p to the text of the leaf being scanned
+static int leaf_add(Scanner* s, const char* p, size_t n) {
+    if (buffer_append(&leaf_buf, &leaf_len, &leaf_cap, p, n) == 0) return 0;
+    s->failed = 1;
+    return -1;
+}
+
+// Simple commands as they are for parse_input(), less comments and line
+// continuations, taken token by token with the lexer's quoting rules.
+// With whole set this is a pipeline of them: a | at the end of a line
+// carries it on, a trailing & stays in the text, and it ends before a |
+// that leads to a compound stage. Otherwise it is one command, up to any
+// | or &.
+static ScriptNode* scan_leaf(Scanner* s, int whole) {
+    const char* src = s->src;
+    size_t i = s->pos;
+    leaf_len = 0;
+    int pipe_open = 0;
+    int heredocs = 0;
+    s->background = 0;
+    for (;;) {
+        const char* p = src + i;
+        if (is_blank(*p)) {
+            if (leaf_add(s, p, 1) < 0) return NULL;
+            i++;
+            continue;
+        }
+        if (p[0] == '\\' && p[1] == '\n') {
+            i += 2;
+            continue;
+        }
+        if (*p == '#') {
+            i += strcspn(p, "\n");
+            continue;
+        }
+        if (pipe_open && (*p == '\n' || *p == '\0')) {
+            if (*p == '\0') {
+                ran_out(s, 0);
+                return NULL;
+            }
+            if (leaf_add(s, " ", 1) < 0) return NULL;
+            i++;
+            continue;
+        }
+        if (*p == '\0' || *p == '\n') break;
+
+        TokenType op = TOK_WORD;
+        size_t len = lex_operator(p, &op);
+        if (len == 0) {
+            const char* end = lex_word_end(p);
+            if (!end) {
+                ran_out(s, 1);
+                return NULL;
+            }
+            len = end - p;
+        } else if (op == TOK_SEMI || op == TOK_AND_IF || op == TOK_OR_IF) {
+            break;
+        } else if (op == TOK_PIPE || op == TOK_FANOUT || op == TOK_AMP) {
+            if (!whole || (op == TOK_PIPE && compound_stage_at(s, i))) break;
+            s->background = op == TOK_AMP;
+        } else if (op == TOK_DLESS || op == TOK_DLESSDASH) {
+            heredocs++;
+        }
+        pipe_open = op == TOK_PIPE || op == TOK_FANOUT;
+        if (leaf_add(s, p, len) < 0) return NULL;
+        i += len;
+        if (s->background) break;
+    }
+
+    size_t n = leaf_len;
+    while (n > 0 && is_blank(leaf_buf[n - 1])) n--;
+    if (n == 0) {
+        unexpected(s);
+        return NULL;
+    }
+    s->pos = i;
+
+    ScriptNode* node = new_node(s, NODE_LEAF);
+    if (!node) return NULL;
+    if (!(node->text = arena_strndup(&script_arena, leaf_buf, n))) {
+        perror("malloc");
+        s->failed = 1;
+        return NULL;
+    }
+    if (heredocs > 0 && !(node->heredocs = take_heredocs(s, heredocs))) {
+        perror("malloc");
+        s->failed = 1;
+        return NULL;
+    }
+    return node;
+}
+
+// ": " and the text of a leaf, to be expanded by parse_input()
+static char* colon_command(Scanner* s, const char* text) {
+    size_t len = strlen(text);
+    char* out = arena_alloc(&script_arena, len + 3);
+    if (!out) {
+        perror("malloc");
+        s->failed = 1;
+        return NULL;
+    }
+    memcpy(out, ": ", 2);
+    memcpy(out + 2, text, len + 1);
+    return out;
+}
+
+// Redirections after a compound command; a | or & after it is left to
+// parse_pipeline()
+static ScriptNode* finish_compound(Scanner* s, ScriptNode* node) {
+    if (!node) return NULL;
+
+    skip_blanks(s);
+    const char* p = s->src + s->pos;
+    TokenType op;
+    p += strspn(p, "0123456789");
+    if (!lex_operator(p, &op) || op < TOK_LESS || op > TOK_ANDDGREAT) return node;
+
+    ScriptNode* redirs = scan_leaf(s, 0);
+    if (!redirs) return NULL;
+    node->redirs = colon_command(s, redirs->text);
+    node->heredocs = redirs->heredocs;
+    return node->redirs ? node : NULL;
+}
+
+// A list that may not be empty
+static ScriptNode* parse_body(Scanner* s) {
+    ScriptNode* list = parse_list(s);
+    if (!list) unexpected(s);
+    return list;
+}
+
+// if/elif: the keyword is at the position
+static ScriptNode* parse_if(Scanner* s, size_t keyword_len) {
+    ScriptNode* node = new_node(s, NODE_IF);
+    if (!node) return NULL;
+    s->pos += keyword_len;
+
+    if (!(node->a = parse_body(s)) || !expect(s, "then") || !(node->b = parse_body(s))) {
+        return NULL;
+    }
+
+    // An elif is an if of its own that takes the fi
+    if (keyword_at(s, "elif")) {
+        node->c = parse_if(s, 4);
+        return node->c ? node : NULL;
+    }
+    if (keyword_at(s, "else")) {
+        s->pos += 4;
+        if (!(node->c = parse_body(s))) return NULL;
+    }
+    return expect_close(s, "fi") ? node : NULL;
+}
+
+static ScriptNode* parse_loop_body(Scanner* s, ScriptNode* node, ScriptNode** body) {
+    if (!expect(s, "do") || !(*body = parse_body(s)) || !expect_close(s, "done")) return NULL;
+    return node;
+}
+
+// for NAME [in WORDS]; do LIST; done
+static ScriptNode* parse_for(Scanner* s) {
+    ScriptNode* node = new_node(s, NODE_FOR);
+    if (!node) return NULL;
+    s->pos += 3;
+    skip_blanks(s);
+
+    size_t n = word_at(s);
+    if (n == 0 || var_name_length(s->src + s->pos) != n) {
+        unexpected(s);
+        return NULL;
+    }
+    node->text = arena_strndup(&script_arena, s->src + s->pos, n);
+    s->pos += n;
+    skip_newlines(s);
+
+    if (keyword_at(s, "in")) {
+        s->pos += 2;
+        skip_blanks(s);
+        const char* p = s->src + s->pos;
+        if (*p == ';' || *p == '\n') {
+            node->words = ": ";
+        } else {
+            ScriptNode* words = scan_leaf(s, 0);
+            if (!words) return NULL;
+            if (words->heredocs) {
+                fprintf(stderr, "myshell: syntax error: bad word list for `%s'\n", node->text);
+                s->failed = 1;
+                return NULL;
+            }
+            node->words = colon_command(s, words->text);
+            if (!node->words) return NULL;
+        }
+        skip_blanks(s);
+        if (s->src[s->pos] != ';' && s->src[s->pos] != '\n') {
+            unexpected(s);
+            return NULL;
+        }
+        s->pos++;
+    } else if (s->src[s->pos] == ';') {
+        s->pos++;
+    }
+    return parse_loop_body(s, node, &node->a);
+}
+
+// name() BODY or function name [()] BODY, where BODY is compound
+static ScriptNode* parse_function(Scanner* s, int keyword) {
+    ScriptNode* node = new_node(s, NODE_FUNCTION);
+    if (!node) return NULL;
+    if (keyword) {
+        s->pos += 8;
+        skip_blanks(s);
+    }
+
+    size_t n = word_at(s);
+    if (n == 0) {
+        unexpected(s);
+        return NULL;
+    }
+    node->text = arena_strndup(&script_arena, s->src + s->pos, n);
+    s->pos += n;
+    skip_blanks(s);
+    if (s->src[s->pos] == '(') {
+        s->pos++;
+        skip_blanks(s);
+        if (s->src[s->pos] != ')') {
+            unexpected(s);
+            return NULL;
+        }
+        s->pos++;
+    } else if (!keyword) {
+        unexpected(s);
+        return NULL;
+    }
+    skip_newlines(s);
+
+    if (!compound_at(s)) {
+        unexpected(s);
+        return NULL;
+    }
+    node->a = parse_command(s);
+    return node->a && node->text ? node : NULL;
+}
+
+// name ( ) at the position
+static int function_at(Scanner* s) {
+    size_t n = word_at(s);
+    if (n == 0) return 0;
+
+    const char* p = s->src + s->pos + n;
+    while (is_blank(*p)) p++;
+    if (*p != '(') return 0;
+    p++;
+    while (is_blank(*p)) p++;
+    return *p == ')';
+}
+
+static ScriptNode* parse_command(Scanner* s) {
+    skip_blanks(s);
+    if (s->src[s->pos] == '\0') {
+        ran_out(s, 0);
+        return NULL;
+    }
+
+    if (compound_at(s)) s->depth++;
+    if (keyword_at(s, "if")) return finish_compound(s, parse_if(s, 2));
+    if (keyword_at(s, "for")) return finish_compound(s, parse_for(s));
+    if (keyword_at(s, "while") || keyword_at(s, "until")) {
+        int until = keyword_at(s, "until");
+        ScriptNode* node = new_node(s, until ? NODE_UNTIL : NODE_WHILE);
+        if (!node) return NULL;
+        s->pos += 5;
+        if (!(node->a = parse_body(s))) return NULL;
+        return finish_compound(s, parse_loop_body(s, node, &node->b));
+    }
+    if (keyword_at(s, "{")) {
+        ScriptNode* node = new_node(s, NODE_GROUP);
+        if (!node) return NULL;
+        s->pos += 1;
+        if (!(node->a = parse_body(s)) || !expect_close(s, "}")) return NULL;
+        return finish_compound(s, node);
+    }
+    if (keyword_at(s, "function")) return parse_function(s, 1);
+    if (at_list_end(s)) {
+        unexpected(s);
+        return NULL;
+    }
+    if (function_at(s)) return parse_function(s, 0);
+    return scan_leaf(s, 1);
+}
+
+// command [| command]... [&]: simple commands stay together in one leaf,
+// and a pipeline with a compound stage (or a compound command sent to
+// the background) becomes a NODE_PIPE of its stages
+static ScriptNode* parse_stages(Scanner* s) {
+    s->background = 0;
+    ScriptNode* stage = parse_command(s);
+    if (!stage || s->background) return stage;
+
+    skip_blanks(s);
+    TokenType op = TOK_WORD;
+    lex_operator(s->src + s->pos, &op);
+    if (op != TOK_PIPE && op != TOK_AMP) return stage;
+
+    ScriptNode* node = new_node(s, NODE_PIPE);
+    if (!node) return NULL;
+    node->a = stage;
+    for (;;) {
+        if (stage->type == NODE_FUNCTION) {
+            unexpected(s);
+            return NULL;
+        }
+        if (op != TOK_PIPE || s->background) break;
+
+        s->pos++;
+        skip_newlines(s);
+        if (!(stage->pipe = parse_command(s))) return NULL;
+        stage = stage->pipe;
+
+        skip_blanks(s);
+        op = TOK_WORD;
+        lex_operator(s->src + s->pos, &op);
+    }
+    if (op == TOK_AMP && !s->background) {
+        s->pos++;
+        s->background = 1;
+    }
+    node->background = s->background;
+    return node;
+}
+
+// [!] pipeline
+static ScriptNode* parse_pipeline(Scanner* s) {
+    skip_blanks(s);
+    if (!keyword_at(s, "!")) return parse_stages(s);
+
+    ScriptNode* node = new_node(s, NODE_NOT);
+    if (!node) return NULL;
+    s->pos++;
+    node->a = parse_stages(s);
+    return node->a ? node : NULL;
+}
+
+// pipeline [&& or || pipeline]..., left to right
+static ScriptNode* parse_and_or(Scanner* s) {
+    ScriptNode* left = parse_pipeline(s);
+    while (left) {
+        skip_blanks(s);
+        TokenType op = TOK_WORD;
+        lex_operator(s->src + s->pos, &op);
+        if (s->background || (op != TOK_AND_IF && op != TOK_OR_IF)) return left;
+
+        ScriptNode* node = new_node(s, op == TOK_AND_IF ? NODE_AND : NODE_OR);
+        if (!node) return NULL;
+        s->pos += 2;
+        skip_newlines(s);
+        node->a = left;
+        if (!(node->b = parse_pipeline(s))) return NULL;
+        left = node;
+    }
+    return NULL;
+}
+
+// Commands separated by ; & or newlines, up to the end of the text or a
+// word that closes the enclosing construct. NULL if empty.
+static ScriptNode* parse_list(Scanner* s) {
+    ScriptNode* head = NULL;
+    ScriptNode** tail = &head;
+
+    for (;;) {
+        skip_newlines(s);
+        if (at_list_end(s)) return head;
+
+        ScriptNode* node = parse_and_or(s);
+        if (!node) return NULL;
+        *tail = node;
+        tail = &node->next;
+
+        if (s->background) {
+            s->background = 0;
+            continue;
+        }
+        skip_blanks(s);
+        char c = s->src[s->pos];
+        if (c == ';' || c == '\n') {
+            s->pos++;
+            continue;
+        }
+        if (!at_list_end(s)) {
+            unexpected(s);
+            return NULL;
+        }
+        return head;
+    }
+}
+
+static ScriptNode* parse_program(Scanner* s) {
+    ScriptNode* tree = parse_list(s);
+    if (s->failed || s->incomplete) return NULL;
+    if (s->src[s->pos] != '\0') {
+        unexpected(s);
+        return NULL;
+    }
+    return tree;
+}
+
+// ==================== READING ====================
+// Copy the here-document delimiter from p to end, without its quotes,
+// to out
+static void copy_delimiter(const char* p, const char* end, char* out) {
+    char quote = 0;
+    for (; p < end; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+            else *out++ = *p;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == '\\') {
+            *out++ = *++p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// The lines after one with << operators are the bodies, read here as
+// they would be for a simple command. The operators are found with the
+// lexer, from where the last search stopped.
+static int read_heredoc_bodies(Shell* self) {
+    const char* p = text_buf + heredoc_scan;
+    char* delims = malloc(strlen(p) + LINE_HEREDOC_MAX);
+    if (!delims) {
+        perror("malloc");
+        return -1;
+    }
+
+    const char* starts[LINE_HEREDOC_MAX];
+    int strip[LINE_HEREDOC_MAX];
+    int count = 0;
+    char* w = delims;
+    for (;;) {
+        while (is_blank(*p) || *p == '\n') p++;
+        if (*p == '#') {
+            p += strcspn(p, "\n");
+            continue;
+        }
+        if (*p == '\0') break;
+
+        TokenType op = TOK_WORD;
+        const char* word = p + lex_operator(p, &op);
+        if (op == TOK_DLESS || op == TOK_DLESSDASH) {
+            while (is_blank(*word)) word++;
+        }
+        const char* end = lex_word_end(word);
+        if (!end) break;    // a quote left open: look again after the next line
+
+        if ((op == TOK_DLESS || op == TOK_DLESSDASH) && end > word && count < LINE_HEREDOC_MAX) {
+            starts[count] = w;
+            strip[count++] = op == TOK_DLESSDASH;
+            copy_delimiter(word, end, w);
+            w += strlen(w) + 1;
+        }
+        p = end;
+    }
+    heredoc_scan = p - text_buf;
+
+    const char* prompt = self->interactive ? "> " : NULL;
+    for (int h = 0; h < count; h++) {
+        for (;;) {
+            if (prompt) {
+                fputs(prompt, stdout);
+                fflush(stdout);
+            }
+            size_t len;
+            char* body = input_next_line(self->input, &len);
+            if (!body) break;
+            if (buffer_append(&body_buf, &body_len, &body_cap, body, len) < 0 ||
+                buffer_append(&body_buf, &body_len, &body_cap, "\n", 1) < 0) {
+                free(delims);
+                return -1;
+            }
+
+            const char* text = body;
+            while (strip[h] && *text == '\t') text++;
+            if (strcmp(text, starts[h]) == 0) break;
+        }
+
+        if (body_count == body_capacity) {
+            int capacity = body_capacity ? body_capacity * 2 : 8;
+            size_t* bigger = realloc(body_ends, capacity * sizeof(size_t));
+            if (!bigger) {
+                perror("realloc");
+                free(delims);
+                return -1;
+            }
+            body_ends = bigger;
+            body_capacity = capacity;
+        }
+        body_ends[body_count++] = body_len;
+    }
+    free(delims);
+    return 0;
+}
+
+static int word_is(const char* p, size_t n, const char* word) {
+    return n == strlen(word) && strncmp(p, word, n) == 0;
+}
+
+// How many of the open compound commands the line could close: its fi,
+// done and } words, less the if, for, while, until and { it surely
+// opens (first on the line or after ; & && || |). Never too few, so a
+// command that may be complete is always parsed; -1 with *unsure set
+// if the line ends inside a word.
+static int line_closes(const char* p, int* unsure) {
+    int closes = 0;
+    int command = 1;
+    for (;;) {
+        while (is_blank(*p)) p++;
+        if (*p == '\0' || *p == '#') return closes;
+
+        TokenType op = TOK_WORD;
+        size_t n = lex_operator(p, &op);
+        if (n > 0) {
+            command = op == TOK_SEMI || op == TOK_AMP || op == TOK_AND_IF ||
+                      op == TOK_OR_IF || op == TOK_PIPE || op == TOK_FANOUT;
+            p += n;
+            continue;
+        }
+
+        const char* end = lex_word_end(p);
+        if (!end) {
+            *unsure = 1;
+            return -1;
+        }
+        n = end - p;
+        if (word_is(p, n, "fi") || word_is(p, n, "done") || word_is(p, n, "}")) {
+            closes++;
+        } else if (command && (word_is(p, n, "if") || word_is(p, n, "for") ||
+                               word_is(p, n, "while") || word_is(p, n, "until") ||
+                               word_is(p, n, "{"))) {
+            closes--;
+        }
+        command = 0;
+        p = end;
+    }
+}
+
+int script_read(Shell* self, const char* line, ScriptNode** tree) {
+    *tree = NULL;
+    text_len = 0;
+    body_len = 0;
+    body_count = 0;
+    heredoc_scan = 0;
+
+    if (buffer_append(&text_buf, &text_len, &text_cap, line, strlen(line)) < 0 ||
+        read_heredoc_bodies(self) < 0) {
+        return -1;
+    }
+
+    // Parsing the text again for every line of a long compound command
+    // is quadratic: a script's lines are only parsed once they may close
+    // all it left open. A prompt still reports errors as they are typed.
+    int open = 0;
+    for (;;) {
+        if (open <= 0) {
+            Scanner s = {text_buf, 0, 0, 0, 0, 0, 0, 0};
+            *tree = parse_program(&s);
+            if (s.failed) return -1;
+            if (!s.incomplete) return 0;
+
+            // Drop the partial tree and read on
+            arena_reset(&script_arena);
+            open = self->interactive ? 0 : s.open;
+        }
+        if (self->interactive) {
+            fputs("> ", stdout);
+            fflush(stdout);
+        }
+        size_t len;
+        char* next = input_next_line(self->input, &len);
+        if (!next) {
+            fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+            return -1;
+        }
+        if (self->history && !is_empty_string(next)) history_add(self->history, next);
+        if (buffer_append(&text_buf, &text_len, &text_cap, "\n", 1) < 0 ||
+            buffer_append(&text_buf, &text_len, &text_cap, next, len) < 0 ||
+            read_heredoc_bodies(self) < 0) {
+            return -1;
+        }
+
+        int unsure = 0;
+        open -= line_closes(next, &unsure);
+        if (unsure) open = 0;
+    }
+}
+
+// ==================== FUNCTIONS ====================
+typedef struct Function {
+    char* name;
+    ScriptNode* body;
+    Arena arena;            // name and body
+    int running;            // calls in progress
+    struct Function* next;
+} Function;
+
+static Function* functions = NULL;
+// Redefined or unset while running; freed once the command is done
+static Function* retired = NULL;
+
+static void free_function(Function* f) {
+    arena_destroy(&f->arena);
+    free(f);
+}
+
+static char* clone_text(Arena* arena, const char* text, int* failed) {
+    if (!text) return NULL;
+
+    char* copy = arena_strdup(arena, text);
+    if (!copy) *failed = 1;
+    return copy;
+}
+
+static ScriptNode* clone_tree(Arena* arena, const ScriptNode* node, int* failed) {
+    if (!node || *failed) return NULL;
+
+    ScriptNode* copy = arena_alloc(arena, sizeof(ScriptNode));
+    if (!copy) {
+        *failed = 1;
+        return NULL;
+    }
+    copy->type = node->type;
+    copy->text = clone_text(arena, node->text, failed);
+    copy->words = clone_text(arena, node->words, failed);
+    copy->redirs = clone_text(arena, node->redirs, failed);
+    copy->heredocs = clone_text(arena, node->heredocs, failed);
+    copy->a = clone_tree(arena, node->a, failed);
+    copy->b = clone_tree(arena, node->b, failed);
+    copy->c = clone_tree(arena, node->c, failed);
+    copy->next = clone_tree(arena, node->next, failed);
+    copy->pipe = clone_tree(arena, node->pipe, failed);
+    copy->background = node->background;
+    return copy;
+}
+
+static Function* find_function(const char* name) {
+    for (Function* f = functions; f; f = f->next) {
+        if (strcmp(f->name, name) == 0) return f;
+    }
+    return NULL;
+}
+
+static void remove_function(const char* name) {
+    for (Function** link = &functions; *link; link = &(*link)->next) {
+        Function* f = *link;
+        if (strcmp(f->name, name) != 0) continue;
+
+        *link = f->next;
+        if (f->running) {
+            f->next = retired;
+            retired = f;
+        } else {
+            free_function(f);
+        }
+        return;
+    }
+}
+
+// The body is copied out of the command's tree, which goes at reset
+static int define_function(const char* name, const ScriptNode* body) {
+    Function* f = malloc(sizeof(Function));
+    if (!f) {
+        perror("malloc");
+        return 1;
+    }
+    arena_init(&f->arena, FUNCTION_ARENA_CHUNK);
+    f->running = 0;
+
+    int failed = 0;
+    f->name = clone_text(&f->arena, name, &failed);
+    f->body = clone_tree(&f->arena, body, &failed);
+    if (failed) {
+        perror("malloc");
+        free_function(f);
+        return 1;
+    }
+
+    remove_function(name);
+    f->next = functions;
+    functions = f;
+    return 0;
+}
+
+int script_unset_function(const char* name) {
+    remove_function(name);
+    return 0;
+}
+
+int script_is_function(const char* name) {
+    return functions && name && find_function(name);
+}
+
+// ==================== INTERPRETER ====================
+static int loop_depth = 0;
+static int function_depth = 0;
+static int break_levels = 0;       // loops left to break out of
+static int continue_levels = 0;    // loops to unwind before continuing
+static int returning = 0;
+static int interrupted = 0;        // a command died of SIGINT
+
+static void run_node(Shell* self, ScriptNode* node);
+
+static int unwinding(Shell* self) {
+    return !self->running || break_levels || continue_levels || returning || interrupted;
+}
+
+static void run_list(Shell* self, ScriptNode* node) {
+    for (; node && !unwinding(self); node = node->next) {
+        run_node(self, node);
+    }
+}
+
+// After a loop body: 1 if the loop is done
+static int end_of_body(Shell* self) {
+    if (break_levels > 0) {
+        break_levels--;
+        return 1;
+    }
+    if (continue_levels > 0 && --continue_levels > 0) return 1;
+    return unwinding(self);
+}
+
+// Redirections that hold while a compound command or function runs.
+// Builtins inside save and restore the shell's descriptors around their
+// own, so the frame keeps its saved set out of their way.
+typedef struct {
+    int outer[REDIR_MAX_FD + 1];
+    int outer_cloexec;
+    int mine[REDIR_MAX_FD + 1];
+    int mine_cloexec;
+} RedirFrame;
+
+static void clear_saved(Shell* self) {
+    for (int fd = 0; fd <= REDIR_MAX_FD; fd++) {
+        self->saved_fds[fd] = -1;
+    }
+    self->saved_cloexec = 0;
+}
+
+static int push_redirections(Shell* self, Command* cmd, RedirFrame* frame) {
+    memcpy(frame->outer, self->saved_fds, sizeof(frame->outer));
+    frame->outer_cloexec = self->saved_cloexec;
+    clear_saved(self);
+
+    int r = setup_redirections(self, cmd);
+    memcpy(frame->mine, self->saved_fds, sizeof(frame->mine));
+    frame->mine_cloexec = self->saved_cloexec;
+    clear_saved(self);
+    return r;
+}
+
+static void pop_redirections(Shell* self, RedirFrame* frame) {
+    fflush(stdout);
+    memcpy(self->saved_fds, frame->mine, sizeof(frame->mine));
+    self->saved_cloexec = frame->mine_cloexec;
+    restore_redirections(self);
+
+    memcpy(self->saved_fds, frame->outer, sizeof(frame->outer));
+    self->saved_cloexec = frame->outer_cloexec;
+}
+
+// Here-document bodies kept with the tree, fed to the parser's reader
+static int attach_heredocs(Command* cmd, const char* bodies) {
+    InputReader* in = input_open_string(bodies);
+    if (!in) {
+        perror("malloc");
+        return -1;
+    }
+    int r = parse_heredocs(cmd, in, NULL);
+    input_close(in);
+    return r;
+}
+
+// Parse ": text" for its expanded words or redirections
+static Command* parse_colon(Shell* self, const char* text, const char* heredocs) {
+    vars_set_status(self->last_status);
+    Command* cmd = NULL;
+    if (!parse_input(text, &cmd) || !cmd) {
+        self->last_status = 2;
+        return NULL;
+    }
+    if (heredocs && attach_heredocs(cmd, heredocs) < 0) {
+        command_destroy(cmd);
+        self->last_status = 1;
+        return NULL;
+    }
+    return cmd;
+}
+
+static void call_function(Shell* self, Function* f, Command* cmd) {
+    if (function_depth >= FUNCTION_DEPTH_MAX) {
+        fprintf(stderr, "myshell: %s: maximum function nesting level exceeded (%d)\n",
+                f->name, FUNCTION_DEPTH_MAX);
+        self->last_status = 1;
+        return;
+    }
+
+    // The arguments outlive the call's own tree, which may be a cached
+    // one that the body's commands push out of the cache
+    size_t size = cmd->argc * sizeof(char*);
+    for (int i = 1; i < cmd->argc; i++) size += strlen(cmd->argv[i]) + 1;
+    char** args = malloc(size);
+    if (!args) {
+        perror("malloc");
+        self->last_status = 1;
+        return;
+    }
+    char* w = (char*)(args + cmd->argc);
+    for (int i = 1; i < cmd->argc; i++) {
+        args[i - 1] = w;
+        w = stpcpy(w, cmd->argv[i]) + 1;
+    }
+
+    RedirFrame frame;
+    if (push_redirections(self, cmd, &frame) < 0 ||
+        var_assign(cmd->assigns, cmd->assign_count) < 0) {
+        pop_redirections(self, &frame);
+        free(args);
+        self->last_status = 1;
+        return;
+    }
+
+    char** outer_args;
+    int outer_count;
+    var_get_positional(&outer_args, &outer_count);
+    var_set_positional(args, cmd->argc - 1);
+    int outer_loops = loop_depth;
+    loop_depth = 0;
+    function_depth++;
+    f->running++;
+
+    self->last_status = 0;
+    run_node(self, f->body);
+
+    f->running--;
+    function_depth--;
+    loop_depth = outer_loops;
+    returning = 0;
+    var_set_positional(outer_args, outer_count);
+    pop_redirections(self, &frame);
+    free(args);
+}
+
+// Parse a pipeline (or take it from the cache) and run it; the memory
+// it parsed into is handed back right after
+static void run_leaf(Shell* self, ScriptNode* node) {
+    uint64_t start = stats_now();
+    ParseMark mark = parse_mark();
+    vars_set_status(self->last_status);
+
+    Command* cmd = parse_cache_lookup(node->text);
+    Command* cached = cmd;
+    int parsed = cached != NULL;
+    if (!cached) {
+        parsed = parse_input(node->text, &cmd);
+        if (parsed) parse_cache_store(node->text, cmd, parse_line_cacheable());
+    }
+    stats_since(STAT_PARSE, start);
+
+    if (!parsed) {
+        self->last_status = 2;
+    } else if (cmd) {
+        // A function in a pipeline, in the background or under run
+        // options runs in a subshell, like a builtin there
+        Function* f = NULL;
+        if (functions && !cmd->pipe_next && !cmd->background && !cmd->policy &&
+            cmd->argc > 0) {
+            f = find_function(cmd->argv[0]);
+        }
+
+        if (!cached && node->heredocs && attach_heredocs(cmd, node->heredocs) < 0) {
+            self->last_status = 1;
+        } else if (f) {
+            call_function(self, f, cmd);
+        } else {
+            execute_command(self, cmd);
+        }
+        if (!cached) command_destroy(cmd);
+    }
+
+    parse_rewind(mark);
+    wildcard_next_line();
+    if (self->last_status == 128 + SIGINT) interrupted = 1;
+}
+
+// How a compound stage shows in jobs and the log
+static char** stage_argv(NodeType type) {
+    static char* group[] = {"{ ... }", NULL};
+    static char* if_fi[] = {"if ... fi", NULL};
+    static char* for_done[] = {"for ... done", NULL};
+    static char* while_done[] = {"while ... done", NULL};
+    static char* until_done[] = {"until ... done", NULL};
+
+    switch (type) {
+        case NODE_IF: return if_fi;
+        case NODE_FOR: return for_done;
+        case NODE_WHILE: return while_done;
+        case NODE_UNTIL: return until_done;
+        default: return group;
+    }
+}
+
+// A pipeline with compound stages is one job: its leaves are parsed into
+// their commands, and a compound stage is a command whose body runs in a
+// forked subshell
+static void run_pipe(Shell* self, ScriptNode* node) {
+    ParseMark mark = parse_mark();
+    vars_set_status(self->last_status);
+
+    Command* head = NULL;
+    Command** tail = &head;
+    int status = 0;
+    for (ScriptNode* stage = node->a; stage && !status; stage = stage->pipe) {
+        Command* cmd = NULL;
+        if (stage->type != NODE_LEAF) {
+            if (!(cmd = create_command())) {
+                perror("malloc");
+                status = 1;
+                break;
+            }
+            cmd->argv = stage_argv(stage->type);
+            cmd->argc = 1;
+            cmd->body = stage;
+        } else if (!parse_input(stage->text, &cmd) || !cmd) {
+            status = 2;
+        } else if (stage->heredocs && attach_heredocs(cmd, stage->heredocs) < 0) {
+            status = 1;
+        } else if (cmd->argc == 0) {
+            fprintf(stderr, "myshell: syntax error near unexpected token `|'\n");
+            status = 2;
+        }
+
+        *tail = cmd;
+        while (*tail) tail = &(*tail)->pipe_next;
+    }
+
+    if (status) {
+        self->last_status = status;
+    } else {
+        head->background = node->background;
+        self->last_status = execute_pipeline(self, head);
+    }
+    command_destroy(head);
+    parse_rewind(mark);
+    wildcard_next_line();
+    if (self->last_status == 128 + SIGINT) interrupted = 1;
+}
+
+static void run_for(Shell* self, ScriptNode* node) {
+    ParseMark mark = parse_mark();
+    char** words;
+    int count;
+    Command* cmd = NULL;
+    if (node->words) {
+        if (!(cmd = parse_colon(self, node->words, NULL))) return;
+        words = cmd->argv + 1;
+        count = cmd->argc - 1;
+    } else {
+        var_get_positional(&words, &count);
+    }
+
+    int status = 0;
+    loop_depth++;
+    for (int i = 0; i < count; i++) {
+        if (var_set(node->text, words[i], 0) < 0) {
+            status = 1;
+            break;
+        }
+        run_list(self, node->a);
+        status = self->last_status;
+        if (end_of_body(self)) break;
+    }
+    loop_depth--;
+
+    self->last_status = status;
+    if (cmd) command_destroy(cmd);
+    parse_rewind(mark);
+}
+
+static void run_while(Shell* self, ScriptNode* node) {
+    int status = 0;
+    loop_depth++;
+    for (;;) {
+        run_list(self, node->a);
+        if (unwinding(self)) {
+            status = self->last_status;
+            if (end_of_body(self)) break;
+            continue;
+        }
+        if ((self->last_status == 0) == (node->type == NODE_UNTIL)) break;
+
+        run_list(self, node->b);
+        status = self->last_status;
+        if (end_of_body(self)) break;
+    }
+    loop_depth--;
+    self->last_status = status;
+}
+
+static void run_compound(Shell* self, ScriptNode* node) {
+    switch (node->type) {
+        case NODE_LEAF:
+            run_leaf(self, node);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            run_node(self, node->a);
+            if (!unwinding(self) && (self->last_status == 0) == (node->type == NODE_AND)) {
+                run_node(self, node->b);
+            }
+            break;
+        case NODE_NOT:
+            run_node(self, node->a);
+            self->last_status = !self->last_status;
+            break;
+        case NODE_IF:
+            run_list(self, node->a);
+            if (unwinding(self)) break;
+            if (self->last_status == 0) {
+                run_list(self, node->b);
+            } else if (node->c) {
+                run_list(self, node->c);
+            } else {
+                self->last_status = 0;
+            }
+            break;
+        case NODE_FOR:
+            run_for(self, node);
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            run_while(self, node);
+            break;
+        case NODE_GROUP:
+            run_list(self, node->a);
+            break;
+        case NODE_FUNCTION:
+            self->last_status = define_function(node->text, node->a);
+            break;
+        case NODE_PIPE:
+            run_pipe(self, node);
+            break;
+    }
+}
+
+static void run_node(Shell* self, ScriptNode* node) {
+    if (!node->redirs) {
+        run_compound(self, node);
+        return;
+    }
+
+    ParseMark mark = parse_mark();
+    Command* cmd = parse_colon(self, node->redirs, node->heredocs);
+    if (cmd) {
+        RedirFrame frame;
+        if (push_redirections(self, cmd, &frame) < 0) {
+            self->last_status = 1;
+        } else {
+            run_compound(self, node);
+        }
+        pop_redirections(self, &frame);
+        command_destroy(cmd);
+    }
+    parse_rewind(mark);
+}
+
+int script_run_stage(Shell* self, Command* cmd) {
+    Function* f = cmd->body ? NULL : find_function(cmd->argv[0]);
+    if (!cmd->body && !f) return execute_builtin(self, cmd);
+
+    if (f) {
+        call_function(self, f, cmd);
+    } else {
+        run_list(self, cmd->body);
+    }
+    return self->last_status;
+}
+
+Job* script_start(Shell* self, const char* text, int in_fd, int out_fd, pid_t pgid) {
+    ArenaMark tree_mark = arena_mark(&script_arena);
+    ParseMark mark = parse_mark();
+
+    // Nothing is read on, so there are no here-document bodies to hand out
+    Scanner s = {text, 0, 0, 0, 0, body_count, 0, 0};
+    ScriptNode* tree = parse_program(&s);
+    if (s.incomplete) {
+        fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+    }
+
+    Job* job = NULL;
+    Command* cmd = NULL;
+    int count = 0;
+    char* argv[] = {(char*)text, NULL};
+    if (!tree) {
+        // Empty, or a syntax error
+    } else if (tree->type == NODE_LEAF && !tree->next && !tree->heredocs) {
+        vars_set_status(self->last_status);
+        if (parse_input(tree->text, &cmd) && cmd) {
+            for (Command* stage = cmd; stage; stage = stage->pipe_next) {
+                stage->background = 0;
+                count++;
+            }
+        }
+    } else if ((cmd = create_command())) {
+        cmd->argv = argv;
+        cmd->argc = 1;
+        cmd->body = tree;
+        count = 1;
+    } else {
+        perror("malloc");
+    }
+
+    if (cmd && cmd->argc > 0) {
+        job = execute_start(self, cmd, count, in_fd, out_fd, pgid);
+    }
+    command_destroy(cmd);
+    parse_rewind(mark);
+    arena_rewind(&script_arena, tree_mark);
+    return job;
+}
+
+void script_execute(Shell* self, ScriptNode* tree) {
+    run_list(self, tree);
+
+    // break or continue outside a loop, or Ctrl-C, ends here
+    break_levels = 0;
+    continue_levels = 0;
+    interrupted = 0;
+}
+
+void script_reset(void) {
+    arena_reset(&script_arena);
+    while (retired) {
+        Function* next = retired->next;
+        free_function(retired);
+        retired = next;
+    }
+}
+
+void script_cleanup(void) {
+    script_reset();
+    arena_destroy(&script_arena);
+    while (functions) {
+        Function* next = functions->next;
+        free_function(functions);
+        functions = next;
+    }
+    free(text_buf);
+    text_buf = NULL;
+    text_len = text_cap = 0;
+    free(body_buf);
+    body_buf = NULL;
+    body_len = body_cap = 0;
+    free(body_ends);
+    body_ends = NULL;
+    body_count = body_capacity = 0;
+}
+
+// ==================== LOOP AND FUNCTION BUILTINS ====================
+// Optional count of break and continue, at least 1
+static int loop_count(Command* cmd, int* n) {
+    *n = 1;
+    if (cmd->argc < 2) return 0;
+
+    char* end;
+    long value = strtol(cmd->argv[1], &end, 10);
+    if (end == cmd->argv[1] || *end || value < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", cmd->argv[0], cmd->argv[1]);
+        return -1;
+    }
+    *n = value > loop_depth ? loop_depth : (int)value;
+    return 0;
+}
+
+int builtin_break(Shell* self, Command* cmd) {
+    (void)self; // Unused
+
+    int n;
+    if (loop_depth == 0) {
+        fprintf(stderr, "break: only meaningful in a loop\n");
+        return 0;
+    }
+    if (loop_count(cmd, &n) < 0) return 1;
+    break_levels = n;
+    return 0;
+}
+
+int builtin_continue(Shell* self, Command* cmd) {
+    (void)self; // Unused
+
+    int n;
+    if (loop_depth == 0) {
+        fprintf(stderr, "continue: only meaningful in a loop\n");
+        return 0;
+    }
+    if (loop_count(cmd, &n) < 0) return 1;
+    continue_levels = n;
+    return 0;
+}
+
+int builtin_return(Shell* self, Command* cmd) {
+    if (function_depth == 0) {
+        fprintf(stderr, "return: can only return from a function\n");
+        return 1;
+    }
+
+    int status = self->last_status;
+    if (cmd->argc > 1) {
+        char* end;
+        long value = strtol(cmd->argv[1], &end, 10);
+        if (end == cmd->argv[1] || *end) {
+            fprintf(stderr, "return: %s: numeric argument required\n", cmd->argv[1]);
+            value = 2;
+        }
+        status = (int)(value & 0xff);
+    }
+    returning = 1;
+    return status;
+}
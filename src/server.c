@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "shell.h"
+#include "execute.h"
+#include "input.h"
+
+// A worker that fails this soon after starting is restarted only after
+// a pause, so a broken setup cannot turn into a fork loop
+#define WORKER_MIN_LIFETIME_MS 1000
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static void on_stop(int sig) {
+    (void)sig;
+    server_stopping = 1;
+}
+
+// ==================== REQUEST HANDLING ====================
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Receive the header with the client's three stdio descriptors attached
+static int recv_request(int conn, ServerRequest* req, int fds[3]) {
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    // The rest of the header may follow the descriptors
+    if ((size_t)n < sizeof(*req) &&
+        read_full(conn, (char*)req + n, sizeof(*req) - n) < 0) {
+        goto fail;
+    }
+    if (req->magic != SERVER_MAGIC || req->cwd_len >= 4096 ||
+        req->text_len > SERVER_MAX_TEXT) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    for (int i = 0; i < 3; i++) close(fds[i]);
+    return -1;
+}
+
+// Run one request in a child forked from the worker's template shell; the
+// status is sent back once the commands are done, their output has been
+// written and the log has been flushed
+static void serve(Shell* shell, int conn) {
+    ServerRequest req;
+    int fds[3];
+    if (recv_request(conn, &req, fds) < 0) return;
+
+    char cwd[4096];
+    char* text = malloc(req.text_len + 1);
+    if (!text || read_full(conn, cwd, req.cwd_len) < 0 ||
+        read_full(conn, text, req.text_len) < 0) {
+        free(text);
+        for (int i = 0; i < 3; i++) close(fds[i]);
+        return;
+    }
+    cwd[req.cwd_len] = '\0';
+    text[req.text_len] = '\0';
+
+    // Take over the client's stdio, then run as a script would
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    int32_t status;
+    if (chdir(cwd) < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", cwd, strerror(errno));
+        status = 1;
+    } else {
+        input_close(shell->input);
+        shell->input = input_open_string(text);
+        shell_run(shell);
+        status = shell->running ? shell->last_status : shell->exit_status;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    free(text);
+
+    destroy_shell(shell);
+    send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+// ==================== WORKER POOL ====================
+// A worker initializes a template shell before any request arrives and
+// forks it for each connection, so a request pays for neither a process
+// start nor shell_init(), and starts from the same clean state: nothing
+// a request sets (variables, functions, options, jobs, caches) reaches
+// the next one. The template never runs a command, so it has no logger
+// or reaper thread that a fork would leave behind.
+static pid_t start_worker(int listen_fd) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0) return pid;
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    Shell* shell = create_shell();
+    if (!shell) _exit(1);
+    shell->input = input_open_string("");
+    shell_init(shell);
+
+    for (;;) {
+        int conn;
+        do {
+            conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        } while (conn < 0 && errno == EINTR);
+        if (conn < 0) {
+            perror("accept");
+            destroy_shell(shell);
+            _exit(1);
+        }
+
+        // One request at a time per worker, as the pool size promises
+        pid_t child = fork();
+        if (child == 0) {
+            close(listen_fd);
+            serve(shell, conn);
+            _exit(0);
+        }
+        close(conn);
+        if (child < 0) {
+            perror("fork");
+            continue;
+        }
+        while (waitpid(child, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+int server_run(const char* path, int workers) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "myshell: %s: socket path too long\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // Only this user may connect: requests run with our privileges
+    unlink(path);
+    mode_t old_mask = umask(077);
+    int bound = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || listen(listen_fd, 128) < 0) {
+        perror(path);
+        close(listen_fd);
+        return 1;
+    }
+
+    // No SA_RESTART: a stop request must interrupt waitpid()
+    struct sigaction sa = {0};
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pid_t* pool = calloc(workers, sizeof(pid_t));
+    long* started = calloc(workers, sizeof(long));
+    if (!pool || !started) {
+        perror("calloc");
+        free(pool);
+        free(started);
+        close(listen_fd);
+        return 1;
+    }
+    for (int i = 0; i < workers; i++) {
+        pool[i] = start_worker(listen_fd);
+        started[i] = now_ms();
+    }
+    fprintf(stderr, "myshell: serving %s with %d workers\n", path, workers);
+
+    // Replace every worker as soon as it exits
+    while (!server_stopping) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < workers; i++) {
+            if (pool[i] != pid) continue;
+
+            int failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            if (failed && now_ms() - started[i] < WORKER_MIN_LIFETIME_MS) {
+                sleep(1);
+            }
+            if (!server_stopping) {
+                pool[i] = start_worker(listen_fd);
+                started[i] = now_ms();
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pool[i] > 0) kill(pool[i], SIGTERM);
+    }
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+    }
+
+    close(listen_fd);
+    unlink(path);
+    free(pool);
+    free(started);
+    return 0;
+}
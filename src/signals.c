@@ -1,26 +1,23 @@
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 #include "signals.h"
 
 // ==================== SIGNAL HANDLERS ====================
-void sigchld_handler(int sig) {
-    (void)sig;
+// Children are reaped through the job table, so SIGCHLD keeps its
+// default disposition
+void setup_signal_handlers(int interactive) {
+    // Ignore SIGINT in parent
+    signal(SIGINT, SIG_IGN);
     
-    int status;
-    pid_t pid;
+    // Allow taking the terminal back from a foreground job
+    signal(SIGTTOU, SIG_IGN);
     
-    // Reap all zombie children
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        // Child reaped successfully
+    // Job control: Ctrl-Z and background reads stop jobs, not the shell
+    if (interactive) {
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
     }
-}
-
-void setup_signal_handlers() {
-    // Ignore SIGINT in parent
-    signal(SIGINT, SIG_IGN);
     
-    // Handle SIGCHLD to avoid zombies
-    signal(SIGCHLD, sigchld_handler);
+    signal(SIGCHLD, SIG_DFL);
 }
\ No newline at end of file
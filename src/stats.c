@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats.h"
+#include "parsecache.h"
+
+// ==================== HISTOGRAMS ====================
+// HDR-style log-linear buckets over nanoseconds: values below
+// STATS_SUB_COUNT are exact, above that every power of two is split in
+// STATS_SUB_COUNT buckets, so any reported value is within ~6% of the
+// real one. Up to 2^STATS_MAX_BITS ns (about 73 minutes).
+#define STATS_SUB_BITS 4
+#define STATS_SUB_COUNT (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS 42
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB_COUNT)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} Histogram;
+
+static Histogram histograms[STAT_COUNT];
+
+static const char* phase_names[STAT_COUNT] = {
+    "read", "parse", "lookup", "spawn", "run", "wait", "builtin", "log", "line"
+};
+
+static int bucket_of(uint64_t ns) {
+    if (ns < STATS_SUB_COUNT) return (int)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    if (msb >= STATS_MAX_BITS) return STATS_BUCKETS - 1;
+
+    int shift = msb - STATS_SUB_BITS;
+    int sub = (int)(ns >> shift) - STATS_SUB_COUNT;
+    return (shift + 1) * STATS_SUB_COUNT + sub;
+}
+
+// Highest value that lands in bucket b
+static uint64_t bucket_top(int b) {
+    if (b < STATS_SUB_COUNT) return b;
+
+    int shift = b / STATS_SUB_COUNT - 1;
+    uint64_t sub = b % STATS_SUB_COUNT;
+    return ((STATS_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void stats_record(StatPhase phase, uint64_t ns) {
+    Histogram* h = &histograms[phase];
+
+    __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, ns, __ATOMIC_RELAXED);
+    uint64_t n = __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t seen = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while ((n == 0 || ns < seen) &&
+           !__atomic_compare_exchange_n(&h->min, &seen, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    seen = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > seen &&
+           !__atomic_compare_exchange_n(&h->max, &seen, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_reset(void) {
+    memset(histograms, 0, sizeof(histograms));
+    parse_cache_reset_stats();
+}
+
+// Value at quantile q (0..1), capped by the largest value seen
+static uint64_t percentile(const Histogram* h, double q) {
+    if (h->count == 0) return 0;
+
+    uint64_t target = (uint64_t)(q * h->count + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= target) {
+            uint64_t top = bucket_top(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+// ==================== REPORTING ====================
+void stats_print(FILE* out) {
+    fprintf(out, "%-8s %9s %12s %10s %10s %10s %10s %10s\n",
+            "phase", "count", "total_ms", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+
+    for (int i = 0; i < STAT_COUNT; i++) {
+        const Histogram* h = &histograms[i];
+        if (h->count == 0) {
+            fprintf(out, "%-8s %9d %12s %10s %10s %10s %10s %10s\n",
+                    phase_names[i], 0, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-8s %9llu %12.3f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                phase_names[i], (unsigned long long)h->count,
+                h->total / 1e6, (double)h->total / h->count / 1e3,
+                percentile(h, 0.50) / 1e3, percentile(h, 0.90) / 1e3,
+                percentile(h, 0.99) / 1e3, h->max / 1e3);
+    }
+    parse_cache_print(out);
+}
+
+void stats_print_json(FILE* out) {
+    fprintf(out, "{\n  \"pid\": %d,\n  \"unit\": \"ns\",\n  \"phases\": {\n", (int)getpid());
+
+    for (int i = 0; i < STAT_COUNT; i++) {
+        const Histogram* h = &histograms[i];
+        fprintf(out, "    \"%s\": {\"count\": %llu, \"total\": %llu, \"min\": %llu, "
+                "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}%s\n",
+                phase_names[i], (unsigned long long)h->count,
+                (unsigned long long)h->total, (unsigned long long)h->min,
+                (unsigned long long)percentile(h, 0.50),
+                (unsigned long long)percentile(h, 0.90),
+                (unsigned long long)percentile(h, 0.99),
+                (unsigned long long)h->max,
+                i + 1 < STAT_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+    parse_cache_print_json(out);
+    fprintf(out, "\n}\n");
+}
+
+// MYSHELL_STATS=file writes the JSON report there at exit ("-" for stderr)
+void stats_dump_at_exit(void) {
+    const char* path = getenv("MYSHELL_STATS");
+    if (!path || !*path) return;
+
+    if (strcmp(path, "-") == 0) {
+        stats_print_json(stderr);
+        return;
+    }
+
+    FILE* out = fopen(path, "we");
+    if (!out) {
+        perror(path);
+        return;
+    }
+    stats_print_json(out);
+    fclose(out);
+}
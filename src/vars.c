@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "vars.h"
+
+extern char** environ;
+
+// ==================== VARIABLE TABLE ====================
+typedef struct Var {
+    char* entry;          // "NAME=value", also the environ string when exported
+    size_t name_len;
+    int env_index;        // position in env, -1 when not exported
+    uint32_t hash;
+    struct Var* next;
+} Var;
+
+static Var** buckets = NULL;
+static size_t bucket_count = 0;
+static size_t var_count = 0;
+
+// Exported entries, NULL-terminated; environ points here
+static char** env = NULL;
+static int env_count = 0;
+static int env_capacity = 0;
+static char** initial_environ = NULL;
+
+static char status_buf[16] = "0";
+static char pid_buf[16];
+
+static const char* shell_name = "myshell";   // $0
+static char** positional = NULL;
+static int positional_count = 0;
+static char count_buf[16];
+static char* joined_buf = NULL;        // $@ as one string, rebuilt on use
+static size_t joined_cap = 0;
+
+static uint32_t hash_name(const char* name, size_t len) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+size_t var_name_length(const char* s) {
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') return 0;
+
+    size_t len = 1;
+    while (isalnum((unsigned char)s[len]) || s[len] == '_') len++;
+    return len;
+}
+
+static Var* find_var(const char* name, size_t len, uint32_t h) {
+    if (!buckets) return NULL;
+
+    for (Var* v = buckets[h & (bucket_count - 1)]; v; v = v->next) {
+        if (v->hash == h && v->name_len == len && memcmp(v->entry, name, len) == 0) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+static int grow_table(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : 256;
+    Var** new_buckets = calloc(new_count, sizeof(Var*));
+    if (!new_buckets) return -1;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        Var* v = buckets[i];
+        while (v) {
+            Var* next = v->next;
+            size_t idx = v->hash & (new_count - 1);
+            v->next = new_buckets[idx];
+            new_buckets[idx] = v;
+            v = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+static char* make_entry(const char* name, size_t len, const char* value) {
+    size_t value_len = strlen(value);
+    char* entry = malloc(len + value_len + 2);
+    if (!entry) return NULL;
+
+    memcpy(entry, name, len);
+    entry[len] = '=';
+    memcpy(entry + len + 1, value, value_len + 1);
+    return entry;
+}
+
+// ==================== ENVIRONMENT ====================
+// Adding appends, removing moves the last entry into the hole: either
+// way only one slot changes
+static int env_add(Var* v) {
+    if (env_count + 1 >= env_capacity) {
+        int capacity = env_capacity ? env_capacity * 2 : 256;
+        char** bigger = realloc(env, capacity * sizeof(char*));
+        if (!bigger) return -1;
+        env = bigger;
+        env_capacity = capacity;
+        environ = env;
+    }
+
+    v->env_index = env_count;
+    env[env_count++] = v->entry;
+    env[env_count] = NULL;
+    return 0;
+}
+
+static void env_remove(Var* v) {
+    int last = env_count - 1;
+    if (v->env_index != last) {
+        char* moved = env[last];
+        Var* m = find_var(moved, strchr(moved, '=') - moved,
+                          hash_name(moved, strchr(moved, '=') - moved));
+        env[v->env_index] = moved;
+        if (m) m->env_index = v->env_index;
+    }
+    env[last] = NULL;
+    env_count = last;
+    v->env_index = -1;
+}
+
+void vars_init(void) {
+    if (env) return;
+
+    initial_environ = environ;
+    if (grow_table() < 0) return;
+
+    for (char** e = initial_environ; e && *e; e++) {
+        size_t len = var_name_length(*e);
+        if (len == 0 || (*e)[len] != '=') continue;
+
+        uint32_t h = hash_name(*e, len);
+        if (find_var(*e, len, h)) continue;
+
+        if (var_count + 1 > bucket_count * 3 / 4 && grow_table() < 0) break;
+        Var* v = malloc(sizeof(Var));
+        if (!v || !(v->entry = strdup(*e))) {
+            free(v);
+            break;
+        }
+        v->name_len = len;
+        v->hash = h;
+        v->next = buckets[h & (bucket_count - 1)];
+        buckets[h & (bucket_count - 1)] = v;
+        var_count++;
+        if (env_add(v) < 0) break;
+    }
+
+    // An empty environment still gets an array of its own
+    if (!env && (env = calloc(16, sizeof(char*)))) {
+        env_capacity = 16;
+        environ = env;
+    }
+}
+
+void vars_cleanup(void) {
+    for (size_t i = 0; i < bucket_count; i++) {
+        Var* v = buckets[i];
+        while (v) {
+            Var* next = v->next;
+            free(v->entry);
+            free(v);
+            v = next;
+        }
+    }
+    free(buckets);
+    buckets = NULL;
+    bucket_count = 0;
+    var_count = 0;
+
+    free(joined_buf);
+    joined_buf = NULL;
+    joined_cap = 0;
+    positional = NULL;
+    positional_count = 0;
+
+    // Anything reading the environment after this sees the startup one
+    if (env) environ = initial_environ;
+    free(env);
+    env = NULL;
+    env_count = 0;
+    env_capacity = 0;
+}
+
+// ==================== ACCESS ====================
+static const char* join_positional(void) {
+    size_t len = 1;
+    for (int i = 0; i < positional_count; i++) len += strlen(positional[i]) + 1;
+
+    if (len > joined_cap) {
+        char* bigger = realloc(joined_buf, len);
+        if (!bigger) return "";
+        joined_buf = bigger;
+        joined_cap = len;
+    }
+
+    char* w = joined_buf;
+    for (int i = 0; i < positional_count; i++) {
+        if (i > 0) *w++ = ' ';
+        size_t n = strlen(positional[i]);
+        memcpy(w, positional[i], n);
+        w += n;
+    }
+    *w = '\0';
+    return joined_buf;
+}
+
+const char* var_lookup(const char* name, size_t len) {
+    if (len == 1 && name[0] == '?') return status_buf;
+    if (len == 1 && name[0] == '$') {
+        snprintf(pid_buf, sizeof(pid_buf), "%d", (int)getpid());
+        return pid_buf;
+    }
+    if (len == 1 && name[0] == '#') {
+        snprintf(count_buf, sizeof(count_buf), "%d", positional_count);
+        return count_buf;
+    }
+    if (len == 1 && (name[0] == '@' || name[0] == '*')) return join_positional();
+    if (isdigit((unsigned char)name[0])) {
+        int n = 0;
+        for (size_t i = 0; i < len; i++) n = n * 10 + (name[i] - '0');
+        if (n == 0) return shell_name;
+        return n <= positional_count ? positional[n - 1] : NULL;
+    }
+
+    Var* v = find_var(name, len, hash_name(name, len));
+    return v ? v->entry + v->name_len + 1 : NULL;
+}
+
+const char* var_get(const char* name) {
+    return var_lookup(name, strlen(name));
+}
+
+static int set_var(const char* name, size_t len, const char* value, int export) {
+    uint32_t h = hash_name(name, len);
+    Var* v = find_var(name, len, h);
+
+    char* entry = make_entry(name, len, value);
+    if (!entry) {
+        perror("malloc");
+        return -1;
+    }
+
+    if (!v) {
+        if (var_count + 1 > bucket_count * 3 / 4 && grow_table() < 0) {
+            free(entry);
+            return -1;
+        }
+        v = malloc(sizeof(Var));
+        if (!v) {
+            free(entry);
+            return -1;
+        }
+        v->entry = entry;
+        v->name_len = len;
+        v->env_index = -1;
+        v->hash = h;
+        v->next = buckets[h & (bucket_count - 1)];
+        buckets[h & (bucket_count - 1)] = v;
+        var_count++;
+    } else {
+        free(v->entry);
+        v->entry = entry;
+        if (v->env_index >= 0) env[v->env_index] = entry;
+    }
+
+    if (export && v->env_index < 0 && env_add(v) < 0) {
+        perror("realloc");
+        return -1;
+    }
+    return 0;
+}
+
+int var_set(const char* name, const char* value, int export) {
+    size_t len = strlen(name);
+    if (len == 0 || var_name_length(name) != len) {
+        fprintf(stderr, "myshell: `%s': not a valid identifier\n", name);
+        return -1;
+    }
+    if (!buckets && grow_table() < 0) return -1;
+    return set_var(name, len, value, export);
+}
+
+int var_unexport(const char* name) {
+    size_t len = strlen(name);
+    Var* v = find_var(name, len, hash_name(name, len));
+    if (v && v->env_index >= 0) env_remove(v);
+    return 0;
+}
+
+int var_unset(const char* name) {
+    size_t len = strlen(name);
+    uint32_t h = hash_name(name, len);
+    if (!buckets) return 0;
+
+    for (Var** link = &buckets[h & (bucket_count - 1)]; *link; link = &(*link)->next) {
+        Var* v = *link;
+        if (v->hash != h || v->name_len != len || memcmp(v->entry, name, len) != 0) continue;
+
+        if (v->env_index >= 0) env_remove(v);
+        *link = v->next;
+        free(v->entry);
+        free(v);
+        var_count--;
+        return 0;
+    }
+    return 0;
+}
+
+int var_assign(char** assigns, int count) {
+    if (!buckets && grow_table() < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        size_t len = var_name_length(assigns[i]);
+        if (set_var(assigns[i], len, assigns[i] + len + 1, 0) < 0) return -1;
+    }
+    return 0;
+}
+
+// Copy of environ with the assignments put over it, for a command run as
+// NAME=value cmd. Only the pointer array is new.
+char** var_environ_with(char** assigns, int count) {
+    char** out = malloc((env_count + count + 1) * sizeof(char*));
+    if (!out) return NULL;
+
+    memcpy(out, env, env_count * sizeof(char*));
+    int n = env_count;
+    for (int i = 0; i < count; i++) {
+        const char* a = assigns[i];
+        size_t len = var_name_length(a);
+
+        Var* v = find_var(a, len, hash_name(a, len));
+        if (v && v->env_index >= 0) {
+            out[v->env_index] = assigns[i];
+            continue;
+        }
+
+        // A name given twice keeps the last value
+        int j = env_count;
+        while (j < n && strncmp(out[j], a, len + 1) != 0) j++;
+        out[j] = assigns[i];
+        if (j == n) n++;
+    }
+    out[n] = NULL;
+    return out;
+}
+
+char** var_environ_push(char** assigns, int count) {
+    char** pushed = var_environ_with(assigns, count);
+    if (pushed) environ = pushed;
+    return pushed;
+}
+
+void var_environ_pop(char** pushed) {
+    if (env) environ = env;
+    free(pushed);
+}
+
+void vars_set_status(int status) {
+    snprintf(status_buf, sizeof(status_buf), "%d", status);
+}
+
+void var_set_positional(char** args, int count) {
+    positional = args;
+    positional_count = count;
+}
+
+void var_get_positional(char*** args, int* count) {
+    *args = positional;
+    *count = positional_count;
+}
+
+void var_set_name(const char* name) {
+    shell_name = name;
+}
+
+// ==================== LISTING ====================
+static int compare_vars(const void* a, const void* b) {
+    const Var* va = *(Var* const*)a;
+    const Var* vb = *(Var* const*)b;
+    size_t len = va->name_len < vb->name_len ? va->name_len : vb->name_len;
+    int c = memcmp(va->entry, vb->entry, len);
+    return c ? c : (va->name_len > vb->name_len) - (va->name_len < vb->name_len);
+}
+
+// Values in single quotes, so the output can be read back in
+void var_print(FILE* out, int exported_only) {
+    Var** list = malloc((var_count ? var_count : 1) * sizeof(Var*));
+    if (!list) {
+        perror("malloc");
+        return;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        for (Var* v = buckets[i]; v; v = v->next) {
+            if (!exported_only || v->env_index >= 0) list[n++] = v;
+        }
+    }
+    qsort(list, n, sizeof(Var*), compare_vars);
+
+    for (size_t i = 0; i < n; i++) {
+        Var* v = list[i];
+        fprintf(out, "%s%.*s='", exported_only ? "export " : "", (int)v->name_len, v->entry);
+        for (const char* c = v->entry + v->name_len + 1; *c; c++) {
+            if (*c == '\'') {
+                fputs("'\\''", out);
+            } else {
+                fputc(*c, out);
+            }
+        }
+        fputs("'\n", out);
+    }
+    free(list);
+}
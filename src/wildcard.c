@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "wildcard.h"
+
+// ==================== MATCHING ====================
+// Length of the bracket expression starting at p, 0 if it is not closed
+// (an unclosed '[' is an ordinary character)
+static size_t bracket_length(const char* p) {
+    const char* q = p + 1;
+    if (*q == '!' || *q == '^') q++;
+    if (*q == ']') q++;   // a leading ']' is a member
+
+    while (*q && *q != ']') {
+        if (q[0] == '[' && q[1] == ':') {
+            const char* close = strstr(q + 2, ":]");
+            if (close) {
+                q = close + 2;
+                continue;
+            }
+        }
+        if (*q == '\\' && q[1]) q++;
+        q++;
+    }
+    return *q == ']' ? (size_t)(q + 1 - p) : 0;
+}
+
+static int class_match(const char* name, size_t len, int c) {
+    static const struct {
+        const char* name;
+        int (*test)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+        {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+        {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+        {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0) {
+            return classes[i].test(c) != 0;
+        }
+    }
+    return 0;
+}
+
+// Does c belong to the len-byte bracket expression at p
+static int bracket_match(const char* p, size_t len, unsigned char c) {
+    const char* end = p + len - 1;   // the closing ']'
+    const char* q = p + 1;
+    int negate = *q == '!' || *q == '^';
+    if (negate) q++;
+
+    int matched = 0;
+    while (q < end) {
+        if (q[0] == '[' && q[1] == ':') {
+            const char* close = strstr(q + 2, ":]");
+            if (close && close < end) {
+                if (class_match(q + 2, close - (q + 2), c)) matched = 1;
+                q = close + 2;
+                continue;
+            }
+        }
+
+        unsigned char lo = *q;
+        if (lo == '\\' && q + 1 < end) lo = *++q;
+        q++;
+        unsigned char hi = lo;
+        if (*q == '-' && q + 1 < end) {
+            hi = *++q;
+            if (hi == '\\' && q + 1 < end) hi = *++q;
+            q++;
+        }
+        if (lo <= c && c <= hi) matched = 1;
+    }
+    return matched != negate;
+}
+
+// Match one path component. A '*' remembers where it started and later
+// mismatches retry from one character further, so there is no recursion.
+static int match_component(const char* p, const char* s) {
+    const char* star_p = NULL;
+    const char* star_s = NULL;
+
+    while (*s) {
+        if (*p == '*') {
+            while (*p == '*') p++;
+            if (*p == '\0') return 1;
+            star_p = p;
+            star_s = s;
+            continue;
+        }
+
+        int ok;
+        size_t len;
+        if (*p == '?') {
+            ok = 1;
+            len = 1;
+        } else if (*p == '[' && (len = bracket_length(p)) > 0) {
+            ok = bracket_match(p, len, (unsigned char)*s);
+        } else {
+            size_t escape = *p == '\\' && p[1];
+            ok = p[escape] != '\0' && p[escape] == *s;
+            len = escape + 1;
+        }
+
+        if (ok) {
+            p += len;
+            s++;
+        } else if (star_p) {
+            p = star_p;
+            s = ++star_s;
+        } else {
+            return 0;
+        }
+    }
+
+    while (*p == '*') p++;
+    return *p == '\0';
+}
+
+int wildcard_has_magic(const char* p) {
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return 1;
+        } else if (*p == '[' && bracket_length(p) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ==================== DIRECTORY LISTINGS ====================
+// Listings are read with getdents64() into one name buffer per directory
+// and sorted once, so matching a directory of 100k files is a linear pass
+// and results come out in order. About LISTING_SLOTS listings are kept,
+// the least recently used one is rescanned into when another directory
+// is needed, and buffers are reused by the next scan.
+#define LISTING_SLOTS 64
+#define LISTING_MAX_BYTES (64UL * 1024 * 1024)
+#define DIRENT_BUF_SIZE (256 * 1024)
+
+// mtime has coarse granularity: a directory changed this recently before
+// its scan may change again without a new mtime, so it is not trusted
+#define LISTING_RACY_NS 1000000000LL
+
+typedef struct {
+    uint32_t offset;      // into names
+    unsigned char type;   // d_type
+} DirEntry;
+
+typedef struct {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int racy;
+    unsigned long checked_line;   // line the listing was last known current in
+    unsigned long last_used;
+    int pinned;                   // being walked, must not be reused
+
+    char* names;                  // NUL-terminated names back to back
+    size_t names_len;
+    size_t names_cap;
+    DirEntry* entries;            // sorted by name
+    size_t count;
+    size_t capacity;
+} DirListing;
+
+static DirListing** listings = NULL;
+static int listing_count = 0;
+static int listing_slots = 0;
+static size_t listing_bytes = 0;
+static unsigned long current_line = 1;
+static unsigned long use_clock = 0;
+static int session_cache = 0;
+static char* dirent_buf = NULL;
+
+void wildcard_next_line(void) {
+    current_line++;
+}
+
+void wildcard_set_session_cache(int enable) {
+    session_cache = enable;
+}
+
+int wildcard_session_cache(void) {
+    return session_cache;
+}
+
+static void free_listing(DirListing* l) {
+    listing_bytes -= l->names_cap + l->capacity * sizeof(DirEntry);
+    free(l->path);
+    free(l->names);
+    free(l->entries);
+    free(l);
+}
+
+// Room for one more entry whose name takes len bytes
+static int reserve_entry(DirListing* l, size_t len) {
+    if (l->names_len + len > l->names_cap) {
+        size_t cap = l->names_cap ? l->names_cap * 2 : 4096;
+        while (cap < l->names_len + len) cap *= 2;
+        char* bigger = realloc(l->names, cap);
+        if (!bigger) return -1;
+        listing_bytes += cap - l->names_cap;
+        l->names = bigger;
+        l->names_cap = cap;
+    }
+    if (l->count == l->capacity) {
+        size_t cap = l->capacity ? l->capacity * 2 : 128;
+        DirEntry* bigger = realloc(l->entries, cap * sizeof(DirEntry));
+        if (!bigger) return -1;
+        listing_bytes += (cap - l->capacity) * sizeof(DirEntry);
+        l->entries = bigger;
+        l->capacity = cap;
+    }
+    return 0;
+}
+
+static int compare_entries(const void* a, const void* b, void* names) {
+    return strcmp((const char*)names + ((const DirEntry*)a)->offset,
+                  (const char*)names + ((const DirEntry*)b)->offset);
+}
+
+// Read every entry but . and .. from the open directory fd
+static int scan_listing(DirListing* l, int fd) {
+    if (!dirent_buf) {
+        dirent_buf = malloc(DIRENT_BUF_SIZE);
+        if (!dirent_buf) return -1;
+    }
+
+    l->names_len = 0;
+    l->count = 0;
+    for (;;) {
+        ssize_t n = getdents64(fd, dirent_buf, DIRENT_BUF_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+
+        for (ssize_t pos = 0; pos < n;) {
+            struct dirent64* d = (struct dirent64*)(dirent_buf + pos);
+            pos += d->d_reclen;
+
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t len = strlen(name) + 1;
+            if (reserve_entry(l, len) < 0) return -1;
+            l->entries[l->count].offset = l->names_len;
+            l->entries[l->count].type = d->d_type;
+            l->count++;
+            memcpy(l->names + l->names_len, name, len);
+            l->names_len += len;
+        }
+    }
+
+    qsort_r(l->entries, l->count, sizeof(DirEntry), compare_entries, l->names);
+    return 0;
+}
+
+static DirListing* find_listing(const char* path) {
+    for (int i = 0; i < listing_count; i++) {
+        if (strcmp(listings[i]->path, path) == 0) return listings[i];
+    }
+    return NULL;
+}
+
+static DirListing* least_recent_listing(const DirListing* keep) {
+    DirListing* lru = NULL;
+    for (int i = 0; i < listing_count; i++) {
+        DirListing* l = listings[i];
+        if (l == keep || l->pinned) continue;
+        if (!lru || l->last_used < lru->last_used) lru = l;
+    }
+    return lru;
+}
+
+// A slot for path: a new one while under LISTING_SLOTS (or when every
+// listing is being walked), else the least recently used one
+static DirListing* claim_listing(const char* path) {
+    char* copy = strdup(path);
+    if (!copy) return NULL;
+
+    DirListing* l = listing_count >= LISTING_SLOTS ? least_recent_listing(NULL) : NULL;
+    if (l) {
+        free(l->path);
+        l->path = copy;
+        l->checked_line = 0;
+        return l;
+    }
+
+    if (listing_count == listing_slots) {
+        int slots = listing_slots ? listing_slots * 2 : 16;
+        DirListing** bigger = realloc(listings, slots * sizeof(DirListing*));
+        if (!bigger) {
+            free(copy);
+            return NULL;
+        }
+        listings = bigger;
+        listing_slots = slots;
+    }
+
+    l = calloc(1, sizeof(DirListing));
+    if (!l) {
+        free(copy);
+        return NULL;
+    }
+    l->path = copy;
+    listings[listing_count++] = l;
+    return l;
+}
+
+// Drop least recently used listings until the buffers fit the budget
+static void trim_listings(const DirListing* keep) {
+    while (listing_bytes > LISTING_MAX_BYTES) {
+        DirListing* lru = least_recent_listing(keep);
+        if (!lru) return;
+
+        for (int i = 0; i < listing_count; i++) {
+            if (listings[i] == lru) {
+                listings[i] = listings[--listing_count];
+                break;
+            }
+        }
+        free_listing(lru);
+    }
+}
+
+static int64_t timespec_ns(struct timespec ts) {
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Current listing of directory path, NULL if it cannot be read. Within a
+// line a listing is used as is; in a later line the session cache checks
+// that the directory is the same one with the same mtime.
+static DirListing* get_listing(const char* path) {
+    DirListing* l = find_listing(path);
+    struct stat st;
+
+    if (l && l->checked_line != current_line && session_cache && !l->racy &&
+        stat(path, &st) == 0 && st.st_dev == l->dev && st.st_ino == l->ino &&
+        timespec_ns(st.st_mtim) == timespec_ns(l->mtime)) {
+        l->checked_line = current_line;
+    }
+    if (l && l->checked_line == current_line) {
+        l->last_used = ++use_clock;
+        return l;
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0 || (!l && !(l = claim_listing(path)))) {
+        close(fd);
+        return NULL;
+    }
+
+    int scanned = scan_listing(l, fd);
+    close(fd);
+    if (scanned < 0) {
+        l->checked_line = 0;
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->racy = timespec_ns(now) - timespec_ns(st.st_mtim) < LISTING_RACY_NS;
+    l->checked_line = current_line;
+    l->last_used = ++use_clock;
+    trim_listings(l);
+    return l;
+}
+
+// ==================== EXPANSION ====================
+// The walk builds candidate paths in path_buf and collects matches in a
+// vector that is reused across calls; the strings go to the caller's arena.
+static Arena* result_arena = NULL;
+static char** found = NULL;
+static size_t found_count = 0;
+static size_t found_cap = 0;
+static int expand_failed = 0;
+
+static char* path_buf = NULL;
+static size_t path_cap = 0;
+static char* pattern_buf = NULL;
+static size_t pattern_cap = 0;
+static char** components = NULL;
+static int components_cap = 0;
+
+static int reserve_bytes(char** buf, size_t* cap, size_t need) {
+    if (need <= *cap) return 0;
+
+    size_t size = *cap ? *cap : 256;
+    while (size < need) size *= 2;
+    char* bigger = realloc(*buf, size);
+    if (!bigger) {
+        expand_failed = 1;
+        return -1;
+    }
+    *buf = bigger;
+    *cap = size;
+    return 0;
+}
+
+static void add_match(size_t len) {
+    if (found_count == found_cap) {
+        size_t cap = found_cap ? found_cap * 2 : 64;
+        char** bigger = realloc(found, cap * sizeof(char*));
+        if (!bigger) {
+            expand_failed = 1;
+            return;
+        }
+        found = bigger;
+        found_cap = cap;
+    }
+
+    char* copy = arena_strndup(result_arena, path_buf, len);
+    if (!copy) {
+        expand_failed = 1;
+        return;
+    }
+    found[found_count++] = copy;
+}
+
+// Append name to the base path and return the new length, leaving room
+// for a '/' after it; -1 on allocation failure
+static ssize_t append_name(size_t base_len, const char* name, int unescape) {
+    size_t len = strlen(name);
+    if (reserve_bytes(&path_buf, &path_cap, base_len + len + 2) < 0) return -1;
+
+    char* w = path_buf + base_len;
+    for (const char* r = name; *r; r++) {
+        if (unescape && *r == '\\' && r[1]) r++;
+        *w++ = *r;
+    }
+    *w = '\0';
+    return w - path_buf;
+}
+
+// Listing of the directory path_buf[0..base_len) names, which is empty
+// for the cwd and otherwise ends in '/'
+static DirListing* listing_at(size_t base_len) {
+    if (base_len == 0) return get_listing(".");
+    if (base_len == 1) {
+        path_buf[1] = '\0';
+        return get_listing(path_buf);
+    }
+
+    path_buf[base_len - 1] = '\0';
+    DirListing* l = get_listing(path_buf);
+    path_buf[base_len - 1] = '/';
+    return l;
+}
+
+// Is the entry now in path_buf a directory; symlinks count if follow is set
+static int entry_is_dir(unsigned char type, int follow) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) return 0;
+
+    struct stat st;
+    int r = follow ? stat(path_buf, &st) : lstat(path_buf, &st);
+    return r == 0 && S_ISDIR(st.st_mode);
+}
+
+static void expand_from(size_t base_len, char** comp, int n);
+
+// "**": the rest of the pattern in this directory and in every directory
+// below it; alone at the end it matches everything below. Hidden and
+// symlinked directories are not entered.
+static void expand_globstar(size_t base_len, char** comp, int n) {
+    if (n > 1) expand_from(base_len, comp + 1, n - 1);
+
+    DirListing* dir = listing_at(base_len);
+    if (!dir) return;
+
+    dir->pinned++;
+    for (size_t i = 0; i < dir->count && !expand_failed; i++) {
+        const char* name = dir->names + dir->entries[i].offset;
+        if (name[0] == '.') continue;
+
+        ssize_t len = append_name(base_len, name, 0);
+        if (len < 0) break;
+
+        int is_dir = entry_is_dir(dir->entries[i].type, 0);
+        if (n == 1) add_match(len);
+        if (is_dir) {
+            path_buf[len] = '/';
+            expand_globstar(len + 1, comp, n);
+        }
+    }
+    dir->pinned--;
+}
+
+// Match components comp[0..n) below the base path in path_buf
+static void expand_from(size_t base_len, char** comp, int n) {
+    if (expand_failed) return;
+
+    if (strcmp(comp[0], "**") == 0) {
+        // dir/** includes dir/ itself
+        if (n == 1 && base_len > 0) add_match(base_len);
+        expand_globstar(base_len, comp, n);
+        return;
+    }
+
+    // Literal components need no listing, only a final existence check
+    if (!wildcard_has_magic(comp[0])) {
+        ssize_t len = append_name(base_len, comp[0], 1);
+        if (len < 0) return;
+
+        struct stat st;
+        if (n > 1) {
+            path_buf[len] = '/';
+            expand_from(len + 1, comp + 1, n - 1);
+        } else if (lstat(path_buf, &st) == 0) {
+            add_match(len);
+        }
+        return;
+    }
+
+    DirListing* dir = listing_at(base_len);
+    if (!dir) return;
+
+    // Hidden names only match a pattern that starts with a dot
+    int dot_ok = comp[0][0] == '.' || (comp[0][0] == '\\' && comp[0][1] == '.');
+
+    dir->pinned++;
+    for (size_t i = 0; i < dir->count && !expand_failed; i++) {
+        const char* name = dir->names + dir->entries[i].offset;
+        if (name[0] == '.' && !dot_ok) continue;
+        if (!match_component(comp[0], name)) continue;
+
+        ssize_t len = append_name(base_len, name, 0);
+        if (len < 0) break;
+
+        if (n == 1) {
+            add_match(len);
+        } else if (entry_is_dir(dir->entries[i].type, 1)) {
+            path_buf[len] = '/';
+            expand_from(len + 1, comp + 1, n - 1);
+        }
+    }
+    dir->pinned--;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int wildcard_expand(const char* pattern, Arena* arena, char*** matches) {
+    *matches = NULL;
+    if (!wildcard_has_magic(pattern)) return 0;
+
+    expand_failed = 0;
+    size_t len = strlen(pattern);
+    if (reserve_bytes(&pattern_buf, &pattern_cap, len + 1) < 0 ||
+        reserve_bytes(&path_buf, &path_cap, 2) < 0) {
+        return -1;
+    }
+    memcpy(pattern_buf, pattern, len + 1);
+
+    // Absolute patterns start from "/"
+    char* p = pattern_buf;
+    size_t base_len = 0;
+    if (*p == '/') {
+        path_buf[base_len++] = '/';
+        while (*p == '/') p++;
+    }
+
+    // Split into components in place
+    int n = 0;
+    for (;;) {
+        if (n == components_cap) {
+            int cap = components_cap ? components_cap * 2 : 16;
+            char** bigger = realloc(components, cap * sizeof(char*));
+            if (!bigger) return -1;
+            components = bigger;
+            components_cap = cap;
+        }
+        components[n++] = p;
+
+        char* slash = strchr(p, '/');
+        if (!slash) break;
+        *slash = '\0';
+        p = slash + 1;
+    }
+
+    // One directory's matches are already in order
+    int sorted = strcmp(components[n - 1], "**") != 0;
+    for (int i = 0; i < n - 1; i++) {
+        if (wildcard_has_magic(components[i])) sorted = 0;
+    }
+
+    result_arena = arena;
+    found_count = 0;
+    expand_from(base_len, components, n);
+    if (expand_failed) return -1;
+    if (found_count == 0) return 0;
+
+    if (!sorted) qsort(found, found_count, sizeof(char*), compare_paths);
+
+    char** out = arena_alloc(arena, found_count * sizeof(char*));
+    if (!out) return -1;
+    memcpy(out, found, found_count * sizeof(char*));
+    *matches = out;
+    return found_count;
+}
+
+void wildcard_cleanup(void) {
+    for (int i = 0; i < listing_count; i++) {
+        free_listing(listings[i]);
+    }
+    free(listings);
+    listings = NULL;
+    listing_count = 0;
+    listing_slots = 0;
+
+    free(dirent_buf);
+    dirent_buf = NULL;
+    free(found);
+    found = NULL;
+    found_count = 0;
+    found_cap = 0;
+    free(path_buf);
+    path_buf = NULL;
+    path_cap = 0;
+    free(pattern_buf);
+    pattern_buf = NULL;
+    pattern_cap = 0;
+    free(components);
+    components = NULL;
+    components_cap = 0;
+}
@@ -0,0 +1,58 @@
+// Parser allocation check: after a warm-up line, parsing and releasing
+// further lines must not touch the heap.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+static unsigned long heap_calls = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* s);
+
+void* __wrap_malloc(size_t size) { heap_calls++; return __real_malloc(size); }
+void* __wrap_calloc(size_t nmemb, size_t size) { heap_calls++; return __real_calloc(nmemb, size); }
+void* __wrap_realloc(void* ptr, size_t size) { heap_calls++; return __real_realloc(ptr, size); }
+char* __wrap_strdup(const char* s) { heap_calls++; return __real_strdup(s); }
+
+static const char* lines[] = {
+    "ls -la /tmp",
+    "cat < in.txt | grep foo | sort -r > out.txt",
+    "sleep 1 &",
+    "echo a b c d e f g h >> log.txt",
+    "make 2>&1 >build.log | tee err.txt 3<> rw.txt &> all.txt",
+    "tr a-z A-Z <<< \"here string\" 4<&0 5>&-",
+    "wc -l src/*.c include/[a-m]*.h 'no*'match?",
+    "echo $HOME \"${USER}-$?\" $UNSET_VARIABLE_WITH_A_LONG_NAME x$$",
+};
+
+static void parse_line(const char* line) {
+    Command* cmd = NULL;
+    if (parse_input(line, &cmd) && cmd) {
+        command_destroy(cmd);
+    }
+    parse_reset();
+}
+
+int main(void) {
+    int n = sizeof(lines) / sizeof(lines[0]);
+
+    for (int i = 0; i < n; i++) {
+        parse_line(lines[i]);
+    }
+
+    unsigned long before = heap_calls;
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < n; i++) {
+            parse_line(lines[i]);
+        }
+    }
+    unsigned long steady = heap_calls - before;
+
+    printf("parse allocations: warm-up %lu, steady state %lu (%d lines)\n",
+           parse_heap_allocs(), steady, 1000 * n);
+    parse_cleanup();
+    return steady == 0 ? 0 : 1;
+}